@@ -0,0 +1,337 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* Compares worker processes forked from a zygote against independent
+ * processes that each call mocr_init(). Prints the time each setup takes to
+ * start and the memory it uses, as PSS summed from /proc/<pid>/smaps_rollup,
+ * so pages shared between processes are split between them instead of being
+ * counted once per process. Linux only.
+ *
+ * Usage: mocr_worker_bench [workers] [model] */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mocr.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 64
+
+/**
+ * @brief Gets the time from a monotonic clock
+ *
+ * @return The time in milliseconds since an unspecified point
+ */
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Gets the PSS of a process
+ *
+ * @param pid The process
+ * @return The PSS in kB, 0 if it can't be read
+ */
+static long process_pss(pid_t pid)
+{
+    char path[64];
+    char line[256];
+    long pss = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "Pss: %ld kB", &pss) == 1)
+        {
+            break;
+        }
+    }
+    fclose(file);
+    return pss;
+}
+
+/**
+ * @brief Gets the parent of a process
+ *
+ * @param pid The process
+ * @return The parent, 0 if it can't be read
+ */
+static pid_t parent_of(pid_t pid)
+{
+    char path[64];
+    char stat[512];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    size_t size = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[size] = '\0';
+
+    /* The name in parentheses can hold spaces, so skip past the last one */
+    char *end = strrchr(stat, ')');
+    int ppid = 0;
+    if (end == NULL || sscanf(end + 1, " %*c %d", &ppid) != 1)
+    {
+        return 0;
+    }
+    return (pid_t)ppid;
+}
+
+/**
+ * @brief Gets the PSS of a process and every process descended from it
+ *
+ * @param pid The process
+ * @return The PSS in kB
+ */
+static long tree_pss(pid_t pid)
+{
+    long pss = process_pss(pid);
+
+    DIR *proc = opendir("/proc");
+    if (proc == NULL)
+    {
+        return pss;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(proc)))
+    {
+        pid_t child = (pid_t)atoi(entry->d_name);
+        if (child > 0 && parent_of(child) == pid)
+        {
+            pss += tree_pss(child);
+        }
+    }
+    closedir(proc);
+    return pss;
+}
+
+/**
+ * @brief Reads an image in every worker, so each has touched the model
+ *
+ * @param ctx The mangaocr context
+ * @param workers The number of workers
+ */
+static void warm_up(mocr_ctx *ctx, int workers)
+{
+    unsigned char image[64 * 48];
+    for (size_t i = 0; i < sizeof(image); ++i)
+    {
+        image[i] = (unsigned char)(i * 7);
+    }
+    for (int i = 0; i < workers * 2; ++i)
+    {
+        mocr_free(mocr_read(ctx, image, 64, 48, mocr_mode_L));
+    }
+}
+
+/**
+ * @brief Runs as one of the independent processes. Loads the model, reports
+ * that it's ready, and waits for stdin to close.
+ *
+ * @param model The model to load
+ * @return The exit status
+ */
+static int run_independent(const char *model)
+{
+    mocr_ctx *ctx = mocr_init(model, 0);
+    if (ctx == NULL)
+    {
+        return 1;
+    }
+    warm_up(ctx, 1);
+    puts("ready");
+    fflush(stdout);
+
+    char c;
+    while (fread(&c, 1, 1, stdin) == 1)
+    {
+    }
+    mocr_destroy(ctx);
+    return 0;
+}
+
+/**
+ * @brief Starts processes that each call mocr_init() in a fresh interpreter
+ * and waits for all of them to be ready
+ *
+ * @param self The path of this program
+ * @param model The model to load
+ * @param count The number of processes to start
+ * @param[out] pids Receives the processes
+ * @param[out] stdins Receives the write ends of their stdin
+ * @return 0 on success, nonzero on error
+ */
+static int start_independent(
+    const char *self, const char *model, int count, pid_t *pids, int *stdins)
+{
+    FILE *readies[MAX_WORKERS];
+
+    for (int i = 0; i < count; ++i)
+    {
+        int in[2], out[2];
+        if (pipe(in) || pipe(out))
+        {
+            return -1;
+        }
+
+        /* Later processes mustn't hold this one's stdin open */
+        fcntl(in[1], F_SETFD, FD_CLOEXEC);
+        fcntl(out[0], F_SETFD, FD_CLOEXEC);
+        pids[i] = fork();
+        if (pids[i] < 0)
+        {
+            return -1;
+        }
+        if (pids[i] == 0)
+        {
+            dup2(in[0], STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            close(in[0]);
+            close(in[1]);
+            close(out[0]);
+            close(out[1]);
+            execl(self, self, "--independent", model, (char *)NULL);
+            _exit(127);
+        }
+        close(in[0]);
+        close(out[1]);
+        stdins[i] = in[1];
+        readies[i] = fdopen(out[0], "r");
+    }
+
+    /* They load in parallel, like workers started together would */
+    int ret = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        char line[16];
+        if (readies[i] == NULL ||
+            fgets(line, sizeof(line), readies[i]) == NULL ||
+            strcmp(line, "ready\n"))
+        {
+            ret = -1;
+        }
+        if (readies[i])
+        {
+            fclose(readies[i]);
+        }
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "--independent") == 0)
+    {
+        return run_independent(argv[2]);
+    }
+
+    int workers = argc > 1 ? atoi(argv[1]) : 4;
+    const char *model = argc > 2 ? argv[2] : DEFAULT_MODEL;
+    if (workers < 1 || workers > MAX_WORKERS)
+    {
+        fprintf(stderr, "usage: %s [workers] [model]\n", argv[0]);
+        return 2;
+    }
+
+    double start = now_ms();
+    mocr_ctx *ctx = mocr_init(model, 0);
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "mocr_init() failed\n");
+        return 1;
+    }
+    double init_ms = now_ms() - start;
+    long host_pss = tree_pss(getpid());
+
+    start = now_ms();
+    if (mocr_set_option(ctx, mocr_option_worker_processes, 1))
+    {
+        fprintf(stderr, "worker processes aren't supported\n");
+        mocr_destroy(ctx);
+        return 1;
+    }
+    double zygote_ms = now_ms() - start;
+    start = now_ms();
+    if (mocr_set_option(ctx, mocr_option_worker_processes, workers))
+    {
+        fprintf(stderr, "couldn't fork %d workers\n", workers);
+        mocr_destroy(ctx);
+        return 1;
+    }
+    double grow_ms = now_ms() - start;
+    warm_up(ctx, workers);
+    long zygote_pss = tree_pss(getpid());
+    mocr_destroy(ctx);
+
+    pid_t pids[MAX_WORKERS];
+    int stdins[MAX_WORKERS];
+    start = now_ms();
+    int ret = start_independent(argv[0], model, workers, pids, stdins);
+    double independent_ms = now_ms() - start;
+    long independent_pss = 0;
+    for (int i = 0; i < workers; ++i)
+    {
+        independent_pss += tree_pss(pids[i]);
+    }
+    for (int i = 0; i < workers; ++i)
+    {
+        close(stdins[i]);
+        waitpid(pids[i], NULL, 0);
+    }
+    if (ret)
+    {
+        fprintf(stderr, "an independent process failed to start\n");
+        return 1;
+    }
+
+    printf("mocr_init in the host:              %8.1f ms\n", init_ms);
+    printf("first worker, starting the zygote:  %8.1f ms\n", zygote_ms);
+    printf("growing from 1 to %2d workers:       %8.1f ms\n", workers, grow_ms);
+    printf("%2d independent processes ready:     %8.1f ms\n",
+        workers, independent_ms);
+    printf("host alone:                         %8ld MiB PSS\n",
+        host_pss / 1024);
+    printf("host, zygote and %2d workers:        %8ld MiB PSS\n",
+        workers, zygote_pss / 1024);
+    printf("%2d independent processes:           %8ld MiB PSS\n",
+        workers, independent_pss / 1024);
+    return 0;
+}
@@ -24,8 +24,106 @@
 
 using namespace mocr;
 
+namespace
+{
+
+/* A C++ callback waiting for an asynchronous read */
+struct pending_read
+{
+    mocr::read_callback callback;
+    void *userdata;
+};
+
+/**
+ * @brief Passes the text of an asynchronous read on to its C++ callback
+ *
+ * @param request The read that finished
+ * @param text The text, NULL on error
+ * @param userdata The pending_read of the read
+ */
+void finish_read(mocr_request *request, char *text, void *userdata)
+{
+    (void)request;
+    pending_read *pending = static_cast<pending_read *>(userdata);
+
+    /* Exceptions can't cross the C callback */
+    try
+    {
+        std::string str;
+        if (text)
+        {
+            str = text;
+        }
+        pending->callback(std::move(str), pending->userdata);
+    }
+    catch (...)
+    {
+
+    }
+    mocr_free(text);
+    delete pending;
+}
+
+/**
+ * @brief Finishes starting an asynchronous read
+ *
+ * @param request The read, NULL if it couldn't be started
+ * @param pending The pending_read the read was started with
+ * @return true if the read was started
+ */
+bool started(mocr_request *request, pending_read *pending)
+{
+    if (request == nullptr)
+    {
+        delete pending;
+        return false;
+    }
+
+    /* The read finishes without the handle */
+    mocr_request_free(request);
+    return true;
+}
+
+/**
+ * @brief Fulfills the promise of an asynchronous read
+ *
+ * @param text The text
+ * @param userdata The promise, which is deleted
+ */
+void fulfill(std::string &&text, void *userdata)
+{
+    std::promise<std::string> *promise =
+        static_cast<std::promise<std::string> *>(userdata);
+    promise->set_value(std::move(text));
+    delete promise;
+}
+
+/**
+ * @brief Gets the future of a promise that might not have been handed to a
+ * read
+ *
+ * @param promise The promise, deleted if it wasn't handed over
+ * @param future The future of the promise
+ * @param handed_over true if the read was started with the promise
+ * @return The future, ready with an empty string if the read wasn't started
+ */
+std::future<std::string> future_of(
+    std::promise<std::string> *promise,
+    std::future<std::string> future,
+    bool handed_over)
+{
+    if (!handed_over)
+    {
+        promise->set_value("");
+        delete promise;
+    }
+    return future;
+}
+
+}
+
 model::model(const char *path, bool force_cpu)
-    : m_ctx(mocr_init(path, force_cpu))
+    : m_ctx(mocr_init(path, force_cpu)), m_owner(true)
 {
 
 }
@@ -36,9 +134,18 @@ model::model(const std::string &path, bool force_cpu)
 
 }
 
+model::model(mocr_ctx *ctx)
+    : m_ctx(ctx), m_owner(false)
+{
+
+}
+
 model::~model()
 {
-    mocr_destroy(m_ctx);
+    if (m_owner)
+    {
+        mocr_destroy(m_ctx);
+    }
 }
 
 bool model::valid() const
@@ -51,11 +158,51 @@ bool model::operator!() const
     return !valid();
 }
 
+bool model::set_option(mocr::option opt, int64_t value)
+{
+    return mocr_set_option(m_ctx, static_cast<mocr_option>(opt), value) == 0;
+}
+
+bool model::get_option(mocr::option opt, int64_t &value) const
+{
+    return mocr_get_option(m_ctx, static_cast<mocr_option>(opt), &value) == 0;
+}
+
+bool model::get_cache_stats(mocr::cache_stats &stats) const
+{
+    mocr_cache_stats c_stats;
+    if (mocr_get_cache_stats(m_ctx, &c_stats))
+    {
+        return false;
+    }
+    stats.hits = c_stats.hits;
+    stats.misses = c_stats.misses;
+    stats.entries = c_stats.entries;
+    stats.bytes = c_stats.bytes;
+    return true;
+}
+
+bool model::set_file_cache(const char *path)
+{
+    return mocr_set_file_cache(m_ctx, path) == 0;
+}
+
+bool model::set_file_cache(const std::string &path)
+{
+    return set_file_cache(path.c_str());
+}
+
 std::string model::read(
     void *data, size_t width, size_t height, mocr::mode mode)
 {
-    char *str = mocr_read(
-        m_ctx, data, width, height, static_cast<mocr_mode>(mode)
+    return read(data, width, height, 0, mode);
+}
+
+std::string model::read(
+    void *data, size_t width, size_t height, size_t stride, mocr::mode mode)
+{
+    char *str = mocr_read_strided(
+        m_ctx, data, width, height, stride, static_cast<mocr_mode>(mode)
     );
     if (str == NULL)
     {
@@ -85,6 +232,273 @@ std::string model::read(const std::string &path)
     return read(path.c_str());
 }
 
+std::string model::read(const void *bytes, size_t size)
+{
+    char *str = mocr_read_encoded(m_ctx, bytes, size);
+    if (str == NULL)
+    {
+        return "";
+    }
+    std::string text(str);
+    mocr_free(str);
+    str = nullptr;
+    return text;
+}
+
+std::vector<std::string> model::read(const std::vector<mocr::image> &images)
+{
+    std::vector<mocr_image> c_images(images.size());
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        c_images[i].data = images[i].data;
+        c_images[i].width = images[i].width;
+        c_images[i].height = images[i].height;
+        c_images[i].stride = images[i].stride;
+        c_images[i].mode = static_cast<mocr_mode>(images[i].mode);
+    }
+
+    std::vector<char *> strs(images.size(), nullptr);
+    if (mocr_read_batch(m_ctx, c_images.data(), images.size(), strs.data()))
+    {
+        return {};
+    }
+
+    std::vector<std::string> texts;
+    texts.reserve(strs.size());
+    for (char *str : strs)
+    {
+        texts.emplace_back(str);
+        mocr_free(str);
+    }
+    return texts;
+}
+
+bool model::read_async(
+    void *data,
+    size_t width,
+    size_t height,
+    mocr::mode mode,
+    mocr::read_callback callback,
+    void *userdata)
+{
+    if (callback == nullptr)
+    {
+        return false;
+    }
+    pending_read *pending = new pending_read{callback, userdata};
+    return started(
+        mocr_read_async(
+            m_ctx, data, width, height, static_cast<mocr_mode>(mode),
+            finish_read, pending
+        ),
+        pending
+    );
+}
+
+bool model::read_async(
+    const char *path, mocr::read_callback callback, void *userdata)
+{
+    if (callback == nullptr)
+    {
+        return false;
+    }
+    pending_read *pending = new pending_read{callback, userdata};
+    return started(
+        mocr_read_file_async(m_ctx, path, finish_read, pending), pending
+    );
+}
+
+std::future<std::string> model::read_async(
+    void *data, size_t width, size_t height, mocr::mode mode)
+{
+    std::promise<std::string> *promise = new std::promise<std::string>();
+    std::future<std::string> future = promise->get_future();
+    bool handed_over =
+        read_async(data, width, height, mode, fulfill, promise);
+    return future_of(promise, std::move(future), handed_over);
+}
+
+std::future<std::string> model::read_async(const std::string &path)
+{
+    std::promise<std::string> *promise = new std::promise<std::string>();
+    std::future<std::string> future = promise->get_future();
+    bool handed_over = read_async(path.c_str(), fulfill, promise);
+    return future_of(promise, std::move(future), handed_over);
+}
+
+page::page(
+    model &model,
+    void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr::mode mode)
+    : m_page(
+        mocr_page_create(
+            model.m_ctx, data, width, height, stride,
+            static_cast<mocr_mode>(mode)
+        )
+    )
+{
+
+}
+
+page::~page()
+{
+    mocr_page_destroy(m_page);
+}
+
+bool page::valid() const
+{
+    return m_page != nullptr;
+}
+
+bool page::operator!() const
+{
+    return !valid();
+}
+
+std::vector<std::string> page::read(const std::vector<mocr::rect> &rects)
+{
+    std::vector<mocr_rect> c_rects(rects.size());
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        c_rects[i].x = rects[i].x;
+        c_rects[i].y = rects[i].y;
+        c_rects[i].width = rects[i].width;
+        c_rects[i].height = rects[i].height;
+    }
+
+    std::vector<char *> strs(rects.size(), nullptr);
+    if (mocr_read_regions(m_page, c_rects.data(), rects.size(), strs.data()))
+    {
+        return {};
+    }
+
+    std::vector<std::string> texts;
+    texts.reserve(strs.size());
+    for (char *str : strs)
+    {
+        texts.emplace_back(str);
+        mocr_free(str);
+    }
+    return texts;
+}
+
+pool::lease::lease(mocr_pool *pool, mocr::model *model)
+    : m_pool(pool), m_model(model)
+{
+
+}
+
+pool::lease::lease(lease &&other)
+    : m_pool(other.m_pool), m_model(other.m_model)
+{
+    other.m_model = nullptr;
+}
+
+pool::lease::~lease()
+{
+    if (m_model)
+    {
+        mocr_pool_release(m_pool, m_model->m_ctx);
+    }
+}
+
+bool pool::lease::valid() const
+{
+    return m_model != nullptr;
+}
+
+bool pool::lease::operator!() const
+{
+    return !valid();
+}
+
+model &pool::lease::operator*() const
+{
+    return *m_model;
+}
+
+model *pool::lease::operator->() const
+{
+    return m_model;
+}
+
+pool::pool(const char *path, bool force_cpu, size_t size)
+    : m_pool(mocr_pool_create(path, force_cpu, size))
+{
+    if (m_pool == nullptr)
+    {
+        return;
+    }
+    for (size_t i = 0; i < size; ++i)
+    {
+        m_models.emplace_back(new model(mocr_pool_context(m_pool, i)));
+    }
+}
+
+pool::pool(const std::string &path, bool force_cpu, size_t size)
+    : pool(path.c_str(), force_cpu, size)
+{
+
+}
+
+pool::~pool()
+{
+    mocr_pool_destroy(m_pool);
+}
+
+bool pool::valid() const
+{
+    return m_pool != nullptr;
+}
+
+bool pool::operator!() const
+{
+    return !valid();
+}
+
+size_t pool::size() const
+{
+    return m_models.size();
+}
+
+model &pool::at(size_t index)
+{
+    return *m_models.at(index);
+}
+
+pool::lease pool::acquire(int64_t timeout_us)
+{
+    if (m_pool == nullptr)
+    {
+        return lease(m_pool, nullptr);
+    }
+    mocr_ctx *ctx = mocr_pool_acquire(m_pool, timeout_us);
+    for (const std::unique_ptr<model> &model : m_models)
+    {
+        if (model->m_ctx == ctx)
+        {
+            return lease(m_pool, model.get());
+        }
+    }
+    return lease(m_pool, nullptr);
+}
+
+bool pool::get_stats(size_t index, mocr::pool_stats &stats) const
+{
+    mocr_pool_stats c_stats;
+    if (mocr_pool_get_stats(m_pool, index, &c_stats))
+    {
+        return false;
+    }
+    stats.checkouts = c_stats.checkouts;
+    stats.busy_us = c_stats.busy_us;
+    stats.busy = c_stats.busy != 0;
+    return true;
+}
+
 bool mocr::finalize(void)
 {
     return mocr_finalize() == 0;
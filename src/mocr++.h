@@ -21,11 +21,29 @@
 #ifndef MOCRXX_H
 #define MOCRXX_H
 
+#include <cstdint>
+#include <future>
+#include <memory>
 #include <string>
+#include <vector>
+
+/* co_await model.read_co() needs C++20 coroutines */
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define MOCRXX_HAVE_COROUTINES
+#endif
+#endif
 
 /* Forward Declaration of the C mangaocr context struct */
 struct mocr_ctx;
 
+/* Forward Declaration of the C mangaocr page struct */
+struct mocr_page;
+
+/* Forward Declaration of the C mangaocr pool struct */
+struct mocr_pool;
+
 namespace mocr
 {
 
@@ -34,13 +52,15 @@ namespace mocr
  */
 enum class mode
 {
-    /* 1-bit pixels, black and white, stored with one pixel per byte */
+    /* 1-bit pixels, black and white, stored with one pixel per byte. Zero is
+     * black and any other value is white. */
     One,
 
     /* 8-bit pixels, black and white */
     L,
 
-    /* 8-bit pixels, mapped to any other mode using a color palette */
+    /* 8-bit pixels, mapped to any other mode using a color palette. No palette
+     * can be supplied, so the indices are read as grayscale. */
     P,
 
     /* 3x8-bit pixels, true color */
@@ -55,7 +75,7 @@ enum class mode
     /* 3x8-bit pixels, color video format */
     YCbCr,
 
-    /* 3x8-bit pixels, the L*a*b color space */
+    /* 3x8-bit pixels, the L*a*b color space. Only the L* band is read. */
     LAB,
 
     /* 3x8-bit pixels, Hue, Saturation, Value color space */
@@ -66,8 +86,167 @@ enum class mode
 
     /* 32-bit floating point pixels */
     F,
+
+    /* 1-bit pixels, black and white, packed 8 to a byte with the most
+     * significant bit first. Each row starts on a new byte. */
+    OnePacked,
+};
+
+/**
+ * @brief Defines the options that can be set on a model
+ */
+enum class option
+{
+    /* Nonzero to convert, resize, and normalize image buffers in C instead of
+     * with PIL and the model's image processor. This requires PyTorch and an
+     * image processor that resizes bilinearly. Defaults to 0. */
+    NativePreprocess,
+
+    /* The most concurrent reads of image buffers that are coalesced into a
+     * single batch. Calls still block until their own text is read. 1
+     * disables coalescing. Defaults to 1. */
+    BatchSize,
+
+    /* How long in microseconds the oldest coalesced read waits for a batch to
+     * fill before it's read anyway. Defaults to 5000. */
+    BatchWaitUs,
+
+    /* The number of internal threads that make every call into Python for the
+     * model. 0 makes calls on the calling thread. Defaults to 0. */
+    ExecutorThreads,
+
+    /* Nonzero to move the model into its own subinterpreter with its own GIL.
+     * Requires Python 3.12 or newer and dependencies that can be imported into
+     * a subinterpreter, otherwise the model stays in the main interpreter.
+     * Defaults to 0. */
+    Subinterpreter,
+
+    /* Nonzero to let reads on the model run Python at the same time. Only
+     * possible with a free-threaded build of Python. Defaults to 0. */
+    ConcurrentReads,
+
+    /* The number of worker processes forked to read image buffers. 0 reads
+     * them in the calling process. Defaults to 0. */
+    WorkerProcesses,
+
+    /* The number of internal threads asynchronous reads are made on and their
+     * callbacks are called on. Defaults to 1. */
+    AsyncThreads,
+
+    /* The most reads the model accepts at once. Can be changed while reads
+     * are in flight. 0 for no limit. Defaults to 0. */
+    MaxPending,
+
+    /* The most bytes of image data the reads the model accepts at once may
+     * hold. Can be changed while reads are in flight. 0 for no limit.
+     * Defaults to 0. */
+    MaxPendingBytes,
+
+    /* What happens to a read past MaxPending or MaxPendingBytes, a
+     * mocr::overload cast to int64_t. Can be changed while reads are in
+     * flight. Defaults to mocr::overload::Block. */
+    Overload,
+
+    /* The most bytes of memory spent remembering the text read from image
+     * buffers, so the same image is answered again without the model. Can be
+     * changed while reads are in flight. 0 disables the cache. Defaults to
+     * 0. */
+    CacheBytes,
+
+    /* Nonzero to also match image files in the file cache by a hash of their
+     * contents. See model::set_file_cache(). Defaults to 0. */
+    FileCacheHash,
+};
+
+/**
+ * @brief Defines what happens to a read that a model can't accept because of
+ * mocr::option::MaxPending or mocr::option::MaxPendingBytes
+ */
+enum class overload
+{
+    /* The call waits until enough earlier reads finish. Callbacks must not
+     * start reads on the same model with this policy. */
+    Block,
+
+    /* The call fails right away with errno set to EAGAIN */
+    Fail,
+
+    /* The oldest asynchronous read that hasn't started yet is cancelled to
+     * make room. If there is none, the call waits like Block. */
+    ShedOldest,
+};
+
+/**
+ * @brief Counters of a model's cache of texts, see mocr::option::CacheBytes
+ */
+struct cache_stats
+{
+    /* The number of reads answered from the cache */
+    uint64_t hits;
+
+    /* The number of reads that weren't in the cache */
+    uint64_t misses;
+
+    /* The number of texts in the cache */
+    uint64_t entries;
+
+    /* The bytes of memory the texts in the cache take */
+    uint64_t bytes;
 };
 
+/**
+ * @brief A rectangular region of an image in pixels
+ */
+struct rect
+{
+    /* The column of the left edge of the region */
+    size_t x;
+
+    /* The row of the top edge of the region */
+    size_t y;
+
+    /* The width of the region */
+    size_t width;
+
+    /* The height of the region */
+    size_t height;
+};
+
+/**
+ * @brief An image buffer to read as part of a batch
+ */
+struct image
+{
+    /* The image data */
+    const void *data;
+
+    /* The width of the image in pixels */
+    size_t width;
+
+    /* The height of the image in pixels */
+    size_t height;
+
+    /* The number of bytes between the start of consecutive rows. 0 if the rows
+     * are tightly packed. */
+    size_t stride;
+
+    /* The format of the image data */
+    mocr::mode mode;
+};
+
+/**
+ * @brief Receives the text of an asynchronous read. Called on one of the
+ * model's internal threads.
+ *
+ * @param text The text contained in the image, empty on error
+ * @param userdata The pointer the read was started with
+ */
+typedef void (*read_callback)(std::string &&text, void *userdata);
+
+#if defined(MOCRXX_HAVE_COROUTINES)
+class read_awaitable;
+#endif
+
 /**
  * @brief A mangaocr model object used for reading text from images
  */
@@ -117,6 +296,57 @@ public:
      */
     bool operator!() const;
 
+    /**
+     * @brief Sets an option on the model. Options should be set before the
+     * model is shared between threads.
+     *
+     * @param opt The option to set
+     * @param value The value of the option
+     * @return true if the option was set,
+     * @return false otherwise
+     */
+    bool set_option(mocr::option opt, int64_t value);
+
+    /**
+     * @brief Gets the value of an option on the model
+     *
+     * @param opt The option to get
+     * @param[out] value The value of the option
+     * @return true if the option was retrieved,
+     * @return false otherwise
+     */
+    bool get_option(mocr::option opt, int64_t &value) const;
+
+    /**
+     * @brief Gets the counters of the model's cache of texts
+     *
+     * @param[out] stats Receives the counters
+     * @return true on success,
+     * @return false otherwise
+     */
+    bool get_cache_stats(mocr::cache_stats &stats) const;
+
+    /**
+     * @brief Keeps the text read from image files in a file on disk, so files
+     * that haven't changed are answered from it even after a restart. See
+     * mocr_set_file_cache().
+     *
+     * @param path The path of the cache file, created if it doesn't exist.
+     *             nullptr to stop using a cache file.
+     * @return true on success,
+     * @return false otherwise
+     */
+    bool set_file_cache(const char *path);
+
+    /**
+     * @brief Keeps the text read from image files in a file on disk
+     *
+     * @param path The path of the cache file, created if it doesn't exist
+     * @return true on success,
+     * @return false otherwise
+     */
+    bool set_file_cache(const std::string &path);
+
     /**
      * @brief Reads text from raw image data
      *
@@ -128,6 +358,24 @@ public:
      */
     std::string read(void *data, size_t width, size_t height, mocr::mode mode);
 
+    /**
+     * @brief Reads text from raw image data with padded rows
+     *
+     * @param data The image data
+     * @param width The width of the image
+     * @param height The height of the image
+     * @param stride The number of bytes between the start of consecutive rows,
+     *               0 if the rows are tightly packed
+     * @param mode The mode the image data should be read in
+     * @return The text contained in the image data, empty string on error
+     */
+    std::string read(
+        void *data,
+        size_t width,
+        size_t height,
+        size_t stride,
+        mocr::mode mode);
+
     /**
      * @brief Reads text from an image file
      *
@@ -144,9 +392,448 @@ public:
      */
     std::string read(const std::string &path);
 
+    /**
+     * @brief Reads text from an encoded image in memory, such as the contents
+     * of a JPEG or PNG file
+     *
+     * @param bytes The encoded image
+     * @param size The size of bytes in bytes
+     * @return The text contained in the image data, empty string on error
+     */
+    std::string read(const void *bytes, size_t size);
+
+    /**
+     * @brief Reads text from multiple image buffers as a single batch
+     *
+     * @param images The images to read
+     * @return The text contained in each image, empty on error
+     */
+    std::vector<std::string> read(const std::vector<mocr::image> &images);
+
+    /**
+     * @brief Starts reading text from raw image data on one of the model's
+     * internal threads. See mocr::option::AsyncThreads.
+     *
+     * @param data The image data. It must stay valid until the read finishes.
+     * @param width The width of the image
+     * @param height The height of the image
+     * @param mode The mode the image data should be read in
+     * @param callback Called with the text once it's read
+     * @param userdata Passed to callback
+     * @return true if the read was started,
+     * @return false otherwise, in which case callback is never called
+     */
+    bool read_async(
+        void *data,
+        size_t width,
+        size_t height,
+        mocr::mode mode,
+        mocr::read_callback callback,
+        void *userdata);
+
+    /**
+     * @brief Starts reading text from an image file on one of the model's
+     * internal threads
+     *
+     * @param path Path to the image file
+     * @param callback Called with the text once it's read
+     * @param userdata Passed to callback
+     * @return true if the read was started,
+     * @return false otherwise, in which case callback is never called
+     */
+    bool read_async(
+        const char *path, mocr::read_callback callback, void *userdata);
+
+    /**
+     * @brief Reads text from raw image data on one of the model's internal
+     * threads
+     *
+     * @param data The image data. It must stay valid until the future is
+     *             ready.
+     * @param width The width of the image
+     * @param height The height of the image
+     * @param mode The mode the image data should be read in
+     * @return A future of the text contained in the image data, empty string
+     * on error
+     */
+    std::future<std::string> read_async(
+        void *data, size_t width, size_t height, mocr::mode mode);
+
+    /**
+     * @brief Reads text from an image file on one of the model's internal
+     * threads
+     *
+     * @param path Path to the image file
+     * @return A future of the text contained in the image data, empty string
+     * on error
+     */
+    std::future<std::string> read_async(const std::string &path);
+
+#if defined(MOCRXX_HAVE_COROUTINES)
+    /**
+     * @brief Reads text from raw image data when awaited. The awaiting
+     * coroutine is suspended without blocking a thread and resumed on one of
+     * the model's internal threads.
+     *
+     * @param data The image data. It must stay valid until the read finishes.
+     * @param width The width of the image
+     * @param height The height of the image
+     * @param mode The mode the image data should be read in
+     * @return An awaitable of the text contained in the image data, empty
+     * string on error
+     */
+    mocr::read_awaitable read_co(
+        void *data, size_t width, size_t height, mocr::mode mode);
+
+    /**
+     * @brief Reads text from an image file when awaited. The awaiting
+     * coroutine is suspended without blocking a thread and resumed on one of
+     * the model's internal threads.
+     *
+     * @param path Path to the image file
+     * @return An awaitable of the text contained in the image data, empty
+     * string on error
+     */
+    mocr::read_awaitable read_co(const std::string &path);
+#endif
+
 private:
+    /**
+     * @brief Wraps a context owned by something else
+     *
+     * @param ctx The context to wrap. It is not destroyed with the model.
+     */
+    explicit model(mocr_ctx *ctx);
+
     /* The C mocr context */
     mocr_ctx *m_ctx;
+
+    /* true if m_ctx is destroyed with the model */
+    bool m_owner;
+
+    friend class page;
+    friend class pool;
+};
+
+#if defined(MOCRXX_HAVE_COROUTINES)
+/**
+ * @brief The result of model::read_co(). Starts the read when awaited.
+ */
+class read_awaitable
+{
+public:
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        m_handle = handle;
+
+        /* The read can finish and resume the coroutine before this returns,
+         * so nothing here may be touched once it's started */
+        if (m_file)
+        {
+            return m_model->read_async(
+                m_path.c_str(), &read_awaitable::finish, this
+            );
+        }
+        return m_model->read_async(
+            m_data, m_width, m_height, m_mode, &read_awaitable::finish, this
+        );
+    }
+
+    std::string await_resume()
+    {
+        return std::move(m_text);
+    }
+
+private:
+    read_awaitable(
+        model &model, void *data, size_t width, size_t height, mocr::mode mode)
+        : m_model(&model), m_file(false), m_data(data), m_width(width),
+          m_height(height), m_mode(mode)
+    {
+
+    }
+
+    read_awaitable(model &model, const std::string &path)
+        : m_model(&model), m_file(true), m_data(nullptr), m_width(0),
+          m_height(0), m_mode(mocr::mode::L), m_path(path)
+    {
+
+    }
+
+    static void finish(std::string &&text, void *userdata)
+    {
+        read_awaitable *self = static_cast<read_awaitable *>(userdata);
+        self->m_text = std::move(text);
+        self->m_handle.resume();
+    }
+
+    /* The model the image is read with */
+    model *m_model;
+
+    /* true to read m_path, false to read the image data */
+    bool m_file;
+
+    /* The image data to read */
+    void *m_data;
+    size_t m_width;
+    size_t m_height;
+    mocr::mode m_mode;
+
+    /* The path of the image file to read */
+    std::string m_path;
+
+    /* The text once it's read */
+    std::string m_text;
+
+    /* The coroutine to resume once the text is read */
+    std::coroutine_handle<> m_handle;
+
+    friend class model;
+};
+
+inline read_awaitable model::read_co(
+    void *data, size_t width, size_t height, mocr::mode mode)
+{
+    return read_awaitable(*this, data, width, height, mode);
+}
+
+inline read_awaitable model::read_co(const std::string &path)
+{
+    return read_awaitable(*this, path);
+}
+#endif
+
+/**
+ * @brief An image buffer that regions can be read from without copying it
+ */
+class page
+{
+public:
+    /**
+     * @brief Construct a new page object. The image data is not copied and
+     * must outlive the page.
+     *
+     * @param model The model used to read regions of the page
+     * @param data The image data
+     * @param width The width of the image
+     * @param height The height of the image
+     * @param stride The number of bytes between the start of consecutive rows,
+     *               0 if the rows are tightly packed
+     * @param mode The mode the image data should be read in
+     */
+    page(
+        model &model,
+        void *data,
+        size_t width,
+        size_t height,
+        size_t stride,
+        mocr::mode mode);
+
+    /* Delete the copy constructor */
+    page(const page &) = delete;
+
+    /**
+     * @brief Destroy the page object
+     */
+    virtual ~page();
+
+    /**
+     * @brief Whether or not this instance was successfully initialized
+     *
+     * @return true if the instance is valid,
+     * @return false if invalid
+     */
+    bool valid() const;
+
+    /**
+     * @brief Whether or not this instance is valid
+     *
+     * @return true if this instance is invalid,
+     * @return false if valid
+     */
+    bool operator!() const;
+
+    /**
+     * @brief Reads text from regions of the page as a single batch
+     *
+     * @param rects The regions to read
+     * @return The text contained in each region, empty vector on error
+     */
+    std::vector<std::string> read(const std::vector<mocr::rect> &rects);
+
+private:
+    /* The C mocr page */
+    mocr_page *m_page;
+};
+
+/**
+ * @brief Usage statistics for a model in a pool
+ */
+struct pool_stats
+{
+    /* The number of times the model has been checked out */
+    uint64_t checkouts;
+
+    /* The total time in microseconds the model has spent checked out, not
+     * counting the current checkout */
+    uint64_t busy_us;
+
+    /* true if the model is checked out */
+    bool busy;
+};
+
+/**
+ * @brief A set of models sharing one copy of the weights that threads check
+ * out and return
+ */
+class pool
+{
+public:
+    /**
+     * @brief A model checked out from a pool. The model is returned to the
+     * pool when the lease is destroyed.
+     */
+    class lease
+    {
+    public:
+        lease(lease &&other);
+
+        /* Delete the copy constructor */
+        lease(const lease &) = delete;
+
+        /**
+         * @brief Return the model to the pool
+         */
+        ~lease();
+
+        /**
+         * @brief Whether or not a model was checked out
+         *
+         * @return true if the lease holds a model,
+         * @return false if none became idle in time
+         */
+        bool valid() const;
+
+        /**
+         * @brief Whether or not this lease is valid
+         *
+         * @return true if the lease is invalid,
+         * @return false if valid
+         */
+        bool operator!() const;
+
+        /**
+         * @brief Gets the checked out model. The lease must be valid.
+         */
+        model &operator*() const;
+
+        /**
+         * @brief Gets the checked out model. The lease must be valid.
+         */
+        model *operator->() const;
+
+    private:
+        lease(mocr_pool *pool, model *model);
+
+        /* The pool the model was checked out from */
+        mocr_pool *m_pool;
+
+        /* The checked out model, nullptr if none */
+        model *m_model;
+
+        friend class pool;
+    };
+
+    /**
+     * @brief Construct a new pool object
+     *
+     * @param path A HuggingFace repo, URL, or path to a local model
+     * @param force_cpu false if GPU acceleration is desired, true if only
+     *                  the CPU should be used
+     * @param size The number of models in the pool
+     */
+    pool(
+        const char *path = "kha-white/manga-ocr-base",
+        bool force_cpu = false,
+        size_t size = 1);
+
+    /**
+     * @brief Construct a new pool object
+     *
+     * @param path A HuggingFace repo, URL, or path to a local model
+     * @param force_cpu false if GPU acceleration is desired, true if only
+     *                  the CPU should be used
+     * @param size The number of models in the pool
+     */
+    pool(const std::string &path, bool force_cpu = false, size_t size = 1);
+
+    /* Delete the copy constructor */
+    pool(const pool &) = delete;
+
+    /**
+     * @brief Destroy the pool object. Every lease must be destroyed first.
+     */
+    virtual ~pool();
+
+    /**
+     * @brief Whether or not this instance was successfully initialized
+     *
+     * @return true if the instance is valid,
+     * @return false if invalid
+     */
+    bool valid() const;
+
+    /**
+     * @brief Whether or not this instance is valid
+     *
+     * @return true if this instance is invalid,
+     * @return false if valid
+     */
+    bool operator!() const;
+
+    /**
+     * @brief Gets the number of models in the pool
+     */
+    size_t size() const;
+
+    /**
+     * @brief Gets a model by its index without checking it out. Used to set
+     * options on every model before the pool is shared between threads.
+     *
+     * @param index The index of the model, less than size()
+     */
+    model &at(size_t index);
+
+    /**
+     * @brief Checks out an idle model
+     *
+     * @param timeout_us How long in microseconds to wait for a model to become
+     *                   idle. 0 to return immediately, negative to wait
+     *                   forever.
+     * @return The lease of the model, invalid if none became idle in time
+     */
+    lease acquire(int64_t timeout_us = -1);
+
+    /**
+     * @brief Gets the usage statistics of a model
+     *
+     * @param index The index of the model, less than size()
+     * @param[out] stats Receives the statistics
+     * @return true on success, false if index is out of range
+     */
+    bool get_stats(size_t index, mocr::pool_stats &stats) const;
+
+private:
+    /* The C mocr pool */
+    mocr_pool *m_pool;
+
+    /* Wrappers around each context in the pool */
+    std::vector<std::unique_ptr<model>> m_models;
 };
 
 /**
@@ -23,24 +23,342 @@
 #include <Python.h>
 
 #include "mocr.h"
+#include "mocr_admit.h"
+#include "mocr_async.h"
+#include "mocr_cache.h"
+#include "mocr_cq.h"
+#include "mocr_exec.h"
+#include "mocr_fcache.h"
+#include "mocr_image.h"
+#include "mocr_proc.h"
+#include "mocr_sched.h"
+#include "mocr_thread.h"
 
+#include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
-/* The thread state for the main thread */
-PyThreadState *g_mainThreadState;
+/* Python 3.12 can give each subinterpreter its own GIL */
+#if PY_VERSION_HEX >= 0x030C0000
+#define MOCR_HAVE_SUBINTERPRETERS
+#endif
+
+/* Free-threaded builds of Python don't serialize calls with a GIL */
+#if defined(Py_GIL_DISABLED)
+#define MOCR_FREE_THREADED
+#endif
+
+/**
+ * @brief A loaded mangaocr model shared by every context created with the same
+ * arguments
+ */
+typedef struct mocr_model
+{
+    /* The next model in the registry */
+    struct mocr_model *next;
+
+    /* The model argument the model was loaded with */
+    char *name;
+
+    /* The force_cpu argument the model was loaded with */
+    int force_cpu;
+
+    /* The number of contexts using the model */
+    size_t refs;
+
+    /* The instance of the mangaocr object */
+    PyObject *obj_mangaocr;
+}
+mocr_model;
+
+/* The thread state for the main thread. Guarded by g_modelsMutex. */
+static PyThreadState *g_mainThreadState;
+
+/* Every loaded model. Models are loaded with the GIL released at times, so
+ * g_modelsMutex serializes loading and releasing them. It is always locked
+ * before the GIL is taken. */
+static mocr_model *g_models;
+static mocr_mutex g_modelsMutex = MOCR_MUTEX_INIT;
 
 /**
  * @brief The definition of the mangaocr context object
  */
 struct mocr_ctx
 {
-    /* The instance of the mangaocr object */
+    /* The model argument the context was created with */
+    char *name;
+
+    /* The force_cpu argument the context was created with */
+    int force_cpu;
+
+    /* The shared model the context reads with, NULL if the context has a
+     * subinterpreter */
+    mocr_model *model;
+
+    /* The instance of the mangaocr object owned by model */
     PyObject *obj_mangaocr;
 
     /* The result of "from PIL.Image import frombytes" */
     PyObject *func_pil_image_frombytes;
+
+    /* The result of "from PIL.Image import open" */
+    PyObject *func_pil_image_open;
+
+    /* The result of "from io import BytesIO" */
+    PyObject *type_io_bytesio;
+
+    /* The VisionEncoderDecoderModel owned by obj_mangaocr, NULL if batching
+     * isn't supported by the installed version of mangaocr */
+    PyObject *obj_model;
+
+    /* The tokenizer owned by obj_mangaocr, NULL if batching isn't supported */
+    PyObject *obj_tokenizer;
+
+    /* The image processor owned by obj_mangaocr, NULL if batching isn't
+     * supported */
+    PyObject *obj_processor;
+
+    /* The result of "from manga_ocr.ocr import post_process", NULL if batching
+     * isn't supported */
+    PyObject *func_post_process;
+
+    /* Nonzero if raw image buffers are preprocessed in C */
+    int native_preprocess;
+
+    /* The width of the images the model takes as input */
+    size_t native_width;
+
+    /* The height of the images the model takes as input */
+    size_t native_height;
+
+    /* Maps luma to the value of each channel of the model's input */
+    float native_lut[MOCR_IMAGE_CHANNELS][256];
+
+    /* The result of "from torch import frombuffer", NULL until native
+     * preprocessing is enabled */
+    PyObject *func_torch_frombuffer;
+
+    /* The result of "from torch import float32", NULL until native
+     * preprocessing is enabled */
+    PyObject *obj_torch_float32;
+
+    /* The most concurrent reads coalesced into one batch, 1 if disabled */
+    int64_t batch_size;
+
+    /* How long in microseconds a read waits for a batch to fill */
+    int64_t batch_wait_us;
+
+    /* Coalesces concurrent reads when batch_size is more than 1 */
+    mocr_sched sched;
+
+    /* Nonzero if sched is running */
+    int sched_running;
+
+    /* The number of executor threads calls into Python run on, 0 if disabled */
+    int64_t executor_threads;
+
+    /* Runs calls into Python when executor_threads is more than 0 */
+    mocr_exec exec;
+
+    /* Nonzero if exec is running */
+    int exec_running;
+
+    /* Nonzero if calls into Python on the context may overlap */
+    int concurrent_reads;
+
+    /* The number of worker processes raw image buffers are read in, 0 if
+     * disabled */
+    int64_t worker_processes;
+
+#if defined(MOCR_HAVE_PROC)
+    /* Reads raw image buffers when worker_processes is more than 0. Its
+     * zygote is kept from the first time workers are enabled. */
+    mocr_proc proc;
+#endif
+
+    /* Nonzero if proc is running. Read while the number of workers changes
+     * under other threads' reads. */
+    volatile uint32_t proc_running;
+
+    /* The number of threads asynchronous reads are made on */
+    int64_t async_threads;
+
+    /* Makes asynchronous reads. Started by the first one. */
+    mocr_async async;
+
+    /* Nonzero if async is running */
+    volatile uint32_t async_running;
+
+    /* Holds asynchronous reads started without a callback once they finish,
+     * until they're taken off with mocr_poll() */
+    mocr_cq cq;
+
+    /* The most reads accepted at once, 0 for no limit */
+    int64_t max_pending;
+
+    /* The most bytes of image data accepted at once, 0 for no limit */
+    int64_t max_pending_bytes;
+
+    /* What happens to reads past the limits, one of mocr_overload */
+    int64_t overload;
+
+    /* Counts the reads accepted against max_pending and max_pending_bytes */
+    mocr_admit admit;
+
+    /* The most bytes the cache holds, 0 if it's disabled */
+    int64_t cache_bytes;
+
+    /* Remembers the text read from recent image buffers */
+    mocr_cache cache;
+
+    /* Keeps the text read from image files on disk, NULL if disabled */
+    mocr_fcache *fcache;
+
+    /* Nonzero if files in fcache are also matched by their contents */
+    int file_cache_hash;
+
+#if defined(MOCR_FREE_THREADED)
+    /* Serializes calls into Python unless concurrent_reads is set. Without a
+     * GIL nothing else keeps two threads from using the model at once. */
+    mocr_mutex py_mutex;
+#endif
+
+    /* The thread state the context's subinterpreter was created with, NULL if
+     * the context uses the main interpreter. Every Python object above belongs
+     * to the subinterpreter while it's set. */
+    PyThreadState *sub_tstate;
+};
+
+/**
+ * @brief The definition of the page object used to read regions of an image
+ */
+struct mocr_page
+{
+    /* The context used to read regions of the page */
+    mocr_ctx *ctx;
+
+    /* The caller owned image data */
+    const unsigned char *data;
+
+    /* The width of the page in pixels */
+    size_t width;
+
+    /* The height of the page in pixels */
+    size_t height;
+
+    /* The number of bytes between the start of each row */
+    size_t stride;
+
+    /* The format of the image data */
+    mocr_mode mode;
+};
+
+/**
+ * @brief The definition of an asynchronous read
+ */
+struct mocr_request
+{
+    /* Queued on the context's async threads. Must come first. */
+    mocr_async_job job;
+
+    /* Queued on the dispatcher when the image is read in a batch */
+    mocr_job sched_job;
+
+    /* Queued on the context's completion queue if callback is NULL */
+    mocr_cq_entry cq_entry;
+
+    /* The context the image is read with */
+    mocr_ctx *ctx;
+
+    /* The caller owned image to read, unused if path is set */
+    mocr_image image;
+
+    /* A copy of the path of the image file to read, NULL for image buffers */
+    char *path;
+
+    /* Called with the text once the image is read, NULL to queue it on the
+     * context's completion queue */
+    mocr_callback callback;
+
+    /* Passed to callback */
+    void *userdata;
+
+    /* The text read by the dispatcher */
+    char *text;
+
+    /* Nonzero once the dispatcher has read the image */
+    int batched;
+
+    /* The number of references. The caller and the context each hold one. */
+    volatile uint32_t refs;
+
+    /* Set to 1 once callback has returned or the text is queued */
+    volatile uint32_t done;
+
+    /* Set to 1 by mocr_request_cancel() */
+    volatile uint32_t cancelled;
+
+    /* The time the read is cancelled at, as returned by mocr_time_now(). 0 if
+     * it has no deadline. */
+    volatile uint64_t deadline;
+
+    /* The bytes of image data the read was admitted with */
+    uint64_t bytes;
+
+    /* Nonzero until the read is released from the context's admission gate */
+    int admitted;
+
+    /* The key the image's text is cached under */
+    mocr_cache_key cache_key;
+
+    /* Nonzero if the text is added to the context's cache once it's read */
+    int cache_text;
+
+    /* Nonzero if the text was found in the context's cache when the read was
+     * started */
+    int cached;
 };
 
+/**
+ * @brief The definition of a stream of latest-wins asynchronous reads
+ */
+struct mocr_stream
+{
+    /* The context the stream's reads are made with */
+    mocr_ctx *ctx;
+
+    /* Protects latest */
+    mocr_mutex mutex;
+
+    /* The newest read started on the stream, NULL if none. The stream holds a
+     * reference to it. */
+    mocr_request *latest;
+};
+
+/* The maximum number of tokens mangaocr generates for a single image */
+#define MAX_TEXT_TOKENS 300
+
+/* The value of PIL.Image.Resampling.BILINEAR */
+#define PIL_RESAMPLE_BILINEAR 2
+
+/* The default value of mocr_option_batch_wait_us */
+#define DEFAULT_BATCH_WAIT_US 5000
+
+#define NSEC_PER_USEC 1000
+
+/* The most executor threads a context can run */
+#define MAX_EXECUTOR_THREADS 256
+
+/* The most worker processes a context can fork */
+#define MAX_WORKER_PROCESSES 64
+
+/* The most threads a context can make asynchronous reads on */
+#define MAX_ASYNC_THREADS 256
+
+/* Serializes starting the async threads of contexts */
+static mocr_mutex g_asyncMutex = MOCR_MUTEX_INIT;
+
 /**
  * @brief Take the ceiling of a division
  *
@@ -61,6 +379,7 @@ static const char *mode_to_pil_mode(mocr_mode mode)
     switch (mode)
     {
         case mocr_mode_1:
+        case mocr_mode_1_packed:
             return "1";
         case mocr_mode_L:
             return "L";
@@ -86,6 +405,21 @@ static const char *mode_to_pil_mode(mocr_mode mode)
     return NULL;
 }
 
+/**
+ * @brief Converts a mocr_mode to the PIL raw mode string its data is stored in
+ *
+ * @param mode The mode to convert
+ * @return The PIL raw mode string, NULL if it doesn't exist
+ */
+static const char *mode_to_pil_raw_mode(mocr_mode mode)
+{
+    if (mode == mocr_mode_1)
+    {
+        return "1;8";
+    }
+    return mode_to_pil_mode(mode);
+}
+
 /**
  * @brief Convert an mocr_mode to its value size in bits
  *
@@ -97,9 +431,10 @@ static size_t mode_to_size(mocr_mode mode)
 {
     switch (mode)
     {
-        case mocr_mode_1:
+        case mocr_mode_1_packed:
             return 1;
 
+        case mocr_mode_1:
         case mocr_mode_L:
         case mocr_mode_P:
             return 8;
@@ -152,202 +487,3616 @@ cleanup:
     return text;
 }
 
-mocr_ctx *mocr_init(const char *model, int force_cpu)
+/**
+ * @brief Calls the mocr object's read method on each image in a list. Used when
+ * the installed version of mangaocr doesn't expose what's needed to batch.
+ *
+ * @param ctx The mangaocr context
+ * @param images A list of PIL images
+ * @param[out] texts An array the size of images to store the results in. Every
+ *                   element is set to NULL on error.
+ * @return 0 on success, nonzero on error
+ */
+static int call_read_serial(mocr_ctx *ctx, PyObject *images, char **texts)
 {
-    PyGILState_STATE gstate;
-    mocr_ctx *ctx = NULL;
-    PyObject *args = NULL;
-    PyObject *module_manga_ocr = NULL;
-    PyObject *module_pil = NULL;
-    PyObject *module_pil_image = NULL;
-
-    /* Deal with state */
-    Py_Initialize();
-    if (PyGILState_Check())
+    Py_ssize_t count = PyList_GET_SIZE(images);
+    Py_ssize_t i;
+    for (i = 0; i < count; ++i)
     {
-        g_mainThreadState = PyEval_SaveThread();
+        PyObject *args = PyTuple_Pack(1, PyList_GET_ITEM(images, i));
+        if (args == NULL)
+        {
+            PyErr_Print();
+            break;
+        }
+        texts[i] = call_read(ctx, args);
+        Py_DECREF(args);
+        if (texts[i] == NULL)
+        {
+            break;
+        }
     }
-    gstate = PyGILState_Ensure();
-
-    ctx = calloc(1, sizeof(mocr_ctx));
-    if (ctx == NULL)
+    if (i == count)
     {
-        goto error;
+        return 0;
     }
 
-    /* from manga_ocr import MangaOcr */
-    args = Py_BuildValue("s", "MangaOcr");
-    if (args == NULL)
+    while (i-- > 0)
     {
-        PyErr_Print();
-        goto error;
-    }
-    module_manga_ocr = PyImport_ImportModuleEx("manga_ocr", NULL, NULL, args);
-    if (module_manga_ocr == NULL)
-    {
-        PyErr_Print();
-        goto error;
+        free(texts[i]);
+        texts[i] = NULL;
     }
-    Py_DECREF(args);
-    args = NULL;
+    return -1;
+}
 
-    /* MangaOcr(model, force_cpu) */
-    ctx->obj_mangaocr = PyObject_CallMethod(
-        module_manga_ocr, "MangaOcr", "sO",
-        model,
-        force_cpu ? Py_True : Py_False
-    );
-    if (ctx->obj_mangaocr == NULL)
+/**
+ * @brief Checks whether an asynchronous read was cancelled or its deadline has
+ * passed
+ *
+ * @param request The read, NULL for a read that can't be cancelled
+ * @return Nonzero if the read should stop
+ */
+static int request_expired(mocr_request *request)
+{
+    if (request == NULL)
     {
-        PyErr_Print();
-        goto error;
+        return 0;
     }
-
-    /* from PIL import Image */
-    args = Py_BuildValue("s", "Image");
-    if (args == NULL)
+    if (mocr_atomic_load32(&request->cancelled))
     {
-        PyErr_Print();
-        goto error;
+        return 1;
     }
-    module_pil = PyImport_ImportModuleEx("PIL", NULL, NULL, args);
-    if (module_pil == NULL)
+    uint64_t deadline = mocr_atomic_load(&request->deadline);
+    return deadline != 0 && mocr_time_now() >= deadline;
+}
+
+/**
+ * @brief A stopping criterion that ends generation once the asynchronous read
+ * in its capsule has expired. Called by generate() after every token.
+ *
+ * @param self A capsule holding the mocr_request
+ * @param args The ids and scores generated so far, unused
+ * @param kwargs Unused
+ * @return True to stop generating, NULL on error
+ */
+static PyObject *stop_request(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+    (void)args;
+    (void)kwargs;
+    mocr_request *request = PyCapsule_GetPointer(self, NULL);
+    if (request == NULL)
     {
-        PyErr_Print();
-        goto error;
+        return NULL;
     }
-    Py_DECREF(args);
-    args = NULL;
+    return PyBool_FromLong(request_expired(request));
+}
 
-    /* Get PIL.Image module */
-    module_pil_image = PyObject_GetAttrString(module_pil, "Image");
-    if (module_pil_image == NULL)
+static PyMethodDef g_stopRequestDef = {
+    "stop_request",
+    (PyCFunction)(void (*)(void))stop_request,
+    METH_VARARGS | METH_KEYWORDS,
+    NULL
+};
+
+/**
+ * @brief Creates the stopping_criteria argument of generate() for an
+ * asynchronous read
+ *
+ * @param request The read. It must outlive the generate() call.
+ * @return A new list with one criterion, NULL on error
+ */
+static PyObject *create_stopping_criteria(mocr_request *request)
+{
+    PyObject *criteria = NULL;
+    PyObject *func = NULL;
+
+    PyObject *capsule = PyCapsule_New(request, NULL, NULL);
+    if (capsule == NULL)
     {
-        PyErr_Print();
-        goto error;
+        goto cleanup;
     }
-
-    /* Get PIL.Image.frombytes */
-    ctx->func_pil_image_frombytes =
-        PyObject_GetAttrString(module_pil_image, "frombytes");
-    if (ctx->func_pil_image_frombytes == NULL)
+    func = PyCFunction_NewEx(&g_stopRequestDef, capsule, NULL);
+    if (func == NULL)
     {
-        PyErr_Print();
-        goto error;
+        goto cleanup;
     }
-
-    PyGILState_Release(gstate);
-
-    return ctx;
-
-error:
-    Py_XDECREF(module_manga_ocr);
-    Py_XDECREF(module_pil_image);
-    Py_XDECREF(module_pil);
-    Py_XDECREF(args);
-
-    PyGILState_Release(gstate);
-
-    mocr_destroy(ctx);
-
-    return NULL;
-}
-
-int mocr_destroy(mocr_ctx *ctx)
-{
-    if (ctx)
+    criteria = PyList_New(1);
+    if (criteria == NULL)
     {
-        PyGILState_STATE gstate = PyGILState_Ensure();
-
-        Py_XDECREF(ctx->obj_mangaocr);
-        Py_XDECREF(ctx->func_pil_image_frombytes);
-        free(ctx);
+        goto cleanup;
+    }
+    Py_INCREF(func);
+    PyList_SET_ITEM(criteria, 0, func);
 
-        PyGC_Collect();
+cleanup:
+    Py_XDECREF(func);
+    Py_XDECREF(capsule);
 
-        PyGILState_Release(gstate);
-    }
-    return 0;
+    return criteria;
 }
 
-#define BITS_IN_BYTE    8
-
-char *mocr_read(
-    mocr_ctx *ctx, void *data, size_t width, size_t height, mocr_mode mode)
+/**
+ * @brief Runs a batch of preprocessed images through the model and decodes the
+ * text. This mirrors what MangaOcr.__call__ does after preprocessing.
+ *
+ * @param ctx The mangaocr context
+ * @param pixel_values A tensor of preprocessed images
+ * @param count The number of images in the batch
+ * @param[out] texts An array of count elements to store the results in. Every
+ *                   element is set to NULL on error.
+ * @param request The asynchronous read the batch is for, stopped between
+ *                tokens once it expires. NULL if it can't be cancelled.
+ * @return 0 on success, nonzero on error or if request expired
+ */
+static int call_generate(
+    mocr_ctx *ctx,
+    PyObject *pixel_values,
+    Py_ssize_t count,
+    char **texts,
+    mocr_request *request)
 {
-    PyGILState_STATE gstate;
-    PyObject *image = NULL;
+    int ret = -1;
+    Py_ssize_t i;
     PyObject *args = NULL;
-    char *text = NULL;
+    PyObject *kwargs = NULL;
+    PyObject *device = NULL;
+    PyObject *inputs = NULL;
+    PyObject *func_generate = NULL;
+    PyObject *ids = NULL;
+    PyObject *decoded = NULL;
 
-    gstate = PyGILState_Ensure();
+    for (i = 0; i < count; ++i)
+    {
+        texts[i] = NULL;
+    }
 
-    /* image = PIL.Image.frombytes(
-     *     mode, (width, height), data, 'raw', mode, 0, 1
-     * )
+    /* ids = model.generate(
+     *     pixel_values.to(model.device), max_length=MAX_TEXT_TOKENS
+     * ).cpu()
      */
+    device = PyObject_GetAttrString(ctx->obj_model, "device");
+    if (device == NULL)
     {
-        size_t data_bytes = mode_to_size(mode) * width * height;
-        data_bytes = CEILING(data_bytes, BITS_IN_BYTE);
-
-        const char *mode_str = mode_to_pil_mode(mode);
-
-        image = PyObject_CallFunction(
-            ctx->func_pil_image_frombytes, "s(nn)y#ssii",
-            mode_str,
-            width, height,
-            data, data_bytes,
-            "raw",
-            mode_str,
-            0,
-            1
-        );
+        PyErr_Print();
+        goto cleanup;
     }
-    if (image == NULL)
+    inputs = PyObject_CallMethod(pixel_values, "to", "O", device);
+    if (inputs == NULL)
     {
         PyErr_Print();
         goto cleanup;
     }
-
-    /* return mocr(image) */
-    args = Py_BuildValue("(O)", image);
-    if (args == NULL)
+    func_generate = PyObject_GetAttrString(ctx->obj_model, "generate");
+    if (func_generate == NULL)
     {
         PyErr_Print();
         goto cleanup;
     }
-    text = call_read(ctx, args);
-
-cleanup:
-    Py_XDECREF(args);
-    Py_XDECREF(image);
-
+    args = PyTuple_Pack(1, inputs);
+    kwargs = Py_BuildValue("{s:i}", "max_length", MAX_TEXT_TOKENS);
+    if (args == NULL || kwargs == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    if (request)
+    {
+        /* generate(..., stopping_criteria=[stop_request]) */
+        PyObject *criteria = create_stopping_criteria(request);
+        if (criteria == NULL ||
+            PyDict_SetItemString(kwargs, "stopping_criteria", criteria))
+        {
+            PyErr_Print();
+            Py_XDECREF(criteria);
+            goto cleanup;
+        }
+        Py_DECREF(criteria);
+    }
+    ids = PyObject_Call(func_generate, args, kwargs);
+    if (ids == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* Don't decode what was cut short */
+    if (request_expired(request))
+    {
+        goto cleanup;
+    }
+    Py_CLEAR(args);
+    Py_CLEAR(kwargs);
+    Py_SETREF(ids, PyObject_CallMethod(ids, "cpu", NULL));
+    if (ids == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* decoded = tokenizer.batch_decode(ids, skip_special_tokens=True) */
+    {
+        PyObject *func_batch_decode =
+            PyObject_GetAttrString(ctx->obj_tokenizer, "batch_decode");
+        if (func_batch_decode == NULL)
+        {
+            PyErr_Print();
+            goto cleanup;
+        }
+        args = PyTuple_Pack(1, ids);
+        kwargs = Py_BuildValue("{s:O}", "skip_special_tokens", Py_True);
+        if (args != NULL && kwargs != NULL)
+        {
+            decoded = PyObject_Call(func_batch_decode, args, kwargs);
+        }
+        Py_DECREF(func_batch_decode);
+    }
+    if (decoded == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* texts = [post_process(text) for text in decoded] */
+    for (i = 0; i < count; ++i)
+    {
+        PyObject *item = PySequence_GetItem(decoded, i);
+        if (item == NULL)
+        {
+            PyErr_Print();
+            goto cleanup;
+        }
+        PyObject *text = PyObject_CallFunctionObjArgs(
+            ctx->func_post_process, item, NULL
+        );
+        Py_DECREF(item);
+        if (text == NULL)
+        {
+            PyErr_Print();
+            goto cleanup;
+        }
+        const char *str = PyUnicode_AsUTF8(text);
+        if (str == NULL)
+        {
+            PyErr_Print();
+            Py_DECREF(text);
+            goto cleanup;
+        }
+        texts[i] = strdup(str);
+        Py_DECREF(text);
+        if (texts[i] == NULL)
+        {
+            goto cleanup;
+        }
+    }
+    ret = 0;
+
+cleanup:
+    if (ret)
+    {
+        for (i = 0; i < count; ++i)
+        {
+            free(texts[i]);
+            texts[i] = NULL;
+        }
+    }
+    Py_XDECREF(decoded);
+    Py_XDECREF(ids);
+    Py_XDECREF(func_generate);
+    Py_XDECREF(inputs);
+    Py_XDECREF(device);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(args);
+
+    return ret;
+}
+
+/**
+ * @brief Runs every image in a list through the model as a single batch. This
+ * mirrors what MangaOcr.__call__ does for a single image.
+ *
+ * @param ctx The mangaocr context
+ * @param images A list of PIL images
+ * @param[out] texts An array the size of images to store the results in. Every
+ *                   element is set to NULL on error.
+ * @param request The asynchronous read the batch is for, NULL if it can't be
+ *                cancelled
+ * @return 0 on success, nonzero on error or if request expired
+ */
+static int call_read_batch(
+    mocr_ctx *ctx, PyObject *images, char **texts, mocr_request *request)
+{
+    int ret = -1;
+    Py_ssize_t count = PyList_GET_SIZE(images);
+    Py_ssize_t i;
+    PyObject *rgb_images = NULL;
+    PyObject *args = NULL;
+    PyObject *kwargs = NULL;
+    PyObject *inputs = NULL;
+    PyObject *pixel_values = NULL;
+
+    for (i = 0; i < count; ++i)
+    {
+        texts[i] = NULL;
+    }
+    if (ctx->obj_model == NULL)
+    {
+        return call_read_serial(ctx, images, texts);
+    }
+
+    /* rgb_images = [img.convert('L').convert('RGB') for img in images] */
+    rgb_images = PyList_New(count);
+    if (rgb_images == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        PyObject *gray = PyObject_CallMethod(
+            PyList_GET_ITEM(images, i), "convert", "s", "L"
+        );
+        if (gray == NULL)
+        {
+            PyErr_Print();
+            goto cleanup;
+        }
+        PyObject *rgb = PyObject_CallMethod(gray, "convert", "s", "RGB");
+        Py_DECREF(gray);
+        if (rgb == NULL)
+        {
+            PyErr_Print();
+            goto cleanup;
+        }
+        PyList_SET_ITEM(rgb_images, i, rgb);
+    }
+
+    /* pixel_values = processor(rgb_images, return_tensors='pt').pixel_values */
+    args = PyTuple_Pack(1, rgb_images);
+    kwargs = Py_BuildValue("{s:s}", "return_tensors", "pt");
+    if (args == NULL || kwargs == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    inputs = PyObject_Call(ctx->obj_processor, args, kwargs);
+    if (inputs == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    pixel_values = PyObject_GetAttrString(inputs, "pixel_values");
+    if (pixel_values == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    ret = call_generate(ctx, pixel_values, count, texts, request);
+
+cleanup:
+    Py_XDECREF(pixel_values);
+    Py_XDECREF(inputs);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(args);
+    Py_XDECREF(rgb_images);
+
+    return ret;
+}
+
+/**
+ * @brief Looks up the members of the MangaOcr object needed to run images
+ * through the model in batches. Versions of mangaocr that don't have them
+ * leave batching disabled rather than failing to initialize.
+ *
+ * @param ctx The mangaocr context with an initialized obj_mangaocr
+ */
+static void init_batching(mocr_ctx *ctx)
+{
+    PyObject *module_ocr = NULL;
+
+    ctx->obj_model = PyObject_GetAttrString(ctx->obj_mangaocr, "model");
+    if (ctx->obj_model == NULL)
+    {
+        goto error;
+    }
+    ctx->obj_tokenizer = PyObject_GetAttrString(ctx->obj_mangaocr, "tokenizer");
+    if (ctx->obj_tokenizer == NULL)
+    {
+        goto error;
+    }
+
+    /* Older versions of mangaocr call the processor a feature extractor */
+    ctx->obj_processor = PyObject_GetAttrString(ctx->obj_mangaocr, "processor");
+    if (ctx->obj_processor == NULL)
+    {
+        PyErr_Clear();
+        ctx->obj_processor =
+            PyObject_GetAttrString(ctx->obj_mangaocr, "feature_extractor");
+    }
+    if (ctx->obj_processor == NULL)
+    {
+        goto error;
+    }
+
+    /* from manga_ocr.ocr import post_process */
+    module_ocr = PyImport_ImportModule("manga_ocr.ocr");
+    if (module_ocr == NULL)
+    {
+        goto error;
+    }
+    ctx->func_post_process = PyObject_GetAttrString(module_ocr, "post_process");
+    Py_DECREF(module_ocr);
+    if (ctx->func_post_process == NULL)
+    {
+        goto error;
+    }
+
+    return;
+
+error:
+    PyErr_Clear();
+    Py_CLEAR(ctx->obj_model);
+    Py_CLEAR(ctx->obj_tokenizer);
+    Py_CLEAR(ctx->obj_processor);
+    Py_CLEAR(ctx->func_post_process);
+}
+
+/**
+ * @brief Gets a boolean attribute of the image processor
+ *
+ * @param processor The image processor
+ * @param name The name of the attribute
+ * @param fallback The value to use if the attribute doesn't exist
+ * @return 1 if true, 0 if false, -1 on error
+ */
+static int get_processor_flag(
+    PyObject *processor, const char *name, int fallback)
+{
+    PyObject *attr = PyObject_GetAttrString(processor, name);
+    if (attr == NULL)
+    {
+        PyErr_Clear();
+        return fallback;
+    }
+    int flag = PyObject_IsTrue(attr);
+    Py_DECREF(attr);
+    return flag;
+}
+
+/**
+ * @brief Gets a floating point attribute of the image processor that is
+ * either a single value or one value per channel
+ *
+ * @param processor The image processor
+ * @param name The name of the attribute
+ * @param fallback The value to use if the attribute doesn't exist
+ * @param[out] values The value of each channel
+ * @return 0 on success, nonzero on error
+ */
+static int get_processor_channels(
+    PyObject *processor,
+    const char *name,
+    double fallback,
+    double values[MOCR_IMAGE_CHANNELS])
+{
+    int ret = -1;
+    PyObject *attr = PyObject_GetAttrString(processor, name);
+    if (attr == NULL)
+    {
+        PyErr_Clear();
+        for (int c = 0; c < MOCR_IMAGE_CHANNELS; ++c)
+        {
+            values[c] = fallback;
+        }
+        return 0;
+    }
+
+    if (PySequence_Check(attr))
+    {
+        if (PySequence_Size(attr) != MOCR_IMAGE_CHANNELS)
+        {
+            goto cleanup;
+        }
+        for (int c = 0; c < MOCR_IMAGE_CHANNELS; ++c)
+        {
+            PyObject *item = PySequence_GetItem(attr, c);
+            if (item == NULL)
+            {
+                goto cleanup;
+            }
+            values[c] = PyFloat_AsDouble(item);
+            Py_DECREF(item);
+            if (PyErr_Occurred())
+            {
+                goto cleanup;
+            }
+        }
+    }
+    else
+    {
+        double value = PyFloat_AsDouble(attr);
+        if (PyErr_Occurred())
+        {
+            goto cleanup;
+        }
+        for (int c = 0; c < MOCR_IMAGE_CHANNELS; ++c)
+        {
+            values[c] = value;
+        }
+    }
+    ret = 0;
+
+cleanup:
+    Py_DECREF(attr);
+
+    return ret;
+}
+
+/**
+ * @brief Gets the size images are resized to by the image processor
+ *
+ * @param processor The image processor
+ * @param[out] width The width images are resized to
+ * @param[out] height The height images are resized to
+ * @return 0 on success, nonzero if the size is missing or unsupported
+ */
+static int get_processor_size(
+    PyObject *processor, size_t *width, size_t *height)
+{
+    int ret = -1;
+    PyObject *size = PyObject_GetAttrString(processor, "size");
+    if (size == NULL)
+    {
+        return -1;
+    }
+
+    /* Older processors store a single integer, newer ones a dictionary */
+    if (PyLong_Check(size))
+    {
+        *width = *height = PyLong_AsSize_t(size);
+    }
+    else if (PyDict_Check(size))
+    {
+        PyObject *w = PyDict_GetItemString(size, "width");
+        PyObject *h = PyDict_GetItemString(size, "height");
+        if (w == NULL || h == NULL)
+        {
+            PyErr_SetString(
+                PyExc_ValueError, "Processor size has no width or height"
+            );
+            goto cleanup;
+        }
+        *width = PyLong_AsSize_t(w);
+        *height = PyLong_AsSize_t(h);
+    }
+    else
+    {
+        PyErr_SetString(PyExc_TypeError, "Unsupported processor size");
+        goto cleanup;
+    }
+    if (PyErr_Occurred())
+    {
+        goto cleanup;
+    }
+    if (*width == 0 || *height == 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Processor size is empty");
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    Py_DECREF(size);
+
+    return ret;
+}
+
+/**
+ * @brief Reads the image processor's configuration so that images can be
+ * preprocessed in C, and imports what's needed to hand the result to the model
+ *
+ * @param ctx The mangaocr context
+ * @return 0 on success, nonzero if the processor's configuration isn't
+ * supported. The GIL must be held.
+ */
+static int init_native_preprocess(mocr_ctx *ctx)
+{
+    int ret = -1;
+    PyObject *module_torch = NULL;
+    PyObject *resample = NULL;
+    double rescale_factor[MOCR_IMAGE_CHANNELS];
+    double mean[MOCR_IMAGE_CHANNELS];
+    double std[MOCR_IMAGE_CHANNELS];
+
+    if (ctx->func_torch_frombuffer != NULL)
+    {
+        return 0;
+    }
+    if (ctx->obj_processor == NULL)
+    {
+        return -1;
+    }
+
+    /* The processor must resize with PIL's bilinear filter */
+    if (get_processor_flag(ctx->obj_processor, "do_resize", 1) != 1)
+    {
+        goto cleanup;
+    }
+    resample = PyObject_GetAttrString(ctx->obj_processor, "resample");
+    if (resample == NULL)
+    {
+        goto cleanup;
+    }
+    if (PyLong_AsLong(resample) != PIL_RESAMPLE_BILINEAR)
+    {
+        if (!PyErr_Occurred())
+        {
+            PyErr_SetString(
+                PyExc_ValueError, "Processor does not resample bilinearly"
+            );
+        }
+        goto cleanup;
+    }
+    if (get_processor_size(
+            ctx->obj_processor, &ctx->native_width, &ctx->native_height))
+    {
+        goto cleanup;
+    }
+
+    /* pixel = (pixel * rescale_factor - image_mean) / image_std */
+    int do_rescale = get_processor_flag(ctx->obj_processor, "do_rescale", 1);
+    int do_normalize =
+        get_processor_flag(ctx->obj_processor, "do_normalize", 1);
+    if (do_rescale < 0 || do_normalize < 0)
+    {
+        goto cleanup;
+    }
+    if (get_processor_channels(
+            ctx->obj_processor, "rescale_factor", 1.0 / 255.0, rescale_factor) ||
+        get_processor_channels(ctx->obj_processor, "image_mean", 0.0, mean) ||
+        get_processor_channels(ctx->obj_processor, "image_std", 1.0, std))
+    {
+        goto cleanup;
+    }
+    for (int c = 0; c < MOCR_IMAGE_CHANNELS; ++c)
+    {
+        for (int v = 0; v < 256; ++v)
+        {
+            float value = do_rescale ?
+                (float)(v * rescale_factor[c]) : (float)v;
+            if (do_normalize)
+            {
+                value = (value - (float)mean[c]) / (float)std[c];
+            }
+            ctx->native_lut[c][v] = value;
+        }
+    }
+
+    /* from torch import frombuffer, float32 */
+    module_torch = PyImport_ImportModule("torch");
+    if (module_torch == NULL)
+    {
+        goto cleanup;
+    }
+    ctx->obj_torch_float32 = PyObject_GetAttrString(module_torch, "float32");
+    if (ctx->obj_torch_float32 == NULL)
+    {
+        goto cleanup;
+    }
+    ctx->func_torch_frombuffer =
+        PyObject_GetAttrString(module_torch, "frombuffer");
+    if (ctx->func_torch_frombuffer == NULL)
+    {
+        Py_CLEAR(ctx->obj_torch_float32);
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    if (ret)
+    {
+        PyErr_Print();
+    }
+    Py_XDECREF(resample);
+    Py_XDECREF(module_torch);
+
+    return ret;
+}
+
+/**
+ * @brief Loads a mangaocr model into the current interpreter
+ *
+ * @param name A HuggingFace repo, URL, or path to a local model
+ * @param force_cpu Nonzero to force CPU usage
+ * @return The MangaOcr object, NULL on error. The GIL must be held.
+ */
+static PyObject *load_mangaocr(const char *name, int force_cpu)
+{
+    PyObject *obj_mangaocr = NULL;
+
+    /* from manga_ocr import MangaOcr */
+    PyObject *args = Py_BuildValue("s", "MangaOcr");
+    if (args == NULL)
+    {
+        PyErr_Print();
+        return NULL;
+    }
+    PyObject *module_manga_ocr =
+        PyImport_ImportModuleEx("manga_ocr", NULL, NULL, args);
+    Py_DECREF(args);
+    if (module_manga_ocr == NULL)
+    {
+        PyErr_Print();
+        return NULL;
+    }
+
+    /* MangaOcr(model, force_cpu) */
+    obj_mangaocr = PyObject_CallMethod(
+        module_manga_ocr, "MangaOcr", "sO",
+        name,
+        force_cpu ? Py_True : Py_False
+    );
+    if (obj_mangaocr == NULL)
+    {
+        PyErr_Print();
+    }
+    Py_DECREF(module_manga_ocr);
+
+    return obj_mangaocr;
+}
+
+/**
+ * @brief Gets a model from the registry, loading it if no context is using it
+ *
+ * @param name A HuggingFace repo, URL, or path to a local model
+ * @param force_cpu Nonzero to force CPU usage
+ * @return The model with a reference added, NULL on error. Must be released
+ * with release_model(). g_modelsMutex and the GIL must be held.
+ */
+static mocr_model *acquire_model(const char *name, int force_cpu)
+{
+    mocr_model *model;
+
+    force_cpu = force_cpu != 0;
+    for (model = g_models; model != NULL; model = model->next)
+    {
+        if (model->force_cpu == force_cpu && strcmp(model->name, name) == 0)
+        {
+            ++model->refs;
+            return model;
+        }
+    }
+
+    model = calloc(1, sizeof(mocr_model));
+    if (model == NULL)
+    {
+        return NULL;
+    }
+    model->name = strdup(name);
+    if (model->name == NULL)
+    {
+        goto error;
+    }
+    model->force_cpu = force_cpu;
+    model->refs = 1;
+
+    model->obj_mangaocr = load_mangaocr(name, force_cpu);
+    if (model->obj_mangaocr == NULL)
+    {
+        goto error;
+    }
+
+    model->next = g_models;
+    g_models = model;
+
+    return model;
+
+error:
+    free(model->name);
+    free(model);
+
+    return NULL;
+}
+
+/**
+ * @brief Drops a reference to a model, unloading it once no context uses it
+ *
+ * @param model The model to release. g_modelsMutex and the GIL must be held.
+ */
+static void release_model(mocr_model *model)
+{
+    if (--model->refs > 0)
+    {
+        return;
+    }
+
+    mocr_model **link = &g_models;
+    while (*link != model)
+    {
+        link = &(*link)->next;
+    }
+    *link = model->next;
+
+    Py_DECREF(model->obj_mangaocr);
+    free(model->name);
+    free(model);
+}
+
+/**
+ * @brief Looks up everything a context reads with in the current interpreter
+ *
+ * @param ctx The mangaocr context without any Python objects
+ * @param obj_mangaocr The MangaOcr object to read with. A reference is added.
+ * @return 0 on success, nonzero on error. The GIL must be held.
+ */
+static int load_objects(mocr_ctx *ctx, PyObject *obj_mangaocr)
+{
+    int ret = -1;
+    PyObject *args = NULL;
+    PyObject *module_pil = NULL;
+    PyObject *module_pil_image = NULL;
+    PyObject *module_io = NULL;
+
+    ctx->obj_mangaocr = obj_mangaocr;
+    Py_INCREF(ctx->obj_mangaocr);
+    init_batching(ctx);
+
+    /* from PIL import Image */
+    args = Py_BuildValue("s", "Image");
+    if (args == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    module_pil = PyImport_ImportModuleEx("PIL", NULL, NULL, args);
+    if (module_pil == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* Get PIL.Image module */
+    module_pil_image = PyObject_GetAttrString(module_pil, "Image");
+    if (module_pil_image == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* Get PIL.Image.frombytes */
+    ctx->func_pil_image_frombytes =
+        PyObject_GetAttrString(module_pil_image, "frombytes");
+    if (ctx->func_pil_image_frombytes == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* Get PIL.Image.open */
+    ctx->func_pil_image_open = PyObject_GetAttrString(module_pil_image, "open");
+    if (ctx->func_pil_image_open == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* from io import BytesIO */
+    module_io = PyImport_ImportModule("io");
+    if (module_io == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    ctx->type_io_bytesio = PyObject_GetAttrString(module_io, "BytesIO");
+    if (ctx->type_io_bytesio == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    Py_XDECREF(module_io);
+    Py_XDECREF(module_pil_image);
+    Py_XDECREF(module_pil);
+    Py_XDECREF(args);
+
+    return ret;
+}
+
+/**
+ * @brief Drops every Python object a context holds
+ *
+ * @param ctx The mangaocr context. The GIL of the interpreter the objects
+ *            belong to must be held.
+ */
+static void clear_objects(mocr_ctx *ctx)
+{
+    Py_CLEAR(ctx->obj_mangaocr);
+    Py_CLEAR(ctx->func_pil_image_frombytes);
+    Py_CLEAR(ctx->func_pil_image_open);
+    Py_CLEAR(ctx->type_io_bytesio);
+    Py_CLEAR(ctx->obj_model);
+    Py_CLEAR(ctx->obj_tokenizer);
+    Py_CLEAR(ctx->obj_processor);
+    Py_CLEAR(ctx->func_post_process);
+    Py_CLEAR(ctx->func_torch_frombuffer);
+    Py_CLEAR(ctx->obj_torch_float32);
+}
+
+mocr_ctx *mocr_init(const char *model, int force_cpu)
+{
+    PyGILState_STATE gstate;
+    mocr_ctx *ctx = NULL;
+
+    /* Deal with state. Two threads must not initialize Python at once. */
+    mocr_mutex_lock(&g_modelsMutex);
+    Py_Initialize();
+    if (PyGILState_Check())
+    {
+        g_mainThreadState = PyEval_SaveThread();
+    }
+    gstate = PyGILState_Ensure();
+
+    ctx = calloc(1, sizeof(mocr_ctx));
+    if (ctx == NULL)
+    {
+        goto error;
+    }
+    if (mocr_cq_init(&ctx->cq))
+    {
+        free(ctx);
+        ctx = NULL;
+        goto error;
+    }
+    if (mocr_admit_init(&ctx->admit))
+    {
+        mocr_cq_destroy(&ctx->cq);
+        free(ctx);
+        ctx = NULL;
+        goto error;
+    }
+    if (mocr_cache_init(&ctx->cache))
+    {
+        mocr_admit_destroy(&ctx->admit);
+        mocr_cq_destroy(&ctx->cq);
+        free(ctx);
+        ctx = NULL;
+        goto error;
+    }
+#if defined(MOCR_FREE_THREADED)
+    if (mocr_mutex_init(&ctx->py_mutex))
+    {
+        mocr_cache_destroy(&ctx->cache);
+        mocr_admit_destroy(&ctx->admit);
+        mocr_cq_destroy(&ctx->cq);
+        free(ctx);
+        ctx = NULL;
+        goto error;
+    }
+#endif
+    ctx->name = strdup(model);
+    if (ctx->name == NULL)
+    {
+        goto error;
+    }
+    ctx->force_cpu = force_cpu != 0;
+    ctx->batch_size = 1;
+    ctx->batch_wait_us = DEFAULT_BATCH_WAIT_US;
+    ctx->async_threads = 1;
+
+    /* Contexts created with the same arguments share one copy of the model */
+    ctx->model = acquire_model(model, force_cpu);
+    if (ctx->model == NULL)
+    {
+        goto error;
+    }
+    if (load_objects(ctx, ctx->model->obj_mangaocr))
+    {
+        goto error;
+    }
+
+    PyGILState_Release(gstate);
+    mocr_mutex_unlock(&g_modelsMutex);
+
+    return ctx;
+
+error:
+    PyGILState_Release(gstate);
+    mocr_mutex_unlock(&g_modelsMutex);
+
+    mocr_destroy(ctx);
+
+    return NULL;
+}
+
+#if defined(MOCR_HAVE_SUBINTERPRETERS)
+
+/**
+ * @brief Moves a context from the main interpreter into a new subinterpreter
+ * with its own GIL. If anything the context needs can't be loaded there, the
+ * context is left in the main interpreter.
+ *
+ * @param ctx The mangaocr context. Its executors and scheduler must be stopped
+ *            and the GIL must not be held.
+ * @return 0 on success, nonzero on error
+ */
+static int enter_subinterpreter(mocr_ctx *ctx)
+{
+    PyThreadState *sub_tstate = NULL;
+    PyObject *obj_mangaocr = NULL;
+    int ret = -1;
+
+    mocr_mutex_lock(&g_modelsMutex);
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    PyThreadState *main_tstate = PyThreadState_Get();
+
+    /* The registry keeps the model loaded in case this has to fall back */
+    clear_objects(ctx);
+
+    /* Extension modules that don't support being loaded more than once, like
+     * older versions of NumPy and PyTorch, fail to import */
+    const PyInterpreterConfig config = {
+        .use_main_obmalloc = 0,
+        .allow_fork = 0,
+        .allow_exec = 0,
+        .allow_threads = 1,
+        .allow_daemon_threads = 0,
+        .check_multi_interp_extensions = 1,
+        .gil = PyInterpreterConfig_OWN_GIL,
+    };
+    PyStatus status = Py_NewInterpreterFromConfig(&sub_tstate, &config);
+    if (PyStatus_Exception(status))
+    {
+        goto fallback;
+    }
+
+    obj_mangaocr = load_mangaocr(ctx->name, ctx->force_cpu);
+    if (obj_mangaocr == NULL || load_objects(ctx, obj_mangaocr) ||
+        (ctx->native_preprocess && init_native_preprocess(ctx)))
+    {
+        Py_XDECREF(obj_mangaocr);
+        clear_objects(ctx);
+        Py_EndInterpreter(sub_tstate);
+        PyThreadState_Swap(main_tstate);
+        goto fallback;
+    }
+    Py_DECREF(obj_mangaocr);
+
+    /* The subinterpreter keeps running on the executor threads */
+    PyThreadState_Swap(main_tstate);
+    release_model(ctx->model);
+    ctx->model = NULL;
+    ctx->sub_tstate = sub_tstate;
+    ret = 0;
+    goto cleanup;
+
+fallback:
+    if (load_objects(ctx, ctx->model->obj_mangaocr) ||
+        (ctx->native_preprocess && init_native_preprocess(ctx)))
+    {
+        ctx->native_preprocess = 0;
+    }
+
+cleanup:
+    PyGILState_Release(gstate);
+    mocr_mutex_unlock(&g_modelsMutex);
+
+    return ret;
+}
+
+/**
+ * @brief Moves a context out of its subinterpreter and back into the main
+ * interpreter, then ends the subinterpreter
+ *
+ * @param ctx The mangaocr context. Its executors and scheduler must be stopped
+ *            and the GIL must not be held.
+ * @return 0 on success, nonzero on error
+ */
+static int leave_subinterpreter(mocr_ctx *ctx)
+{
+    int ret = -1;
+
+    PyEval_RestoreThread(ctx->sub_tstate);
+    clear_objects(ctx);
+    Py_EndInterpreter(ctx->sub_tstate);
+    ctx->sub_tstate = NULL;
+
+    mocr_mutex_lock(&g_modelsMutex);
+    PyGILState_STATE gstate = PyGILState_Ensure();
+
+    ctx->model = acquire_model(ctx->name, ctx->force_cpu);
+    if (ctx->model && load_objects(ctx, ctx->model->obj_mangaocr) == 0)
+    {
+        if (ctx->native_preprocess && init_native_preprocess(ctx))
+        {
+            ctx->native_preprocess = 0;
+        }
+        ret = 0;
+    }
+
     PyGILState_Release(gstate);
+    mocr_mutex_unlock(&g_modelsMutex);
+
+    return ret;
+}
+
+#endif
+
+/**
+ * @brief Drops a reference to an asynchronous read and frees it with the last
+ *
+ * @param request The read
+ */
+static void release_request(mocr_request *request)
+{
+    if (mocr_atomic_add32(&request->refs, (uint32_t)-1) == 1)
+    {
+        free(request->path);
+        free(request);
+    }
+}
+
+/**
+ * @brief Waits for the asynchronous reads in flight on a context, then stops
+ * its async threads
+ *
+ * @param ctx The mangaocr context
+ */
+static void stop_async(mocr_ctx *ctx)
+{
+    if (ctx->async_running)
+    {
+        mocr_async_stop(&ctx->async);
+        ctx->async_running = 0;
+    }
+}
+
+/**
+ * @brief Frees the finished asynchronous reads no one took off a context,
+ * then destroys its completion queue
+ *
+ * @param ctx The mangaocr context. Its async threads must be stopped.
+ */
+static void clear_completions(mocr_ctx *ctx)
+{
+    mocr_cq_entry *entry = mocr_cq_pop(&ctx->cq, SIZE_MAX);
+    while (entry)
+    {
+        mocr_request *request = (mocr_request *)(
+            (char *)entry - offsetof(mocr_request, cq_entry)
+        );
+        entry = entry->next;
+        free(request->text);
+        release_request(request);
+    }
+    mocr_cq_destroy(&ctx->cq);
+}
+
+int mocr_destroy(mocr_ctx *ctx)
+{
+    if (ctx)
+    {
+        /* Asynchronous reads still in flight use everything below */
+        stop_async(ctx);
+        clear_completions(ctx);
+        mocr_admit_destroy(&ctx->admit);
+        mocr_cache_destroy(&ctx->cache);
+        if (ctx->fcache)
+        {
+            mocr_fcache_close(ctx->fcache);
+        }
+
+        /* The dispatcher and the executors need the GIL to finish the reads
+         * still queued */
+#if defined(MOCR_HAVE_PROC)
+        if (mocr_atomic_load32(&ctx->proc_running))
+        {
+            mocr_proc_stop(&ctx->proc);
+        }
+#endif
+        if (ctx->sched_running)
+        {
+            mocr_sched_stop(&ctx->sched);
+        }
+        if (ctx->exec_running)
+        {
+            mocr_exec_stop(&ctx->exec);
+        }
+
+#if defined(MOCR_HAVE_SUBINTERPRETERS)
+        if (ctx->sub_tstate)
+        {
+            PyEval_RestoreThread(ctx->sub_tstate);
+            clear_objects(ctx);
+            Py_EndInterpreter(ctx->sub_tstate);
+#if defined(MOCR_FREE_THREADED)
+            mocr_mutex_destroy(&ctx->py_mutex);
+#endif
+            free(ctx->name);
+            free(ctx);
+            return 0;
+        }
+#endif
+
+        mocr_mutex_lock(&g_modelsMutex);
+        PyGILState_STATE gstate = PyGILState_Ensure();
+
+        clear_objects(ctx);
+        if (ctx->model)
+        {
+            release_model(ctx->model);
+        }
+#if defined(MOCR_FREE_THREADED)
+        mocr_mutex_destroy(&ctx->py_mutex);
+#endif
+        free(ctx->name);
+        free(ctx);
+
+        PyGC_Collect();
+
+        PyGILState_Release(gstate);
+        mocr_mutex_unlock(&g_modelsMutex);
+    }
+    return 0;
+}
+
+#define BITS_IN_BYTE    8
+
+/**
+ * @brief Get the number of bytes a single tightly packed row of pixels takes
+ *
+ * @param mode The format of the image data
+ * @param width The width of the image in pixels
+ * @return The number of bytes in a row, 0 if the mode is invalid
+ */
+static size_t mode_to_row_bytes(mocr_mode mode, size_t width)
+{
+    return CEILING(mode_to_size(mode) * width, BITS_IN_BYTE);
+}
+
+/**
+ * @brief Converts an image buffer to tightly packed 8-bit luma
+ *
+ * @param data The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of each row, 0 if the
+ *               rows are tightly packed
+ * @param mode The format of the image data
+ * @return A buffer of width * height bytes, NULL on error. Must be freed with
+ * free(). The GIL does not need to be held.
+ */
+static uint8_t *image_to_luma(
+    const void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode)
+{
+    size_t row_bytes = mode_to_row_bytes(mode, width);
+    if (row_bytes == 0 || height == 0 || width > SIZE_MAX / height)
+    {
+        return NULL;
+    }
+    if (stride == 0)
+    {
+        stride = row_bytes;
+    }
+    if (stride < row_bytes)
+    {
+        return NULL;
+    }
+
+    uint8_t *luma = malloc(width * height);
+    if (luma == NULL)
+    {
+        return NULL;
+    }
+    if (mocr_image_to_luma(data, width, height, stride, mode, luma))
+    {
+        free(luma);
+        return NULL;
+    }
+    return luma;
+}
+
+/**
+ * @brief Checks that an image describes a buffer that can be read
+ *
+ * @param image The image to check
+ * @return nonzero if the image is valid, 0 otherwise
+ */
+static int image_valid(const mocr_image *image)
+{
+    size_t row_bytes = mode_to_row_bytes(image->mode, image->width);
+    return image->data != NULL && row_bytes != 0 && image->height != 0 &&
+        (image->stride == 0 || image->stride >= row_bytes);
+}
+
+/**
+ * @brief Gets the number of bytes of image data an image holds
+ *
+ * @param image The image
+ * @return The number of bytes, UINT64_MAX if it doesn't fit
+ */
+static uint64_t image_bytes(const mocr_image *image)
+{
+    uint64_t row = image->stride ?
+        image->stride : mode_to_row_bytes(image->mode, image->width);
+    if (image->height && row > UINT64_MAX / image->height)
+    {
+        return UINT64_MAX;
+    }
+    return row * image->height;
+}
+
+/**
+ * @brief Gets the number of bytes of image data a list of images holds
+ *
+ * @param images The images
+ * @param count The number of images
+ * @return The number of bytes, UINT64_MAX if it doesn't fit
+ */
+static uint64_t images_bytes(const mocr_image *images, size_t count)
+{
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint64_t image = image_bytes(&images[i]);
+        if (image > UINT64_MAX - bytes)
+        {
+            return UINT64_MAX;
+        }
+        bytes += image;
+    }
+    return bytes;
+}
+
+/**
+ * @brief Gets the key the text of an image buffer is cached under
+ *
+ * @param ctx The mangaocr context
+ * @param image The image
+ * @param[out] key Receives the key
+ * @return Nonzero if the context's cache is enabled and the image is valid
+ */
+static int cache_key(
+    mocr_ctx *ctx, const mocr_image *image, mocr_cache_key *key)
+{
+    if (!mocr_cache_enabled(&ctx->cache) || !image_valid(image))
+    {
+        return 0;
+    }
+
+    size_t row_bytes = mode_to_row_bytes(image->mode, image->width);
+    mocr_cache_key_hash(
+        image->data,
+        row_bytes,
+        image->height,
+        image->stride ? image->stride : row_bytes,
+        key
+    );
+    key->width = image->width;
+    key->height = image->height;
+    key->mode = image->mode;
+    return 1;
+}
+
+/**
+ * @brief Sheds the oldest asynchronous read on a context that hasn't started
+ * to make room for another. It's cancelled and put back on the queue so a
+ * thread calls its callback right away.
+ *
+ * @param ctx The mangaocr context
+ * @return Nonzero if a read was shed
+ */
+static int shed_oldest(mocr_ctx *ctx)
+{
+    if (!mocr_atomic_load32(&ctx->async_running))
+    {
+        return 0;
+    }
+    mocr_async_job *job = mocr_async_shed(&ctx->async);
+    if (job == NULL)
+    {
+        return 0;
+    }
+
+    mocr_request *request = (mocr_request *)job;
+    mocr_atomic_store32(&request->cancelled, 1);
+    if (request->admitted)
+    {
+        request->admitted = 0;
+        mocr_admit_release(&ctx->admit, request->bytes);
+    }
+    mocr_async_requeue(&ctx->async, job);
+    return 1;
+}
+
+/**
+ * @brief Admits a read to a context, applying the context's overload policy
+ * if it's over its limits
+ *
+ * @param ctx The mangaocr context
+ * @param bytes The bytes of image data the read holds
+ * @return 0 if the read was admitted and must be released with
+ * mocr_admit_release(), nonzero with errno set to EAGAIN if it was refused
+ */
+static int admit_read(mocr_ctx *ctx, uint64_t bytes)
+{
+    switch (ctx->overload)
+    {
+        case mocr_overload_fail:
+            if (mocr_admit_try(&ctx->admit, bytes))
+            {
+                errno = EAGAIN;
+                return -1;
+            }
+            return 0;
+
+        case mocr_overload_shed_oldest:
+            while (mocr_admit_try(&ctx->admit, bytes))
+            {
+                if (!shed_oldest(ctx))
+                {
+                    mocr_admit_wait(&ctx->admit, bytes);
+                    break;
+                }
+            }
+            return 0;
+
+        default:
+            mocr_admit_wait(&ctx->admit, bytes);
+            return 0;
+    }
+}
+
+/**
+ * @brief Creates a PIL image from a raw image buffer without copying the
+ * buffer into a Python bytes object first
+ *
+ * The buffer is exposed to PIL through a read-only memoryview that is released
+ * before this function returns, so no Python object can reference the caller's
+ * memory once the image has been created. Row padding is skipped by PIL's raw
+ * decoder, so strided buffers are never repacked.
+ *
+ * @param ctx The mangaocr context
+ * @param data The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of each row, 0 if the
+ *               rows are tightly packed
+ * @param mode The format of the image data
+ * @return A new reference to a PIL image, NULL on error. The GIL must be held.
+ */
+static PyObject *create_image(
+    mocr_ctx *ctx,
+    const void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode)
+{
+    PyObject *image = NULL;
+    PyObject *view = NULL;
+    PyObject *released = NULL;
+
+    const char *mode_str = mode_to_pil_mode(mode);
+    const char *raw_mode_str = mode_to_pil_raw_mode(mode);
+    size_t row_bytes = mode_to_row_bytes(mode, width);
+    if (mode_str == NULL || row_bytes == 0 || height == 0)
+    {
+        return NULL;
+    }
+    if (stride == 0)
+    {
+        stride = row_bytes;
+    }
+    if (stride < row_bytes || stride > (size_t)PY_SSIZE_T_MAX)
+    {
+        return NULL;
+    }
+
+    /* The last row does not need to be padded out to the full stride */
+    if (height - 1 > ((size_t)PY_SSIZE_T_MAX - row_bytes) / stride)
+    {
+        return NULL;
+    }
+    size_t data_bytes = stride * (height - 1) + row_bytes;
+
+    view = PyMemoryView_FromMemory(
+        (char *)data, (Py_ssize_t)data_bytes, PyBUF_READ
+    );
+    if (view == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* image = PIL.Image.frombytes(
+     *     mode, (width, height), view, 'raw', raw_mode, stride, 1
+     * )
+     */
+    image = PyObject_CallFunction(
+        ctx->func_pil_image_frombytes, "s(nn)Ossni",
+        mode_str,
+        width, height,
+        view,
+        "raw",
+        raw_mode_str,
+        stride,
+        1
+    );
+    if (image == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* view.release() fails if anything still holds the caller's memory */
+    released = PyObject_CallMethod(view, "release", NULL);
+    if (released == NULL)
+    {
+        PyErr_Print();
+        Py_CLEAR(image);
+        goto cleanup;
+    }
+
+cleanup:
+    Py_XDECREF(released);
+    Py_XDECREF(view);
+
+    return image;
+}
+
+/**
+ * @brief Get the number of floats in the model input for a single image
+ *
+ * @param ctx The mangaocr context with native preprocessing enabled
+ * @return The number of floats
+ */
+static size_t native_tensor_size(mocr_ctx *ctx)
+{
+    return MOCR_IMAGE_CHANNELS * ctx->native_width * ctx->native_height;
+}
+
+/**
+ * @brief Converts, resizes, and normalizes an image buffer into the model's
+ * input format without using Python. The GIL does not need to be held.
+ *
+ * @param ctx The mangaocr context with native preprocessing enabled
+ * @param data The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of each row, 0 if the
+ *               rows are tightly packed
+ * @param mode The format of the image data
+ * @param[out] tensor A buffer of native_tensor_size() floats
+ * @return 0 on success, nonzero on error
+ */
+static int native_preprocess(
+    mocr_ctx *ctx,
+    const void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode,
+    float *tensor)
+{
+    int ret = -1;
+    uint8_t *luma = NULL;
+    uint8_t *resized = NULL;
+
+    /* Grayscale data is resized in place */
+    const uint8_t *gray = data;
+    size_t gray_stride = stride ? stride : width;
+    if (mode != mocr_mode_L)
+    {
+        luma = image_to_luma(data, width, height, stride, mode);
+        if (luma == NULL)
+        {
+            goto cleanup;
+        }
+        gray = luma;
+        gray_stride = width;
+    }
+    else if (width == 0 || height == 0 || gray_stride < width)
+    {
+        goto cleanup;
+    }
+
+    resized = malloc(ctx->native_width * ctx->native_height);
+    if (resized == NULL)
+    {
+        goto cleanup;
+    }
+    if (mocr_image_resize(
+            gray, width, height, gray_stride,
+            resized, ctx->native_width, ctx->native_height))
+    {
+        goto cleanup;
+    }
+    mocr_image_normalize(
+        resized,
+        ctx->native_width * ctx->native_height,
+        (const float (*)[256])ctx->native_lut,
+        tensor
+    );
+    ret = 0;
+
+cleanup:
+    free(resized);
+    free(luma);
+
+    return ret;
+}
+
+/**
+ * @brief Runs images preprocessed by native_preprocess() through the model.
+ * The tensor is handed to PyTorch without being copied.
+ *
+ * @param ctx The mangaocr context with native preprocessing enabled
+ * @param tensor The preprocessed images. Freed by this function.
+ * @param count The number of images in tensor
+ * @param[out] texts An array of count elements to store the results in. Every
+ *                   element is set to NULL on error.
+ * @param request The asynchronous read the images are for, NULL if it can't be
+ *                cancelled
+ * @return 0 on success, nonzero on error. The GIL must be held.
+ */
+static int call_read_tensor(
+    mocr_ctx *ctx,
+    float *tensor,
+    size_t count,
+    char **texts,
+    mocr_request *request)
+{
+    int ret = -1;
+    PyObject *view = NULL;
+    PyObject *args = NULL;
+    PyObject *kwargs = NULL;
+    PyObject *flat = NULL;
+    PyObject *pixel_values = NULL;
+    PyObject *released = NULL;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        texts[i] = NULL;
+    }
+
+    view = PyMemoryView_FromMemory(
+        (char *)tensor,
+        (Py_ssize_t)(count * native_tensor_size(ctx) * sizeof(float)),
+        PyBUF_WRITE
+    );
+    if (view == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* pixel_values = torch.frombuffer(view, dtype=torch.float32).reshape(
+     *     count, channels, height, width
+     * )
+     */
+    args = PyTuple_Pack(1, view);
+    kwargs = Py_BuildValue("{s:O}", "dtype", ctx->obj_torch_float32);
+    if (args == NULL || kwargs == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    flat = PyObject_Call(ctx->func_torch_frombuffer, args, kwargs);
+    if (flat == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    pixel_values = PyObject_CallMethod(
+        flat, "reshape", "nnnn",
+        (Py_ssize_t)count,
+        (Py_ssize_t)MOCR_IMAGE_CHANNELS,
+        (Py_ssize_t)ctx->native_height,
+        (Py_ssize_t)ctx->native_width
+    );
+    if (pixel_values == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    ret = call_generate(
+        ctx, pixel_values, (Py_ssize_t)count, texts, request
+    );
+
+cleanup:
+    Py_XDECREF(pixel_values);
+    Py_XDECREF(flat);
+    Py_XDECREF(kwargs);
+    Py_XDECREF(args);
+    if (view != NULL)
+    {
+        /* If something still references the tensor, leak it rather than free
+         * memory PyTorch may touch */
+        released = PyObject_CallMethod(view, "release", NULL);
+        if (released == NULL)
+        {
+            PyErr_Print();
+            tensor = NULL;
+        }
+        Py_XDECREF(released);
+        Py_DECREF(view);
+    }
+    free(tensor);
+
+    return ret;
+}
+
+/* The arguments and results of a call into Python. Which fields are used
+ * depends on the function the call is made with. */
+typedef struct py_call
+{
+    /* The mangaocr context */
+    mocr_ctx *ctx;
+
+    /* The images to read, already reduced to luma */
+    const mocr_image *images;
+
+    /* The images to read, already preprocessed */
+    float *tensor;
+
+    /* The number of images */
+    size_t count;
+
+    /* The path of the image file to read */
+    const char *path;
+
+    /* The encoded image to read and its size in bytes */
+    const void *bytes;
+    size_t size;
+
+    /* An array of count elements to store the results in, one element when
+     * reading a file or encoded image */
+    char **texts;
+
+    /* The asynchronous read the call is made for, NULL if it can't be
+     * cancelled */
+    mocr_request *request;
+
+    /* 0 on success, nonzero on error */
+    int ret;
+}
+py_call;
+
+/**
+ * @brief Runs a call into Python. The call runs on an executor thread if
+ * executors are enabled, otherwise it takes the GIL on the calling thread.
+ *
+ * @param func The function to run with the GIL held
+ * @param call The call passed to func
+ */
+static void run_python(mocr_exec_func func, py_call *call)
+{
+    mocr_ctx *ctx = call->ctx;
+
+#if defined(MOCR_FREE_THREADED)
+    /* Taken before attaching to the interpreter so a blocked caller never
+     * holds up the garbage collector */
+    int serialize = !ctx->concurrent_reads;
+    if (serialize)
+    {
+        mocr_mutex_lock(&ctx->py_mutex);
+    }
+#endif
+
+    if (ctx->exec_running)
+    {
+        mocr_exec_call(&ctx->exec, func, call);
+    }
+    else
+    {
+        PyGILState_STATE gstate = PyGILState_Ensure();
+        func(call);
+        PyGILState_Release(gstate);
+    }
+
+#if defined(MOCR_FREE_THREADED)
+    if (serialize)
+    {
+        mocr_mutex_unlock(&ctx->py_mutex);
+    }
+#endif
+}
+
+#if defined(MOCR_FREE_THREADED)
+
+/**
+ * @brief Checks that the interpreter of a call is running without a GIL.
+ * Importing an extension that doesn't support free threading turns it back on.
+ *
+ * @param arg The py_call
+ */
+static void locked_check_gil_disabled(void *arg)
+{
+    py_call *call = arg;
+
+    /* sys._is_gil_enabled() */
+    PyObject *func = PySys_GetObject("_is_gil_enabled");
+    if (func == NULL)
+    {
+        return;
+    }
+    PyObject *enabled = PyObject_CallNoArgs(func);
+    if (enabled == NULL)
+    {
+        PyErr_Print();
+        return;
+    }
+    call->ret = PyObject_IsTrue(enabled) == 0 ? 0 : -1;
+    Py_DECREF(enabled);
+}
+
+#endif
+
+/**
+ * @brief Sets up native preprocessing for the context of a call
+ *
+ * @param arg The py_call
+ */
+static void locked_init_native_preprocess(void *arg)
+{
+    py_call *call = arg;
+    call->ret = init_native_preprocess(call->ctx);
+}
+
+/**
+ * @brief Reads a single PIL image for a call. Reads that can be cancelled are
+ * run through generate() directly so they can be stopped between tokens.
+ *
+ * @param call The py_call
+ * @param image The PIL image
+ * @return The text, NULL on error. Must be freed with free().
+ */
+static char *call_read_image(py_call *call, PyObject *image)
+{
+    char *text = NULL;
+
+    if (call->request && call->ctx->obj_model)
+    {
+        PyObject *list = PyList_New(1);
+        if (list == NULL)
+        {
+            PyErr_Print();
+            return NULL;
+        }
+        Py_INCREF(image);
+        PyList_SET_ITEM(list, 0, image);
+        call_read_batch(call->ctx, list, &text, call->request);
+        Py_DECREF(list);
+        return text;
+    }
+
+    /* return mocr(image) */
+    PyObject *args = PyTuple_Pack(1, image);
+    if (args == NULL)
+    {
+        PyErr_Print();
+        return NULL;
+    }
+    text = call_read(call->ctx, args);
+    Py_DECREF(args);
+
+    return text;
+}
+
+/**
+ * @brief Reads the first image of a call with the mocr object
+ *
+ * @param arg The py_call
+ */
+static void locked_read_image(void *arg)
+{
+    py_call *call = arg;
+    const mocr_image *luma = call->images;
+
+    PyObject *image = create_image(
+        call->ctx,
+        luma->data,
+        luma->width, luma->height,
+        luma->stride,
+        luma->mode
+    );
+    if (image == NULL)
+    {
+        return;
+    }
+    call->texts[0] = call_read_image(call, image);
+    call->ret = call->texts[0] ? 0 : -1;
+    Py_DECREF(image);
+}
+
+/**
+ * @brief Reads the images of a call as a single batch
+ *
+ * @param arg The py_call
+ */
+static void locked_read_images(void *arg)
+{
+    py_call *call = arg;
+
+    PyObject *list = PyList_New((Py_ssize_t)call->count);
+    if (list == NULL)
+    {
+        PyErr_Print();
+        return;
+    }
+    for (size_t i = 0; i < call->count; ++i)
+    {
+        const mocr_image *luma = &call->images[i];
+        PyObject *image = create_image(
+            call->ctx,
+            luma->data,
+            luma->width, luma->height,
+            luma->stride,
+            luma->mode
+        );
+        if (image == NULL)
+        {
+            Py_DECREF(list);
+            return;
+        }
+        PyList_SET_ITEM(list, (Py_ssize_t)i, image);
+    }
+    call->ret = call_read_batch(call->ctx, list, call->texts, call->request);
+
+    Py_DECREF(list);
+}
+
+/**
+ * @brief Runs the tensor of a call through the model
+ *
+ * @param arg The py_call
+ */
+static void locked_read_tensor(void *arg)
+{
+    py_call *call = arg;
+    call->ret = call_read_tensor(
+        call->ctx, call->tensor, call->count, call->texts, call->request
+    );
+}
+
+/**
+ * @brief Reads the image file of a call
+ *
+ * @param arg The py_call
+ */
+static void locked_read_file(void *arg)
+{
+    py_call *call = arg;
+
+    if (call->request && call->ctx->obj_model)
+    {
+        /* image = PIL.Image.open(path) */
+        PyObject *image = PyObject_CallFunction(
+            call->ctx->func_pil_image_open, "s", call->path
+        );
+        if (image == NULL)
+        {
+            PyErr_Print();
+            return;
+        }
+        call->texts[0] = call_read_image(call, image);
+        call->ret = call->texts[0] ? 0 : -1;
+        Py_DECREF(image);
+        return;
+    }
+
+    PyObject *args = Py_BuildValue("(s)", call->path);
+    if (args == NULL)
+    {
+        PyErr_Print();
+        return;
+    }
+    call->texts[0] = call_read(call->ctx, args);
+    call->ret = call->texts[0] ? 0 : -1;
+    Py_DECREF(args);
+}
+
+/**
+ * @brief Decodes and reads the encoded image of a call
+ *
+ * @param arg The py_call
+ */
+static void locked_read_encoded(void *arg)
+{
+    py_call *call = arg;
+    PyObject *data = NULL;
+    PyObject *stream = NULL;
+    PyObject *image = NULL;
+    PyObject *args = NULL;
+
+    /* PIL decodes lazily, so the image must own its data. BytesIO shares the
+     * buffer of a bytes object instead of copying it again. */
+    data = PyBytes_FromStringAndSize(call->bytes, (Py_ssize_t)call->size);
+    if (data == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    /* image = PIL.Image.open(io.BytesIO(data)) */
+    stream = PyObject_CallFunctionObjArgs(
+        call->ctx->type_io_bytesio, data, NULL
+    );
+    if (stream == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    image = PyObject_CallFunctionObjArgs(
+        call->ctx->func_pil_image_open, stream, NULL
+    );
+    if (image == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+
+    args = PyTuple_Pack(1, image);
+    if (args == NULL)
+    {
+        PyErr_Print();
+        goto cleanup;
+    }
+    call->texts[0] = call_read(call->ctx, args);
+    call->ret = call->texts[0] ? 0 : -1;
+
+cleanup:
+    Py_XDECREF(args);
+    Py_XDECREF(image);
+    Py_XDECREF(stream);
+    Py_XDECREF(data);
+}
+
+/**
+ * @brief Reads text from an image buffer using native preprocessing
+ *
+ * @param ctx The mangaocr context with native preprocessing enabled
+ * @param data The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of each row, 0 if the
+ *               rows are tightly packed
+ * @param mode The format of the image data
+ * @param request The asynchronous read the image is for, NULL if it can't be
+ *                cancelled
+ * @return The text extracted from the image, NULL on error. Must be freed with
+ * free().
+ */
+static char *read_native(
+    mocr_ctx *ctx,
+    const void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode,
+    mocr_request *request)
+{
+    char *text = NULL;
+
+    float *tensor = malloc(native_tensor_size(ctx) * sizeof(float));
+    if (tensor == NULL)
+    {
+        return NULL;
+    }
+    if (native_preprocess(ctx, data, width, height, stride, mode, tensor))
+    {
+        free(tensor);
+        return NULL;
+    }
+
+    py_call call = {0};
+    call.ctx = ctx;
+    call.tensor = tensor;
+    call.count = 1;
+    call.texts = &text;
+    call.request = request;
+    call.ret = -1;
+    run_python(locked_read_tensor, &call);
+
+    return text;
+}
+
+/**
+ * @brief Reads text from an image buffer. See mocr_read_strided().
+ *
+ * @param ctx The mangaocr context
+ * @param data The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of each row, 0 if the
+ *               rows are tightly packed
+ * @param mode The format of the image data
+ * @param request The asynchronous read the image is for, NULL if it can't be
+ *                cancelled. Reads in worker processes and batches run to the
+ *                end.
+ * @return The text extracted from the image, NULL on error. Must be freed with
+ * free().
+ */
+static char *read_strided(
+    mocr_ctx *ctx,
+    const void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode,
+    mocr_request *request)
+{
+    uint8_t *luma = NULL;
+    char *text = NULL;
+
+#if defined(MOCR_HAVE_PROC)
+    if (mocr_atomic_load32(&ctx->proc_running))
+    {
+        mocr_image image = {data, width, height, stride, mode};
+        if (!image_valid(&image))
+        {
+            return NULL;
+        }
+        if (image.stride == 0)
+        {
+            image.stride = mode_to_row_bytes(mode, width);
+        }
+
+        /* Images too large for shared memory are read here instead */
+        if (mocr_proc_read(&ctx->proc, &image, &text) == 0)
+        {
+            return text;
+        }
+    }
+#endif
+
+    if (ctx->sched_running)
+    {
+        mocr_image job = {data, width, height, stride, mode};
+
+        /* Don't let a bad image fail the batch it would be part of */
+        if (!image_valid(&job))
+        {
+            return NULL;
+        }
+        return mocr_sched_read(&ctx->sched, &job);
+    }
+
+    if (ctx->native_preprocess && mocr_image_luma_supported(mode))
+    {
+        return read_native(ctx, data, width, height, stride, mode, request);
+    }
+
+    /* mangaocr only uses luma, so only one byte per pixel crosses into
+     * Python */
+    if (mode != mocr_mode_L)
+    {
+        luma = image_to_luma(data, width, height, stride, mode);
+        if (luma == NULL)
+        {
+            return NULL;
+        }
+        data = luma;
+        stride = 0;
+        mode = mocr_mode_L;
+    }
+
+    mocr_image image = {data, width, height, stride, mode};
+    py_call call = {0};
+    call.ctx = ctx;
+    call.images = &image;
+    call.count = 1;
+    call.texts = &text;
+    call.request = request;
+    call.ret = -1;
+    run_python(locked_read_image, &call);
+
+    free(luma);
+
+    return text;
+}
+
+char *mocr_read(
+    mocr_ctx *ctx, void *data, size_t width, size_t height, mocr_mode mode)
+{
+    return mocr_read_strided(ctx, data, width, height, 0, mode);
+}
+
+char *mocr_read_strided(
+    mocr_ctx *ctx,
+    void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode)
+{
+    mocr_image image = {data, width, height, stride, mode};
+    mocr_cache_key key;
+    int cached = cache_key(ctx, &image, &key);
+    char *text = cached ? mocr_cache_get(&ctx->cache, &key) : NULL;
+    if (text)
+    {
+        return text;
+    }
+
+    uint64_t bytes = image_bytes(&image);
+    if (admit_read(ctx, bytes))
+    {
+        return NULL;
+    }
+    text = read_strided(ctx, data, width, height, stride, mode, NULL);
+    mocr_admit_release(&ctx->admit, bytes);
+
+    if (cached && text)
+    {
+        mocr_cache_put(&ctx->cache, &key, text);
+    }
+    return text;
+}
+
+mocr_page *mocr_page_create(
+    mocr_ctx *ctx,
+    void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode)
+{
+    size_t row_bytes = mode_to_row_bytes(mode, width);
+    if (ctx == NULL || data == NULL || row_bytes == 0 || height == 0)
+    {
+        return NULL;
+    }
+    if (stride == 0)
+    {
+        stride = row_bytes;
+    }
+    if (stride < row_bytes)
+    {
+        return NULL;
+    }
+
+    mocr_page *page = malloc(sizeof(mocr_page));
+    if (page == NULL)
+    {
+        return NULL;
+    }
+    page->ctx = ctx;
+    page->data = data;
+    page->width = width;
+    page->height = height;
+    page->stride = stride;
+    page->mode = mode;
+
+    return page;
+}
+
+int mocr_page_destroy(mocr_page *page)
+{
+    free(page);
+    return 0;
+}
+
+/**
+ * @brief Get the address of the first pixel of a region of a page
+ *
+ * @param page The page
+ * @param rect The region of the page
+ * @return The address of the region's top left pixel
+ */
+static const unsigned char *page_region(
+    const mocr_page *page, const mocr_rect *rect)
+{
+    return page->data + rect->y * page->stride +
+        rect->x * mode_to_size(page->mode) / BITS_IN_BYTE;
+}
+
+/**
+ * @brief Reads images as a single batch using native preprocessing
+ *
+ * @param ctx The mangaocr context with native preprocessing enabled
+ * @param images The validated images to read
+ * @param count The number of images
+ * @param[out] texts An array of count elements to store the results in
+ * @return 0 on success, nonzero on error
+ */
+static int read_images_native(
+    mocr_ctx *ctx, const mocr_image *images, size_t count, char **texts)
+{
+    size_t tensor_size = native_tensor_size(ctx);
+
+    float *tensor = malloc(count * tensor_size * sizeof(float));
+    if (tensor == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (native_preprocess(
+                ctx,
+                images[i].data,
+                images[i].width, images[i].height,
+                images[i].stride,
+                images[i].mode,
+                tensor + i * tensor_size))
+        {
+            free(tensor);
+            return -1;
+        }
+    }
+
+    py_call call = {0};
+    call.ctx = ctx;
+    call.tensor = tensor;
+    call.count = count;
+    call.texts = texts;
+    call.ret = -1;
+    run_python(locked_read_tensor, &call);
+
+    return call.ret;
+}
+
+/**
+ * @brief Reads images as a single batch. Every image is reduced to luma before
+ * the GIL is taken.
+ *
+ * @param ctx The mangaocr context
+ * @param images The images to read
+ * @param count The number of images
+ * @param[out] texts An array of count elements to store the results in. Every
+ *                   element must be NULL.
+ * @return 0 on success, nonzero on error
+ */
+static int read_images(
+    mocr_ctx *ctx, const mocr_image *images, size_t count, char **texts)
+{
+    py_call call = {0};
+    mocr_image *lumas = NULL;
+    int ret = -1;
+
+    if (count > (size_t)PY_SSIZE_T_MAX)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!image_valid(&images[i]))
+        {
+            return -1;
+        }
+    }
+
+    if (ctx->native_preprocess)
+    {
+        return read_images_native(ctx, images, count, texts);
+    }
+
+    lumas = calloc(count ? count : 1, sizeof(*lumas));
+    if (lumas == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        const mocr_image *image = &images[i];
+        lumas[i].data = image_to_luma(
+            image->data,
+            image->width, image->height,
+            image->stride,
+            image->mode
+        );
+        if (lumas[i].data == NULL)
+        {
+            goto cleanup;
+        }
+        lumas[i].width = image->width;
+        lumas[i].height = image->height;
+        lumas[i].stride = 0;
+        lumas[i].mode = mocr_mode_L;
+    }
+
+    call.ctx = ctx;
+    call.images = lumas;
+    call.count = count;
+    call.texts = texts;
+    call.ret = -1;
+    run_python(locked_read_images, &call);
+    ret = call.ret;
+
+cleanup:
+    for (size_t i = 0; i < count; ++i)
+    {
+        free((void *)lumas[i].data);
+    }
+    free(lumas);
+
+    return ret;
+}
+
+/**
+ * @brief Reads a batch of coalesced reads on the scheduler's dispatcher thread
+ *
+ * @param arg The mangaocr context
+ * @param images The images to read
+ * @param count The number of images
+ * @param[out] texts An array of count elements to store the results in
+ * @return 0 on success, nonzero on error
+ */
+static int read_sched_batch(
+    void *arg, const mocr_image *images, size_t count, char **texts)
+{
+    return read_images(arg, images, count, texts);
+}
+
+int mocr_read_regions(
+    mocr_page *page, const mocr_rect *rects, size_t count, char **texts)
+{
+    if (page == NULL || (count && (rects == NULL || texts == NULL)))
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        texts[i] = NULL;
+    }
+
+    /* Every region must be within the page and start on a byte boundary */
+    size_t bits = mode_to_size(page->mode);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const mocr_rect *rect = &rects[i];
+        if (rect->width == 0 || rect->height == 0 ||
+            rect->x >= page->width || rect->y >= page->height ||
+            rect->width > page->width - rect->x ||
+            rect->height > page->height - rect->y ||
+            (rect->x * bits) % BITS_IN_BYTE != 0)
+        {
+            return -1;
+        }
+    }
+
+    mocr_image *images = calloc(count ? count : 1, sizeof(mocr_image));
+    if (images == NULL)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        images[i].data = page_region(page, &rects[i]);
+        images[i].width = rects[i].width;
+        images[i].height = rects[i].height;
+        images[i].stride = page->stride;
+        images[i].mode = page->mode;
+    }
+    int ret = -1;
+    uint64_t bytes = images_bytes(images, count);
+    if (admit_read(page->ctx, bytes) == 0)
+    {
+        ret = read_images(page->ctx, images, count, texts);
+        mocr_admit_release(&page->ctx->admit, bytes);
+    }
+    free(images);
+
+    return ret;
+}
+
+int mocr_read_batch(
+    mocr_ctx *ctx, const mocr_image *images, size_t count, char **texts)
+{
+    if (ctx == NULL || (count && (images == NULL || texts == NULL)))
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        texts[i] = NULL;
+    }
+
+    uint64_t bytes = images_bytes(images, count);
+    if (admit_read(ctx, bytes))
+    {
+        return -1;
+    }
+    int ret = read_images(ctx, images, count, texts);
+    mocr_admit_release(&ctx->admit, bytes);
+
+    return ret;
+}
+
+#undef BITS_IN_BYTE
+
+/**
+ * @brief Reads text from an image file. See mocr_read_file().
+ *
+ * @param ctx The mangaocr context
+ * @param path The path to the image file
+ * @param request The asynchronous read the file is for, NULL if it can't be
+ *                cancelled
+ * @return The text extracted from the image, NULL on error. Must be freed with
+ * free().
+ */
+static char *read_file(mocr_ctx *ctx, const char *path, mocr_request *request)
+{
+    char *text = NULL;
+
+    /* Files that haven't changed since they were read are answered from the
+     * file cache */
+    mocr_fcache_key key;
+    int cached = ctx->fcache != NULL && mocr_fcache_key_init(
+        path, ctx->name, ctx->file_cache_hash, &key
+    ) == 0;
+    if (cached)
+    {
+        text = mocr_fcache_get(ctx->fcache, &key);
+        if (text)
+        {
+            mocr_fcache_key_free(&key);
+            return text;
+        }
+    }
+
+    py_call call = {0};
+    call.ctx = ctx;
+    call.path = path;
+    call.texts = &text;
+    call.request = request;
+    call.ret = -1;
+    run_python(locked_read_file, &call);
+
+    /* Text cut short by a cancellation is NULL */
+    if (cached)
+    {
+        if (text)
+        {
+            mocr_fcache_put(ctx->fcache, &key, text);
+        }
+        mocr_fcache_key_free(&key);
+    }
+    return text;
+}
+
+char *mocr_read_file(mocr_ctx *ctx, const char *path)
+{
+    if (admit_read(ctx, 0))
+    {
+        return NULL;
+    }
+    char *text = read_file(ctx, path, NULL);
+    mocr_admit_release(&ctx->admit, 0);
+
+    return text;
+}
+
+char *mocr_read_encoded(mocr_ctx *ctx, const void *bytes, size_t size)
+{
+    char *text = NULL;
+
+    if (ctx == NULL || bytes == NULL || size > (size_t)PY_SSIZE_T_MAX)
+    {
+        return NULL;
+    }
+    if (admit_read(ctx, size))
+    {
+        return NULL;
+    }
+
+    py_call call = {0};
+    call.ctx = ctx;
+    call.bytes = bytes;
+    call.size = size;
+    call.texts = &text;
+    call.ret = -1;
+    run_python(locked_read_encoded, &call);
+    mocr_admit_release(&ctx->admit, size);
+
+    return text;
+}
+
+/**
+ * @brief Hands an asynchronous read back to the async threads once the
+ * dispatcher has read it, so its callback doesn't hold up the next batch
+ *
+ * @param job The read's job on the dispatcher
+ */
+static void complete_batched(mocr_job *job)
+{
+    mocr_request *request = (mocr_request *)(
+        (char *)job - offsetof(mocr_request, sched_job)
+    );
+    request->text = job->text;
+    request->batched = 1;
+    mocr_async_requeue(&request->ctx->async, &request->job);
+}
+
+/**
+ * @brief Looks up the text of an asynchronous read of an image buffer in its
+ * context's cache. On a miss the read is marked so its text is added once
+ * it's read.
+ *
+ * @param ctx The mangaocr context
+ * @param request The read
+ * @return Nonzero if the text was found and set on the read
+ */
+static int read_cached(mocr_ctx *ctx, mocr_request *request)
+{
+    if (!cache_key(ctx, &request->image, &request->cache_key))
+    {
+        return 0;
+    }
+    request->text = mocr_cache_get(&ctx->cache, &request->cache_key);
+    request->cache_text = request->text == NULL;
+    return !request->cache_text;
+}
+
+/**
+ * @brief Calls the callback of an asynchronous read with its text or queues
+ * the text, then drops the context's reference to the read
+ *
+ * @param ctx The mangaocr context
+ * @param request The read with its text set
+ */
+static void finish_request(mocr_ctx *ctx, mocr_request *request)
+{
+    if (request->callback)
+    {
+        request->callback(request, request->text, request->userdata);
+    }
+    else
+    {
+        /* The queue holds a reference until the text is taken off it */
+        mocr_atomic_add32(&request->refs, 1);
+        mocr_cq_push(&ctx->cq, &request->cq_entry);
+    }
+    mocr_atomic_store32(&request->done, 1);
+    mocr_futex_wake(&request->done);
+    release_request(request);
+}
+
+/**
+ * @brief Reads the image of an asynchronous read and calls its callback or
+ * queues its text. Runs on the context's async threads.
+ *
+ * @param arg The mangaocr context
+ * @param job The read's job
+ * @return 0 if the read finished, nonzero if it was handed to the dispatcher
+ */
+static int run_request(void *arg, mocr_async_job *job)
+{
+    mocr_ctx *ctx = arg;
+    mocr_request *request = (mocr_request *)job;
+
+    if (request_expired(request))
+    {
+        /* Dropped without touching the model */
+    }
+    else if (request->path)
+    {
+        request->text = read_file(ctx, request->path, request);
+    }
+    else if (request->batched)
+    {
+        /* The dispatcher has already read the image */
+    }
+    else if (request->cached)
+    {
+        /* The image was read before, so the model isn't needed */
+    }
+    else
+    {
+        /* Don't hold the thread while the read waits for a batch. Worker
+         * processes come first, like in mocr_read_strided(). */
+        if (ctx->sched_running &&
+            !mocr_atomic_load32(&ctx->proc_running) &&
+            image_valid(&request->image))
+        {
+            request->sched_job.image = request->image;
+            request->sched_job.complete = complete_batched;
+            if (mocr_sched_submit(&ctx->sched, &request->sched_job) == 0)
+            {
+                return 1;
+            }
+        }
+        request->text = read_strided(
+            ctx,
+            request->image.data,
+            request->image.width, request->image.height,
+            request->image.stride,
+            request->image.mode,
+            request
+        );
+    }
+
+    /* A read that expired while it couldn't be interrupted still fails */
+    if (request_expired(request))
+    {
+        free(request->text);
+        request->text = NULL;
+    }
+
+    /* Text cut short by a cancellation never gets this far */
+    if (request->cache_text && request->text)
+    {
+        mocr_cache_put(&ctx->cache, &request->cache_key, request->text);
+    }
+
+    /* The image isn't touched again, so make room before the callback */
+    if (request->admitted)
+    {
+        request->admitted = 0;
+        mocr_admit_release(&ctx->admit, request->bytes);
+    }
+
+    finish_request(ctx, request);
+    return 0;
+}
+
+/**
+ * @brief Starts the async threads of a context if they aren't running
+ *
+ * @param ctx The mangaocr context
+ * @return 0 on success, nonzero on error
+ */
+static int start_async(mocr_ctx *ctx)
+{
+    int ret = 0;
+
+    if (mocr_atomic_load32(&ctx->async_running))
+    {
+        return 0;
+    }
+    mocr_mutex_lock(&g_asyncMutex);
+    if (!ctx->async_running)
+    {
+        ret = mocr_async_start(
+            &ctx->async, (size_t)ctx->async_threads, run_request, ctx
+        );
+        if (ret == 0)
+        {
+            mocr_atomic_store32(&ctx->async_running, 1);
+        }
+    }
+    mocr_mutex_unlock(&g_asyncMutex);
+
+    return ret;
+}
+
+/**
+ * @brief Queues an asynchronous read on a context
+ *
+ * @param ctx The mangaocr context
+ * @param request The read with its image or path set. Freed on error.
+ * @param callback Called with the text once it's read, NULL to queue it
+ * @param userdata Passed to callback
+ * @param bytes The bytes of image data the read holds
+ * @return The read, NULL on error
+ */
+static mocr_request *submit_request(
+    mocr_ctx *ctx,
+    mocr_request *request,
+    mocr_callback callback,
+    void *userdata,
+    uint64_t bytes)
+{
+    request->ctx = ctx;
+    request->callback = callback;
+    request->userdata = userdata;
+    request->refs = 2;
+    request->bytes = bytes;
+    if (start_async(ctx))
+    {
+        goto error;
+    }
+
+    /* A read answered from the cache holds no image data and has nothing to
+     * wait for, so it skips admission and the reads queued ahead of it */
+    if (request->path == NULL && read_cached(ctx, request))
+    {
+        request->cached = 1;
+        if (callback == NULL)
+        {
+            finish_request(ctx, request);
+            return request;
+        }
+        if (mocr_async_push_front(&ctx->async, &request->job))
+        {
+            free(request->text);
+            goto error;
+        }
+        return request;
+    }
+
+    if (admit_read(ctx, bytes))
+    {
+        goto error;
+    }
+    request->admitted = 1;
+    if (mocr_async_push(&ctx->async, &request->job))
+    {
+        mocr_admit_release(&ctx->admit, bytes);
+        goto error;
+    }
+    return request;
+
+error:
+    free(request->path);
+    free(request);
+
+    return NULL;
+}
+
+mocr_request *mocr_read_async(
+    mocr_ctx *ctx,
+    void *data,
+    size_t width,
+    size_t height,
+    mocr_mode mode,
+    mocr_callback callback,
+    void *userdata)
+{
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
+    mocr_request *request = calloc(1, sizeof(mocr_request));
+    if (request == NULL)
+    {
+        return NULL;
+    }
+    mocr_image image = {data, width, height, 0, mode};
+    request->image = image;
+    return submit_request(
+        ctx, request, callback, userdata, image_bytes(&image)
+    );
+}
+
+mocr_request *mocr_read_file_async(
+    mocr_ctx *ctx, const char *path, mocr_callback callback, void *userdata)
+{
+    if (ctx == NULL || path == NULL)
+    {
+        return NULL;
+    }
+    mocr_request *request = calloc(1, sizeof(mocr_request));
+    if (request == NULL)
+    {
+        return NULL;
+    }
+    request->path = strdup(path);
+    if (request->path == NULL)
+    {
+        free(request);
+        return NULL;
+    }
+    return submit_request(ctx, request, callback, userdata, 0);
+}
+
+int mocr_completion_fd(mocr_ctx *ctx)
+{
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+    return mocr_cq_fd(&ctx->cq);
+}
 
-    return text;
+size_t mocr_poll(mocr_ctx *ctx, mocr_result *results, size_t max)
+{
+    size_t count = 0;
+
+    if (ctx == NULL || results == NULL)
+    {
+        return 0;
+    }
+
+    mocr_cq_entry *entry = mocr_cq_pop(&ctx->cq, max);
+    while (entry)
+    {
+        mocr_request *request = (mocr_request *)(
+            (char *)entry - offsetof(mocr_request, cq_entry)
+        );
+        entry = entry->next;
+
+        results[count].request = request;
+        results[count].text = request->text;
+        results[count].userdata = request->userdata;
+        ++count;
+        release_request(request);
+    }
+
+    return count;
 }
 
-#undef BITS_IN_BYTE
+int mocr_request_set_priority(mocr_request *request, mocr_priority priority)
+{
+    if (request == NULL ||
+        (priority != mocr_priority_bulk &&
+         priority != mocr_priority_interactive))
+    {
+        return -1;
+    }
 
-char *mocr_read_file(mocr_ctx *ctx, const char *path)
+    /* A finished read is no longer on the queue, which may be gone */
+    if (mocr_atomic_load32(&request->done))
+    {
+        return 0;
+    }
+    mocr_async_set_priority(
+        &request->ctx->async,
+        &request->job,
+        priority == mocr_priority_interactive ? 1 : 0
+    );
+    return 0;
+}
+
+int mocr_request_cancel(mocr_request *request)
 {
-    char *text = NULL;
+    if (request == NULL)
+    {
+        return -1;
+    }
+    mocr_atomic_store32(&request->cancelled, 1);
+    return 0;
+}
 
-    PyGILState_STATE gstate = PyGILState_Ensure();
+int mocr_request_set_timeout(mocr_request *request, uint64_t timeout_us)
+{
+    if (request == NULL)
+    {
+        return -1;
+    }
+    uint64_t now = mocr_time_now();
+    uint64_t deadline = UINT64_MAX;
+    if (timeout_us < (UINT64_MAX - now) / NSEC_PER_USEC)
+    {
+        deadline = now + timeout_us * NSEC_PER_USEC;
+    }
+    mocr_atomic_store(&request->deadline, deadline ? deadline : 1);
+    return 0;
+}
 
-    PyObject *args = Py_BuildValue("(s)", path);
-    if (args == NULL)
+int mocr_request_wait(mocr_request *request)
+{
+    if (request == NULL)
+    {
+        return -1;
+    }
+    while (mocr_atomic_load32(&request->done) == 0)
+    {
+        mocr_futex_wait(&request->done, 0);
+    }
+    return 0;
+}
+
+int mocr_request_free(mocr_request *request)
+{
+    if (request)
+    {
+        release_request(request);
+    }
+    return 0;
+}
+
+mocr_stream *mocr_stream_create(mocr_ctx *ctx)
+{
+    if (ctx == NULL)
     {
-        PyErr_Print();
         return NULL;
     }
-    text = call_read(ctx, args);
-    Py_DECREF(args);
-    args = NULL;
+    mocr_stream *stream = calloc(1, sizeof(mocr_stream));
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    if (mocr_mutex_init(&stream->mutex))
+    {
+        free(stream);
+        return NULL;
+    }
+    stream->ctx = ctx;
+    return stream;
+}
 
-    PyGILState_Release(gstate);
+int mocr_stream_destroy(mocr_stream *stream)
+{
+    if (stream)
+    {
+        if (stream->latest)
+        {
+            release_request(stream->latest);
+        }
+        mocr_mutex_destroy(&stream->mutex);
+        free(stream);
+    }
+    return 0;
+}
 
-    return text;
+/**
+ * @brief Makes a read the newest on a stream and cancels the one it replaces
+ *
+ * @param stream The stream
+ * @param request The read that was just started, NULL if it couldn't be
+ * @return request
+ */
+static mocr_request *replace_latest(mocr_stream *stream, mocr_request *request)
+{
+    if (request == NULL)
+    {
+        return NULL;
+    }
+
+    /* The caller can't free its handle before this returns, so the read is
+     * still alive */
+    mocr_atomic_add32(&request->refs, 1);
+    mocr_mutex_lock(&stream->mutex);
+    mocr_request *replaced = stream->latest;
+    stream->latest = request;
+    mocr_mutex_unlock(&stream->mutex);
+
+    if (replaced)
+    {
+        mocr_request_cancel(replaced);
+        release_request(replaced);
+    }
+    return request;
+}
+
+mocr_request *mocr_stream_read_async(
+    mocr_stream *stream,
+    void *data,
+    size_t width,
+    size_t height,
+    mocr_mode mode,
+    mocr_callback callback,
+    void *userdata)
+{
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    return replace_latest(
+        stream,
+        mocr_read_async(
+            stream->ctx, data, width, height, mode, callback, userdata
+        )
+    );
+}
+
+mocr_request *mocr_stream_read_file_async(
+    mocr_stream *stream,
+    const char *path,
+    mocr_callback callback,
+    void *userdata)
+{
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    return replace_latest(
+        stream, mocr_read_file_async(stream->ctx, path, callback, userdata)
+    );
+}
+
+/**
+ * @brief Stops the scheduler and starts it again with the context's batch
+ * settings if coalescing is enabled
+ *
+ * @param ctx The mangaocr context. The GIL must not be held.
+ * @return 0 on success, nonzero on error
+ */
+static int restart_sched(mocr_ctx *ctx)
+{
+    if (ctx->sched_running)
+    {
+        mocr_sched_stop(&ctx->sched);
+        ctx->sched_running = 0;
+    }
+    if (ctx->batch_size <= 1)
+    {
+        return 0;
+    }
+    if (mocr_sched_start(
+            &ctx->sched,
+            (size_t)ctx->batch_size,
+            (uint64_t)ctx->batch_wait_us * NSEC_PER_USEC,
+            read_sched_batch,
+            ctx))
+    {
+        return -1;
+    }
+    ctx->sched_running = 1;
+    return 0;
+}
+
+/**
+ * @brief Stops the executors and starts them again with the context's number
+ * of executor threads if executors are enabled
+ *
+ * @param ctx The mangaocr context. The GIL must not be held.
+ * @return 0 on success, nonzero on error
+ */
+static int restart_exec(mocr_ctx *ctx)
+{
+    if (ctx->exec_running)
+    {
+        mocr_exec_stop(&ctx->exec);
+        ctx->exec_running = 0;
+    }
+    if (ctx->executor_threads == 0)
+    {
+        return 0;
+    }
+    PyInterpreterState *interp = NULL;
+#if defined(MOCR_HAVE_SUBINTERPRETERS)
+    if (ctx->sub_tstate)
+    {
+        interp = PyThreadState_GetInterpreter(ctx->sub_tstate);
+    }
+#endif
+    if (mocr_exec_start(&ctx->exec, (size_t)ctx->executor_threads, interp))
+    {
+        return -1;
+    }
+    ctx->exec_running = 1;
+    return 0;
+}
+
+#if defined(MOCR_HAVE_PROC)
+
+/**
+ * @brief Gets a context ready to read in the zygote worker processes are
+ * forked from
+ *
+ * @param arg The mangaocr context
+ */
+static void init_worker(void *arg)
+{
+    mocr_ctx *ctx = arg;
+
+    /* Only the forking thread survives fork(), so workers read everything
+     * themselves */
+    mocr_atomic_store32(&ctx->proc_running, 0);
+    ctx->sched_running = 0;
+    ctx->exec_running = 0;
+    ctx->async_running = 0;
+#if defined(MOCR_FREE_THREADED)
+    mocr_mutex_init(&ctx->py_mutex);
+#endif
+}
+
+/**
+ * @brief Reads an image in a worker process
+ *
+ * @param arg The mangaocr context
+ * @param image The image to read
+ * @return The text read from the image, NULL on error
+ */
+static char *read_worker_image(void *arg, const mocr_image *image)
+{
+    /* The parent admitted the read */
+    return read_strided(
+        arg,
+        image->data,
+        image->width, image->height,
+        image->stride,
+        image->mode,
+        NULL
+    );
+}
+
+#endif
+
+/**
+ * @brief Forks or retires worker processes until the context's number of them
+ * are running. The zygote they're forked from is started the first time
+ * they're enabled and kept until the context is destroyed, so later changes
+ * only take as long as fork().
+ *
+ * @param ctx The mangaocr context. The GIL must not be held.
+ * @return 0 on success, nonzero on error
+ */
+static int resize_proc(mocr_ctx *ctx)
+{
+#if defined(MOCR_HAVE_PROC)
+    if (!mocr_atomic_load32(&ctx->proc_running))
+    {
+        if (ctx->worker_processes == 0)
+        {
+            return 0;
+        }
+        if (mocr_proc_start(
+                &ctx->proc,
+                MAX_WORKER_PROCESSES,
+                init_worker,
+                read_worker_image,
+                ctx))
+        {
+            return -1;
+        }
+        /* Publishes the started set to readers on other threads */
+        mocr_atomic_store32(&ctx->proc_running, 1);
+    }
+    return mocr_proc_resize(&ctx->proc, (size_t)ctx->worker_processes);
+#else
+    return ctx->worker_processes == 0 ? 0 : -1;
+#endif
+}
+
+/**
+ * @brief Replaces the zygote and its workers, so the workers read with the
+ * context's current options. The zygote keeps the copy of the context it was
+ * forked with.
+ *
+ * @param ctx The mangaocr context. The GIL must not be held.
+ * @return 0 on success, nonzero if the workers couldn't be started again, in
+ * which case they're disabled
+ */
+static int restart_proc(mocr_ctx *ctx)
+{
+#if defined(MOCR_HAVE_PROC)
+    if (!mocr_atomic_load32(&ctx->proc_running))
+    {
+        return 0;
+    }
+    mocr_atomic_store32(&ctx->proc_running, 0);
+    mocr_proc_stop(&ctx->proc);
+    if (resize_proc(ctx))
+    {
+        ctx->worker_processes = 0;
+        resize_proc(ctx);
+        return -1;
+    }
+#endif
+    (void)ctx;
+    return 0;
+}
+
+/**
+ * @brief Moves a context into or out of its own subinterpreter
+ *
+ * @param ctx The mangaocr context. The GIL must not be held.
+ * @param enable Nonzero to move the context into a subinterpreter
+ * @return 0 on success, nonzero on error
+ */
+static int set_subinterpreter(mocr_ctx *ctx, int enable)
+{
+    if (enable == (ctx->sub_tstate != NULL))
+    {
+        return 0;
+    }
+
+    /* Workers are forked from the main interpreter */
+    if (ctx->worker_processes)
+    {
+        return -1;
+    }
+#if defined(MOCR_HAVE_SUBINTERPRETERS)
+#if defined(MOCR_HAVE_PROC)
+    /* The zygote's copy of the context stays in the main interpreter */
+    if (mocr_atomic_load32(&ctx->proc_running))
+    {
+        mocr_atomic_store32(&ctx->proc_running, 0);
+        mocr_proc_stop(&ctx->proc);
+    }
+#endif
+    /* Nothing may be running in the interpreter being left */
+    if (ctx->sched_running)
+    {
+        mocr_sched_stop(&ctx->sched);
+        ctx->sched_running = 0;
+    }
+    if (ctx->exec_running)
+    {
+        mocr_exec_stop(&ctx->exec);
+        ctx->exec_running = 0;
+    }
+
+    int ret = enable ? enter_subinterpreter(ctx) : leave_subinterpreter(ctx);
+
+    /* Callers can't take the GIL of a subinterpreter themselves */
+    if (ctx->sub_tstate && ctx->executor_threads == 0)
+    {
+        ctx->executor_threads = 1;
+    }
+    if (restart_exec(ctx) || restart_sched(ctx))
+    {
+        ret = -1;
+    }
+    return ret;
+#else
+    return -1;
+#endif
+}
+
+int mocr_set_option(mocr_ctx *ctx, mocr_option option, int64_t value)
+{
+    int ret = -1;
+    py_call call = {0};
+
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+
+    /* Reads in flight finish with the options they were started with. Worker
+     * processes and admission limits can change under them. */
+    if (option != mocr_option_worker_processes &&
+        option != mocr_option_max_pending &&
+        option != mocr_option_max_pending_bytes &&
+        option != mocr_option_overload &&
+        option != mocr_option_cache_bytes)
+    {
+        stop_async(ctx);
+    }
+
+    switch (option)
+    {
+        case mocr_option_native_preprocess:
+            if ((value != 0) == ctx->native_preprocess)
+            {
+                ret = 0;
+                break;
+            }
+            if (value == 0)
+            {
+                ctx->native_preprocess = 0;
+                ret = restart_proc(ctx);
+                break;
+            }
+            call.ctx = ctx;
+            call.ret = -1;
+            run_python(locked_init_native_preprocess, &call);
+            if (call.ret == 0)
+            {
+                ctx->native_preprocess = 1;
+                ret = restart_proc(ctx);
+            }
+            break;
+
+        case mocr_option_batch_size:
+            if (value < 1 || (uint64_t)value > SIZE_MAX / sizeof(char *))
+            {
+                break;
+            }
+            ctx->batch_size = value;
+            ret = restart_sched(ctx);
+            break;
+
+        case mocr_option_batch_wait_us:
+            if (value < 0 || (uint64_t)value > UINT64_MAX / NSEC_PER_USEC)
+            {
+                break;
+            }
+            ctx->batch_wait_us = value;
+            ret = restart_sched(ctx);
+            break;
+
+        case mocr_option_executor_threads:
+            if (value < (ctx->sub_tstate ? 1 : 0) ||
+                value > MAX_EXECUTOR_THREADS)
+            {
+                break;
+            }
+            ctx->executor_threads = value;
+            ret = restart_exec(ctx);
+            break;
+
+        case mocr_option_subinterpreter:
+            ret = set_subinterpreter(ctx, value != 0);
+            break;
+
+        case mocr_option_worker_processes:
+            if (value < 0 || value > MAX_WORKER_PROCESSES ||
+                (value && ctx->sub_tstate))
+            {
+                break;
+            }
+            ctx->worker_processes = value;
+            ret = resize_proc(ctx);
+            if (ret)
+            {
+                ctx->worker_processes = 0;
+                resize_proc(ctx);
+            }
+            break;
+
+        case mocr_option_async_threads:
+            if (value < 1 || value > MAX_ASYNC_THREADS)
+            {
+                break;
+            }
+            ctx->async_threads = value;
+            ret = 0;
+            break;
+
+        case mocr_option_max_pending:
+            if (value < 0 || (uint64_t)value > SIZE_MAX)
+            {
+                break;
+            }
+            ctx->max_pending = value;
+            mocr_admit_set_limits(
+                &ctx->admit,
+                (size_t)ctx->max_pending,
+                (uint64_t)ctx->max_pending_bytes
+            );
+            ret = 0;
+            break;
+
+        case mocr_option_max_pending_bytes:
+            if (value < 0)
+            {
+                break;
+            }
+            ctx->max_pending_bytes = value;
+            mocr_admit_set_limits(
+                &ctx->admit,
+                (size_t)ctx->max_pending,
+                (uint64_t)ctx->max_pending_bytes
+            );
+            ret = 0;
+            break;
+
+        case mocr_option_overload:
+            if (value != mocr_overload_block &&
+                value != mocr_overload_fail &&
+                value != mocr_overload_shed_oldest)
+            {
+                break;
+            }
+            ctx->overload = value;
+            ret = 0;
+            break;
+
+        case mocr_option_cache_bytes:
+            if (value < 0)
+            {
+                break;
+            }
+            ctx->cache_bytes = value;
+            mocr_cache_set_budget(&ctx->cache, (uint64_t)value);
+            ret = 0;
+            break;
+
+        case mocr_option_file_cache_hash:
+            ctx->file_cache_hash = value != 0;
+            ret = 0;
+            break;
+
+        case mocr_option_concurrent_reads:
+            if (value == 0)
+            {
+                ctx->concurrent_reads = 0;
+                ret = 0;
+                break;
+            }
+#if defined(MOCR_FREE_THREADED)
+            call.ctx = ctx;
+            call.ret = -1;
+            run_python(locked_check_gil_disabled, &call);
+            if (call.ret == 0)
+            {
+                ctx->concurrent_reads = 1;
+                ret = 0;
+            }
+#endif
+            break;
+    }
+
+    return ret;
+}
+
+int mocr_get_option(mocr_ctx *ctx, mocr_option option, int64_t *value)
+{
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+    switch (option)
+    {
+        case mocr_option_native_preprocess:
+            *value = ctx->native_preprocess;
+            return 0;
+
+        case mocr_option_batch_size:
+            *value = ctx->batch_size;
+            return 0;
+
+        case mocr_option_batch_wait_us:
+            *value = ctx->batch_wait_us;
+            return 0;
+
+        case mocr_option_executor_threads:
+            *value = ctx->executor_threads;
+            return 0;
+
+        case mocr_option_subinterpreter:
+            *value = ctx->sub_tstate != NULL;
+            return 0;
+
+        case mocr_option_concurrent_reads:
+            *value = ctx->concurrent_reads;
+            return 0;
+
+        case mocr_option_worker_processes:
+            *value = ctx->worker_processes;
+            return 0;
+
+        case mocr_option_async_threads:
+            *value = ctx->async_threads;
+            return 0;
+
+        case mocr_option_max_pending:
+            *value = ctx->max_pending;
+            return 0;
+
+        case mocr_option_max_pending_bytes:
+            *value = ctx->max_pending_bytes;
+            return 0;
+
+        case mocr_option_overload:
+            *value = ctx->overload;
+            return 0;
+
+        case mocr_option_cache_bytes:
+            *value = ctx->cache_bytes;
+            return 0;
+
+        case mocr_option_file_cache_hash:
+            *value = ctx->file_cache_hash;
+            return 0;
+    }
+    return -1;
+}
+
+int mocr_get_cache_stats(mocr_ctx *ctx, mocr_cache_stats *stats)
+{
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+    mocr_cache_get_stats(
+        &ctx->cache,
+        &stats->hits,
+        &stats->misses,
+        &stats->entries,
+        &stats->bytes
+    );
+    return 0;
+}
+
+int mocr_set_file_cache(mocr_ctx *ctx, const char *path)
+{
+    mocr_fcache *fcache = NULL;
+
+    if (ctx == NULL)
+    {
+        return -1;
+    }
+    if (path)
+    {
+        fcache = mocr_fcache_open(path);
+        if (fcache == NULL)
+        {
+            return -1;
+        }
+    }
+
+    /* Asynchronous reads in flight may be using the old file */
+    stop_async(ctx);
+    if (ctx->fcache)
+    {
+        mocr_fcache_close(ctx->fcache);
+    }
+    ctx->fcache = fcache;
+    return 0;
 }
 
 int mocr_free(void *ptr)
@@ -358,11 +4107,16 @@ int mocr_free(void *ptr)
 
 int mocr_finalize(void)
 {
-    if (g_mainThreadState == NULL)
+    int ret = 0;
+
+    mocr_mutex_lock(&g_modelsMutex);
+    if (g_mainThreadState)
     {
-        return 0;
+        PyEval_RestoreThread(g_mainThreadState);
+        g_mainThreadState = NULL;
+        ret = Py_FinalizeEx();
     }
-    PyEval_RestoreThread(g_mainThreadState);
-    g_mainThreadState = NULL;
-    return Py_FinalizeEx();
+    mocr_mutex_unlock(&g_modelsMutex);
+
+    return ret;
 }
@@ -34,16 +34,44 @@ extern "C" {
 /* The libmocr state object */
 typedef struct mocr_ctx mocr_ctx;
 
+/* An image buffer registered for reading multiple regions from */
+typedef struct mocr_page mocr_page;
+
+/* A set of contexts that threads check out and return */
+typedef struct mocr_pool mocr_pool;
+
+/* An asynchronous read started with mocr_read_async() or
+ * mocr_read_file_async() */
+typedef struct mocr_request mocr_request;
+
+/* A sequence of asynchronous reads where only the newest matters, such as the
+ * crops of a live screen or video */
+typedef struct mocr_stream mocr_stream;
+
+/**
+ * @brief Receives the result of an asynchronous read. Called on one of the
+ * context's internal threads. It may start other reads, but must not set
+ * options on the context or destroy it.
+ *
+ * @param request The read that finished
+ * @param text The text extracted from the image, NULL on error. This must be
+ *             freed with mocr_free().
+ * @param userdata The pointer the read was started with
+ */
+typedef void (*mocr_callback)(mocr_request *request, char *text, void *userdata);
+
 /* Defines the various modes for reading in image data */
 typedef enum mocr_mode
 {
-    /* 1-bit pixels, black and white, stored with one pixel per byte */
+    /* 1-bit pixels, black and white, stored with one pixel per byte. Zero is
+     * black and any other value is white. */
     mocr_mode_1,
 
     /* 8-bit pixels, black and white */
     mocr_mode_L,
 
-    /* 8-bit pixels, mapped to any other mode using a color palette */
+    /* 8-bit pixels, mapped to any other mode using a color palette. No palette
+     * can be supplied, so the indices are read as grayscale. */
     mocr_mode_P,
 
     /* 3x8-bit pixels, true color */
@@ -58,7 +86,7 @@ typedef enum mocr_mode
     /* 3x8-bit pixels, color video format */
     mocr_mode_YCbCr,
 
-    /* 3x8-bit pixels, the L*a*b color space */
+    /* 3x8-bit pixels, the L*a*b color space. Only the L* band is read. */
     mocr_mode_LAB,
 
     /* 3x8-bit pixels, Hue, Saturation, Value color space */
@@ -69,11 +97,257 @@ typedef enum mocr_mode
 
     /* 32-bit floating point pixels */
     mocr_mode_F,
+
+    /* 1-bit pixels, black and white, packed 8 to a byte with the most
+     * significant bit first. Each row starts on a new byte. */
+    mocr_mode_1_packed,
 }
 mocr_mode;
 
+/* Defines the priority classes of asynchronous reads. Reads waiting for one of
+ * the context's async threads are started in priority order, so priorities
+ * matter most when there are few async threads. */
+typedef enum mocr_priority
+{
+    /* Background work such as indexing. While interactive reads are waiting,
+     * one read in every eight started is still a bulk read so bulk work keeps
+     * moving. The default. */
+    mocr_priority_bulk,
+
+    /* Work someone is waiting on. Started before any waiting bulk read. */
+    mocr_priority_interactive,
+}
+mocr_priority;
+
+/* Defines the options that can be set on a context with mocr_set_option() */
+typedef enum mocr_option
+{
+    /* Nonzero to convert, resize, and normalize image buffers in C instead of
+     * with PIL and the model's image processor. This requires PyTorch and an
+     * image processor that resizes bilinearly. Defaults to 0. */
+    mocr_option_native_preprocess,
+
+    /* The most concurrent mocr_read() and mocr_read_strided() calls that are
+     * coalesced into a single batch. Calls still block until their own text
+     * is read. 1 disables coalescing. Defaults to 1. */
+    mocr_option_batch_size,
+
+    /* How long in microseconds the oldest coalesced call waits for a batch to
+     * fill before it's read anyway. Defaults to 5000. */
+    mocr_option_batch_wait_us,
+
+    /* The number of internal threads that make every call into Python for the
+     * context. They keep their interpreter state and hold the GIL while calls
+     * are queued, so callers never take the GIL themselves. 0 makes calls on
+     * the calling thread. At most 256. Defaults to 0. */
+    mocr_option_executor_threads,
+
+    /* Nonzero to move the context into its own subinterpreter with its own
+     * GIL, so contexts can run Python in parallel. Requires Python 3.12 or
+     * newer and that mangaocr and its dependencies can be imported into a
+     * subinterpreter. If they can't, setting the option fails and the context
+     * keeps using the main interpreter. The model isn't shared with other
+     * contexts while enabled. Calls are always made on executor threads, so
+     * mocr_option_executor_threads becomes at least 1. Defaults to 0. */
+    mocr_option_subinterpreter,
+
+    /* Nonzero to let calls on the context run Python at the same time from
+     * different threads. Only free-threaded builds of Python can do this, and
+     * only while the GIL hasn't been turned back on by an extension, so
+     * setting it fails otherwise. Without it, a free-threaded build makes
+     * calls on one context one at a time, like the GIL would. Defaults to 0. */
+    mocr_option_concurrent_reads,
+
+    /* The number of worker processes forked to read image buffers passed to
+     * mocr_read() and mocr_read_strided(). Each worker has its own copy of the
+     * interpreter and model, so concurrent calls scale across cores. Images
+     * reach the workers through shared memory. Images over 16 megapixels, and
+     * every other kind of read, are still read in the calling process. The
+     * first time workers are enabled, a zygote process is forked with the
+     * model already loaded, and workers are forked from it. They share its
+     * memory, including the model's weights, until they write to it. Later
+     * changes fork or retire workers in milliseconds, and unlike most options
+     * can be made while other threads read. The zygote is kept until the
+     * context is destroyed. It keeps the options it was forked with, so
+     * changing mocr_option_native_preprocess while workers are enabled forks
+     * a new zygote and new workers. If they can't be forked, the workers are
+     * disabled and setting the option fails. No other option changes how
+     * workers read. 0 disables the workers. At most 64. Not available on
+     * Windows or with mocr_option_subinterpreter. Defaults to 0. */
+    mocr_option_worker_processes,
+
+    /* The number of internal threads asynchronous reads are made on and their
+     * callbacks are called on. Reads that are coalesced into batches are
+     * handed to the dispatcher and don't hold a thread while they wait for
+     * their batch, so a few threads serve many reads in flight. The threads
+     * are started by the first asynchronous read. Setting any other option
+     * waits for the reads in flight to finish, except for
+     * mocr_option_worker_processes, mocr_option_max_pending,
+     * mocr_option_max_pending_bytes, mocr_option_overload, and
+     * mocr_option_cache_bytes, which can be changed while reads are in
+     * flight. At least 1 and at most 256. Defaults to 1. */
+    mocr_option_async_threads,
+
+    /* The most reads the context accepts at once, counting reads that are
+     * running, waiting for the model, and queued for the async threads.
+     * mocr_option_overload decides what happens to reads past the limit. Can
+     * be changed while reads are in flight, and reads already accepted stay
+     * accepted. 0 for no limit. Defaults to 0. */
+    mocr_option_max_pending,
+
+    /* The most bytes of image data the reads the context accepts at once may
+     * hold. Image files count as 0 bytes and encoded images as their size. A
+     * read is always accepted when no other read is, however large it is. Can
+     * be changed while reads are in flight, and reads already accepted stay
+     * accepted. 0 for no limit. Defaults to 0. */
+    mocr_option_max_pending_bytes,
+
+    /* What happens to a read past mocr_option_max_pending or
+     * mocr_option_max_pending_bytes, one of mocr_overload. Can be changed
+     * while reads are in flight. Defaults to mocr_overload_block. */
+    mocr_option_overload,
+
+    /* The most bytes of memory the context spends remembering the text read
+     * from image buffers passed to mocr_read(), mocr_read_strided(), and
+     * mocr_read_async(). An image with the same pixels, size, and format as
+     * one read before is answered from memory in microseconds, without the
+     * GIL. Images are matched by two differently seeded 64-bit hashes of
+     * their pixels rather than the pixels themselves, so another image's text
+     * is only returned if both hashes collide, which is vanishingly unlikely
+     * for images that aren't crafted to collide. The least recently used
+     * texts are dropped to stay within the budget.
+     * mocr_read_async() looks the image up before admission, so a hit is
+     * never refused or blocked by mocr_option_max_pending. Without a
+     * callback its text is queued for mocr_poll() before the call returns;
+     * with one, the callback runs on the next free internal thread, ahead of
+     * the reads already queued. Can be changed while reads are in flight. 0
+     * disables the cache and empties it. Defaults to 0. */
+    mocr_option_cache_bytes,
+
+    /* Nonzero to also match image files in the file cache by a hash of their
+     * contents, so a file rewritten with the same size and modification time
+     * isn't answered with its old text. Costs one pass over each file. See
+     * mocr_set_file_cache(). Defaults to 0. */
+    mocr_option_file_cache_hash,
+}
+mocr_option;
+
+/* Defines what happens to a read that a context can't accept because of
+ * mocr_option_max_pending or mocr_option_max_pending_bytes */
+typedef enum mocr_overload
+{
+    /* The call waits until enough earlier reads finish. Callbacks on the
+     * context must not start reads with this policy, since the reads they'd
+     * wait for may need their thread. */
+    mocr_overload_block,
+
+    /* The call fails right away with errno set to EAGAIN */
+    mocr_overload_fail,
+
+    /* The oldest asynchronous read that hasn't started yet is cancelled to
+     * make room, as if by mocr_request_cancel(), bulk reads before
+     * interactive ones. If there is none, the call waits like
+     * mocr_overload_block. */
+    mocr_overload_shed_oldest,
+}
+mocr_overload;
+
+/* A rectangular region of an image in pixels */
+typedef struct mocr_rect
+{
+    /* The column of the left edge of the region */
+    size_t x;
+
+    /* The row of the top edge of the region */
+    size_t y;
+
+    /* The width of the region */
+    size_t width;
+
+    /* The height of the region */
+    size_t height;
+}
+mocr_rect;
+
+/* An image buffer to read as part of a batch */
+typedef struct mocr_image
+{
+    /* The image data */
+    const void *data;
+
+    /* The width of the image in pixels */
+    size_t width;
+
+    /* The height of the image in pixels */
+    size_t height;
+
+    /* The number of bytes between the start of consecutive rows. 0 if the rows
+     * are tightly packed. */
+    size_t stride;
+
+    /* The format of the image data */
+    mocr_mode mode;
+}
+mocr_image;
+
+/* A finished asynchronous read taken off a context with mocr_poll() */
+typedef struct mocr_result
+{
+    /* The handle of the read. Only valid if it hasn't been freed with
+     * mocr_request_free(), otherwise it can only be compared. */
+    mocr_request *request;
+
+    /* The text extracted from the image, NULL on error. This must be freed
+     * with mocr_free(). */
+    char *text;
+
+    /* The pointer the read was started with */
+    void *userdata;
+}
+mocr_result;
+
+/* Counters of a context's cache of texts, see mocr_option_cache_bytes */
+typedef struct mocr_cache_stats
+{
+    /* The number of reads answered from the cache */
+    uint64_t hits;
+
+    /* The number of reads that weren't in the cache */
+    uint64_t misses;
+
+    /* The number of texts in the cache */
+    uint64_t entries;
+
+    /* The bytes of memory the texts in the cache take */
+    uint64_t bytes;
+}
+mocr_cache_stats;
+
+/* Usage statistics for a context in a pool */
+typedef struct mocr_pool_stats
+{
+    /* The number of times the context has been checked out */
+    uint64_t checkouts;
+
+    /* The total time in microseconds the context has spent checked out, not
+     * counting the current checkout */
+    uint64_t busy_us;
+
+    /* Nonzero if the context is checked out */
+    int busy;
+}
+mocr_pool_stats;
+
+/* libmocr is built with its symbols hidden, so only the functions declared
+ * below are exported */
+#if defined(__GNUC__) && !defined(_WIN32)
+#pragma GCC visibility push(default)
+#endif
+
 /**
- * @brief Initializes manga-ocr's state with a model
+ * @brief Initializes manga-ocr's state with a model. Contexts created with the
+ * same model and force_cpu share one copy of the model, which is unloaded when
+ * the last of them is destroyed. Options and other state are per context.
  *
  * @param model A HuggingFace repo, URL, or path to a local model
  * @param force_cpu 0 to use CUDA is available, nonzero to force CPU usage
@@ -104,6 +378,92 @@ int mocr_destroy(mocr_ctx *ctx);
 char *mocr_read(
     mocr_ctx *ctx, void *data, size_t width, size_t height, mocr_mode mode);
 
+/**
+ * @brief Extracts text from an image buffer with padded rows
+ *
+ * @param ctx The context containing the model
+ * @param data The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of consecutive rows. 0
+ *               if the rows are tightly packed. The last row does not need to
+ *               be padded.
+ * @param mode The format of the image data
+ * @return The text extracted from the image. This must be freed with
+ * mocr_free().
+ */
+char *mocr_read_strided(
+    mocr_ctx *ctx,
+    void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode);
+
+/**
+ * @brief Registers an image buffer to read regions from with
+ * mocr_read_regions(). The buffer is not copied and must stay valid until the
+ * page is destroyed.
+ *
+ * @param ctx The context containing the model
+ * @param data The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of consecutive rows. 0
+ *               if the rows are tightly packed.
+ * @param mode The format of the image data
+ * @return A new page object, NULL on error. This must be freed with
+ * mocr_page_destroy().
+ */
+mocr_page *mocr_page_create(
+    mocr_ctx *ctx,
+    void *data,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode);
+
+/**
+ * @brief Destroys a page object. The image data is not freed.
+ *
+ * @param page The page object to destroy
+ * @return 0 on success, nonzero on error
+ */
+int mocr_page_destroy(mocr_page *page);
+
+/**
+ * @brief Extracts text from multiple regions of a page. The regions are read
+ * in place and run through the model as a single batch.
+ *
+ * @param page The page to read regions from
+ * @param rects The regions of the page to read. Regions must be within the
+ *              page and, for modes smaller than a byte, start on a byte
+ *              boundary.
+ * @param count The number of regions in rects
+ * @param[out] texts An array of count elements that receives the text of each
+ *                   region. Each element must be freed with mocr_free(). Every
+ *                   element is set to NULL on error.
+ * @return 0 on success, nonzero on error
+ */
+int mocr_read_regions(
+    mocr_page *page, const mocr_rect *rects, size_t count, char **texts);
+
+/**
+ * @brief Extracts text from multiple image buffers. The images are run through
+ * the model as a single batch, which is much faster than reading them one at a
+ * time.
+ *
+ * @param ctx The context containing the model
+ * @param images The images to read
+ * @param count The number of images
+ * @param[out] texts An array of count elements that receives the text of each
+ *                   image. Each element must be freed with mocr_free(). Every
+ *                   element is set to NULL on error.
+ * @return 0 on success, nonzero on error
+ */
+int mocr_read_batch(
+    mocr_ctx *ctx, const mocr_image *images, size_t count, char **texts);
+
 /**
  * @brief Extracts text from an image file
  *
@@ -114,6 +474,322 @@ char *mocr_read(
  */
 char *mocr_read_file(mocr_ctx *ctx, const char *path);
 
+/**
+ * @brief Extracts text from an encoded image in memory, such as the contents
+ * of a JPEG or PNG file. Any format PIL can open is supported.
+ *
+ * @param ctx The context containing the model
+ * @param bytes The encoded image
+ * @param size The size of bytes in bytes
+ * @return The text extracted from the image, NULL on error. This must be freed
+ * with mocr_free().
+ */
+char *mocr_read_encoded(mocr_ctx *ctx, const void *bytes, size_t size);
+
+/**
+ * @brief Starts extracting text from an image on one of the context's internal
+ * threads and returns right away. See mocr_read().
+ *
+ * @param ctx The context containing the model
+ * @param data The image data. It must stay valid until the callback is called.
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param mode The format of the image data
+ * @param callback Called with the text once it's read. NULL to queue the text
+ *                 for mocr_poll() instead. An image in the context's cache
+ *                 skips admission, see mocr_option_cache_bytes.
+ * @param userdata Passed to the callback
+ * @return A handle to the read, NULL if it couldn't be started, in which case
+ * the callback is never called. This must be freed with mocr_request_free().
+ */
+mocr_request *mocr_read_async(
+    mocr_ctx *ctx,
+    void *data,
+    size_t width,
+    size_t height,
+    mocr_mode mode,
+    mocr_callback callback,
+    void *userdata);
+
+/**
+ * @brief Starts extracting text from an image file on one of the context's
+ * internal threads and returns right away. See mocr_read_file().
+ *
+ * @param ctx The context containing the model
+ * @param path The path to the image file. It's copied.
+ * @param callback Called with the text once it's read. NULL to queue the text
+ *                 for mocr_poll() instead.
+ * @param userdata Passed to the callback
+ * @return A handle to the read, NULL if it couldn't be started, in which case
+ * the callback is never called. This must be freed with mocr_request_free().
+ */
+mocr_request *mocr_read_file_async(
+    mocr_ctx *ctx, const char *path, mocr_callback callback, void *userdata);
+
+/**
+ * @brief Sets the priority class of an asynchronous read. Call it right after
+ * starting the read. A read that's waiting for an async thread moves behind
+ * the other waiting reads of its new class. A read that has already started
+ * isn't affected.
+ *
+ * @param request The read
+ * @param priority The priority class
+ * @return 0 on success, nonzero on error
+ */
+int mocr_request_set_priority(mocr_request *request, mocr_priority priority);
+
+/**
+ * @brief Cancels an asynchronous read. A read that hasn't started is dropped
+ * without running. A running read is stopped after the token the model is
+ * generating, unless it's being read in a worker process or as part of a
+ * batch, in which case it runs to the end. Either way the callback is called
+ * with NULL text, or NULL text is queued for mocr_poll(). Reads that already
+ * finished aren't affected.
+ *
+ * @param request The read to cancel
+ * @return 0 on success, nonzero on error
+ */
+int mocr_request_cancel(mocr_request *request);
+
+/**
+ * @brief Cancels an asynchronous read if it hasn't finished within a timeout.
+ * See mocr_request_cancel().
+ *
+ * @param request The read
+ * @param timeout_us How long from now in microseconds the read has to finish.
+ *                   Replaces any earlier timeout.
+ * @return 0 on success, nonzero on error
+ */
+int mocr_request_set_timeout(mocr_request *request, uint64_t timeout_us);
+
+/**
+ * @brief Gets a file descriptor that's readable while asynchronous reads
+ * started without a callback have finished and not been taken off the
+ * context with mocr_poll(). It can be added to an event loop like epoll. It
+ * stays readable until the results are taken, so the loop wakes once for any
+ * number of them. Don't read from it or close it. It's an eventfd on Linux.
+ *
+ * @param ctx The context the reads were started on
+ * @return The file descriptor, -1 on error or on Windows, where mocr_poll()
+ * has to be called periodically instead
+ */
+int mocr_completion_fd(mocr_ctx *ctx);
+
+/**
+ * @brief Takes finished asynchronous reads that were started without a
+ * callback off a context, oldest first. Never blocks.
+ *
+ * @param ctx The context the reads were started on
+ * @param[out] results Receives the finished reads. Their text must be freed
+ *                     with mocr_free().
+ * @param max The size of results
+ * @return The number of results stored. 0 if no reads have finished.
+ */
+size_t mocr_poll(mocr_ctx *ctx, mocr_result *results, size_t max);
+
+/**
+ * @brief Blocks until the callback of an asynchronous read has returned, or
+ * until its text is ready for mocr_poll() if it has no callback. Must not be
+ * called from a callback on the same context.
+ *
+ * @param request The read to wait for
+ * @return 0 on success, nonzero on error
+ */
+int mocr_request_wait(mocr_request *request);
+
+/**
+ * @brief Frees the handle of an asynchronous read. The read still finishes and
+ * its callback is still called or its text queued if that hasn't happened.
+ *
+ * @param request The handle to free
+ * @return 0 on success, nonzero on error
+ */
+int mocr_request_free(mocr_request *request);
+
+/**
+ * @brief Creates a stream for latest-wins asynchronous reads. Starting a read
+ * on the stream cancels the read started on it before, as if by
+ * mocr_request_cancel(), so response time follows the newest input rather
+ * than the backlog.
+ *
+ * @param ctx The context the stream's reads are made with. It must outlive
+ *            the stream.
+ * @return A new stream, NULL on error. This must be freed with
+ * mocr_stream_destroy().
+ */
+mocr_stream *mocr_stream_create(mocr_ctx *ctx);
+
+/**
+ * @brief Destroys a stream. The newest read started on it isn't cancelled.
+ *
+ * @param stream The stream to destroy
+ * @return 0 on success, nonzero on error
+ */
+int mocr_stream_destroy(mocr_stream *stream);
+
+/**
+ * @brief Starts extracting text from an image on a stream, cancelling the
+ * stream's previous read. See mocr_read_async().
+ *
+ * @param stream The stream
+ * @param data The image data. It must stay valid until the callback is called.
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param mode The format of the image data
+ * @param callback Called with the text once it's read. NULL to queue the text
+ *                 for mocr_poll() instead.
+ * @param userdata Passed to the callback
+ * @return A handle to the read, NULL if it couldn't be started, in which case
+ * the previous read isn't cancelled. This must be freed with
+ * mocr_request_free().
+ */
+mocr_request *mocr_stream_read_async(
+    mocr_stream *stream,
+    void *data,
+    size_t width,
+    size_t height,
+    mocr_mode mode,
+    mocr_callback callback,
+    void *userdata);
+
+/**
+ * @brief Starts extracting text from an image file on a stream, cancelling the
+ * stream's previous read. See mocr_read_file_async().
+ *
+ * @param stream The stream
+ * @param path The path to the image file. It's copied.
+ * @param callback Called with the text once it's read. NULL to queue the text
+ *                 for mocr_poll() instead.
+ * @param userdata Passed to the callback
+ * @return A handle to the read, NULL if it couldn't be started, in which case
+ * the previous read isn't cancelled. This must be freed with
+ * mocr_request_free().
+ */
+mocr_request *mocr_stream_read_file_async(
+    mocr_stream *stream,
+    const char *path,
+    mocr_callback callback,
+    void *userdata);
+
+/**
+ * @brief Sets an option on a context. Options should be set before the context
+ * is shared between threads.
+ *
+ * @param ctx The context to set the option on
+ * @param option The option to set
+ * @param value The value of the option
+ * @return 0 on success, nonzero if the option couldn't be set
+ */
+int mocr_set_option(mocr_ctx *ctx, mocr_option option, int64_t value);
+
+/**
+ * @brief Gets the value of an option on a context
+ *
+ * @param ctx The context to get the option from
+ * @param option The option to get
+ * @param[out] value The value of the option
+ * @return 0 on success, nonzero if the option doesn't exist
+ */
+int mocr_get_option(mocr_ctx *ctx, mocr_option option, int64_t *value);
+
+/**
+ * @brief Gets the counters of a context's cache of texts. The counters keep
+ * counting while the cache is disabled and emptied.
+ *
+ * @param ctx The context
+ * @param[out] stats Receives the counters
+ * @return 0 on success, nonzero on error
+ */
+int mocr_get_cache_stats(mocr_ctx *ctx, mocr_cache_stats *stats);
+
+/**
+ * @brief Keeps the text mocr_read_file() and mocr_read_file_async() read in a
+ * file on disk, so image files that haven't changed since they were read are
+ * answered from it without the model, even after a restart. Files are matched
+ * by their absolute path, size, and modification time, the context's model,
+ * and optionally a hash of their contents. See mocr_option_file_cache_hash.
+ * The cache file is only ever appended to, and opening it maps it into memory
+ * and indexes it without reading the texts. Any number of contexts, in any
+ * number of processes, may share one cache file. Not available on Windows.
+ *
+ * @param ctx The context
+ * @param path The path of the cache file, created if it doesn't exist. NULL
+ *             to stop using a cache file.
+ * @return 0 on success, nonzero if the file can't be opened or isn't a cache
+ * file. The context keeps its previous cache file on error.
+ */
+int mocr_set_file_cache(mocr_ctx *ctx, const char *path);
+
+/**
+ * @brief Creates a pool of contexts that share one copy of a model. Threads
+ * check out an idle context with mocr_pool_acquire() and return it with
+ * mocr_pool_release(), so each context is only used by one thread at a time.
+ *
+ * @param model A HuggingFace repo, URL, or path to a local model
+ * @param force_cpu 0 to use CUDA is available, nonzero to force CPU usage
+ * @param size The number of contexts in the pool
+ * @return A new pool, NULL on error. This must be freed with
+ * mocr_pool_destroy().
+ */
+mocr_pool *mocr_pool_create(const char *model, int force_cpu, size_t size);
+
+/**
+ * @brief Destroys a pool and its contexts. Every context must be released
+ * first.
+ *
+ * @param pool The pool to destroy
+ * @return 0 on success, nonzero if a context is still checked out
+ */
+int mocr_pool_destroy(mocr_pool *pool);
+
+/**
+ * @brief Gets the number of contexts in a pool
+ *
+ * @param pool The pool
+ * @return The number of contexts in the pool
+ */
+size_t mocr_pool_size(mocr_pool *pool);
+
+/**
+ * @brief Gets a context of a pool by its index without checking it out. Used
+ * to set options on every context before the pool is shared between threads.
+ *
+ * @param pool The pool
+ * @param index The index of the context, less than mocr_pool_size()
+ * @return The context, NULL if index is out of range
+ */
+mocr_ctx *mocr_pool_context(mocr_pool *pool, size_t index);
+
+/**
+ * @brief Checks out an idle context from a pool
+ *
+ * @param pool The pool to check a context out from
+ * @param timeout_us How long in microseconds to wait for a context to become
+ *                   idle. 0 to return immediately, negative to wait forever.
+ * @return The context, NULL if none became idle before the timeout. This must
+ * be returned with mocr_pool_release().
+ */
+mocr_ctx *mocr_pool_acquire(mocr_pool *pool, int64_t timeout_us);
+
+/**
+ * @brief Returns a context checked out with mocr_pool_acquire() to its pool
+ *
+ * @param pool The pool the context was checked out from
+ * @param ctx The context to return
+ * @return 0 on success, nonzero if the context isn't checked out from the pool
+ */
+int mocr_pool_release(mocr_pool *pool, mocr_ctx *ctx);
+
+/**
+ * @brief Gets the usage statistics of a context in a pool
+ *
+ * @param pool The pool
+ * @param index The index of the context, less than mocr_pool_size()
+ * @param[out] stats Receives the statistics
+ * @return 0 on success, nonzero if index is out of range
+ */
+int mocr_pool_get_stats(mocr_pool *pool, size_t index, mocr_pool_stats *stats);
+
 /**
  * @brief Frees memory allocated by libmocr
  *
@@ -137,6 +813,10 @@ int mocr_free(void *ptr);
  */
 int mocr_finalize(void);
 
+#if defined(__GNUC__) && !defined(_WIN32)
+#pragma GCC visibility pop
+#endif
+
 #endif // LIBMOCR_H
 
 #ifdef __cplusplus
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "mocr_admit.h"
+
+/**
+ * @brief Checks whether a read fits within the limits of a gate
+ *
+ * @param admit The gate. The mutex must be held.
+ * @param bytes The image bytes the read holds
+ * @return Nonzero if the read fits
+ */
+static int fits(const mocr_admit *admit, uint64_t bytes)
+{
+    if (admit->count == 0)
+    {
+        return 1;
+    }
+    if (admit->max_count && admit->count >= admit->max_count)
+    {
+        return 0;
+    }
+    return admit->max_bytes == 0 ||
+        (admit->bytes <= admit->max_bytes &&
+         bytes <= admit->max_bytes - admit->bytes);
+}
+
+int mocr_admit_init(mocr_admit *admit)
+{
+    admit->count = 0;
+    admit->bytes = 0;
+    admit->max_count = 0;
+    admit->max_bytes = 0;
+
+    if (mocr_mutex_init(&admit->mutex))
+    {
+        return -1;
+    }
+    if (mocr_cond_init(&admit->room))
+    {
+        mocr_mutex_destroy(&admit->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+void mocr_admit_destroy(mocr_admit *admit)
+{
+    mocr_cond_destroy(&admit->room);
+    mocr_mutex_destroy(&admit->mutex);
+}
+
+void mocr_admit_set_limits(
+    mocr_admit *admit, size_t max_count, uint64_t max_bytes)
+{
+    mocr_mutex_lock(&admit->mutex);
+    admit->max_count = max_count;
+    admit->max_bytes = max_bytes;
+    mocr_cond_broadcast(&admit->room);
+    mocr_mutex_unlock(&admit->mutex);
+}
+
+int mocr_admit_try(mocr_admit *admit, uint64_t bytes)
+{
+    int ret = -1;
+
+    mocr_mutex_lock(&admit->mutex);
+    if (fits(admit, bytes))
+    {
+        ++admit->count;
+        admit->bytes += bytes;
+        ret = 0;
+    }
+    mocr_mutex_unlock(&admit->mutex);
+
+    return ret;
+}
+
+void mocr_admit_wait(mocr_admit *admit, uint64_t bytes)
+{
+    mocr_mutex_lock(&admit->mutex);
+    while (!fits(admit, bytes))
+    {
+        mocr_cond_wait(&admit->room, &admit->mutex);
+    }
+    ++admit->count;
+    admit->bytes += bytes;
+    mocr_mutex_unlock(&admit->mutex);
+}
+
+void mocr_admit_release(mocr_admit *admit, uint64_t bytes)
+{
+    mocr_mutex_lock(&admit->mutex);
+    --admit->count;
+    admit->bytes -= bytes;
+    mocr_cond_broadcast(&admit->room);
+    mocr_mutex_unlock(&admit->mutex);
+}
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef LIBMOCR_ADMIT_H
+#define LIBMOCR_ADMIT_H
+
+/* Limits the number of reads and the image bytes they hold that a context
+ * accepts at once, so overload turns into waiting or failed reads instead of
+ * unbounded memory. Not part of the public API. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mocr_thread.h"
+
+/* The reads admitted to a context and their limits */
+typedef struct mocr_admit
+{
+    /* Protects everything below */
+    mocr_mutex mutex;
+
+    /* Broadcast when a read is released or the limits change */
+    mocr_cond room;
+
+    /* The number of reads admitted */
+    size_t count;
+
+    /* The image bytes held by the reads admitted */
+    uint64_t bytes;
+
+    /* The most reads admitted at once, 0 for no limit */
+    size_t max_count;
+
+    /* The most image bytes admitted at once, 0 for no limit */
+    uint64_t max_bytes;
+}
+mocr_admit;
+
+/**
+ * @brief Initializes an admission gate without limits
+ *
+ * @param admit The gate to initialize
+ * @return 0 on success, nonzero on error
+ */
+int mocr_admit_init(mocr_admit *admit);
+
+/**
+ * @brief Frees the resources of a gate nothing is waiting on
+ *
+ * @param admit The gate to destroy
+ */
+void mocr_admit_destroy(mocr_admit *admit);
+
+/**
+ * @brief Changes the limits of a gate. Reads already admitted stay admitted.
+ *
+ * @param admit The gate
+ * @param max_count The most reads admitted at once, 0 for no limit
+ * @param max_bytes The most image bytes admitted at once, 0 for no limit
+ */
+void mocr_admit_set_limits(
+    mocr_admit *admit, size_t max_count, uint64_t max_bytes);
+
+/**
+ * @brief Admits a read if it fits within the limits. A read is always
+ * admitted when nothing else is, however large it is.
+ *
+ * @param admit The gate
+ * @param bytes The image bytes the read holds
+ * @return 0 if the read was admitted, nonzero if it doesn't fit
+ */
+int mocr_admit_try(mocr_admit *admit, uint64_t bytes);
+
+/**
+ * @brief Waits until a read fits within the limits and admits it
+ *
+ * @param admit The gate
+ * @param bytes The image bytes the read holds
+ */
+void mocr_admit_wait(mocr_admit *admit, uint64_t bytes);
+
+/**
+ * @brief Releases a read admitted by mocr_admit_try() or mocr_admit_wait()
+ *
+ * @param admit The gate
+ * @param bytes The image bytes the read was admitted with
+ */
+void mocr_admit_release(mocr_admit *admit, uint64_t bytes);
+
+#endif // LIBMOCR_ADMIT_H
@@ -0,0 +1,341 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "mocr_async.h"
+
+#include <stdlib.h>
+
+/* While jobs of both classes are queued, one job in this many is low
+ * priority */
+#define LOW_PRIORITY_SHARE 8
+
+/**
+ * @brief Adds a job to its class in the queue and wakes a thread
+ *
+ * @param async The queue. The mutex must be held.
+ * @param job The job
+ * @param front Nonzero to add the job before the others of its class
+ */
+static void enqueue(mocr_async *async, mocr_async_job *job, int front)
+{
+    int priority = job->priority;
+    if (front)
+    {
+        job->prev = NULL;
+        job->next = async->head[priority];
+        if (job->next)
+        {
+            job->next->prev = job;
+        }
+        else
+        {
+            async->tail[priority] = job;
+        }
+        async->head[priority] = job;
+    }
+    else
+    {
+        job->next = NULL;
+        job->prev = async->tail[priority];
+        if (job->prev)
+        {
+            job->prev->next = job;
+        }
+        else
+        {
+            async->head[priority] = job;
+        }
+        async->tail[priority] = job;
+    }
+    job->queued = 1;
+    mocr_cond_signal(&async->queued);
+}
+
+/**
+ * @brief Removes a queued job from its class
+ *
+ * @param async The queue. The mutex must be held.
+ * @param job The job
+ */
+static void unlink_job(mocr_async *async, mocr_async_job *job)
+{
+    int priority = job->priority;
+    if (job->prev)
+    {
+        job->prev->next = job->next;
+    }
+    else
+    {
+        async->head[priority] = job->next;
+    }
+    if (job->next)
+    {
+        job->next->prev = job->prev;
+    }
+    else
+    {
+        async->tail[priority] = job->prev;
+    }
+    job->next = NULL;
+    job->prev = NULL;
+    job->queued = 0;
+}
+
+/**
+ * @brief Takes the next job off the queue. High priority jobs come first, but
+ * a low priority job gets a turn every LOW_PRIORITY_SHARE jobs.
+ *
+ * @param async The queue. The mutex must be held.
+ * @return The job, NULL if nothing is queued
+ */
+static mocr_async_job *dequeue(mocr_async *async)
+{
+    mocr_async_job *job = NULL;
+
+    for (int priority = MOCR_ASYNC_PRIORITIES - 1; priority >= 0; --priority)
+    {
+        if (async->head[priority])
+        {
+            job = async->head[priority];
+            break;
+        }
+    }
+    if (job == NULL)
+    {
+        return NULL;
+    }
+
+    if (job->priority == 0 || async->head[0] == NULL)
+    {
+        async->streak = 0;
+    }
+    else if (++async->streak >= LOW_PRIORITY_SHARE)
+    {
+        async->streak = 0;
+        job = async->head[0];
+    }
+    unlink_job(async, job);
+    return job;
+}
+
+/**
+ * @brief Works on queued jobs until the queue is stopped
+ *
+ * @param arg The queue
+ */
+static void run(void *arg)
+{
+    mocr_async *async = arg;
+
+    mocr_mutex_lock(&async->mutex);
+    for (;;)
+    {
+        mocr_async_job *job = dequeue(async);
+        if (job == NULL)
+        {
+            if (async->exiting)
+            {
+                break;
+            }
+            mocr_cond_wait(&async->queued, &async->mutex);
+            continue;
+        }
+
+        mocr_mutex_unlock(&async->mutex);
+        int handed_off = async->func(async->arg, job);
+        mocr_mutex_lock(&async->mutex);
+
+        if (!handed_off && --async->unfinished == 0)
+        {
+            mocr_cond_broadcast(&async->idle);
+        }
+    }
+    mocr_mutex_unlock(&async->mutex);
+}
+
+int mocr_async_start(
+    mocr_async *async, size_t count, mocr_async_func func, void *arg)
+{
+    size_t started = 0;
+
+    for (int i = 0; i < MOCR_ASYNC_PRIORITIES; ++i)
+    {
+        async->head[i] = NULL;
+        async->tail[i] = NULL;
+    }
+    async->streak = 0;
+    async->unfinished = 0;
+    async->stopping = 0;
+    async->exiting = 0;
+    async->func = func;
+    async->arg = arg;
+    async->count = count;
+
+    async->threads = malloc(count * sizeof(mocr_thread));
+    if (async->threads == NULL)
+    {
+        return -1;
+    }
+    if (mocr_mutex_init(&async->mutex))
+    {
+        goto error_alloc;
+    }
+    if (mocr_cond_init(&async->queued))
+    {
+        goto error_mutex;
+    }
+    if (mocr_cond_init(&async->idle))
+    {
+        goto error_queued;
+    }
+    for (; started < count; ++started)
+    {
+        if (mocr_thread_create(&async->threads[started], run, async))
+        {
+            goto error_threads;
+        }
+    }
+    return 0;
+
+error_threads:
+    mocr_mutex_lock(&async->mutex);
+    async->exiting = 1;
+    mocr_cond_broadcast(&async->queued);
+    mocr_mutex_unlock(&async->mutex);
+    for (size_t i = 0; i < started; ++i)
+    {
+        mocr_thread_join(async->threads[i]);
+    }
+    mocr_cond_destroy(&async->idle);
+error_queued:
+    mocr_cond_destroy(&async->queued);
+error_mutex:
+    mocr_mutex_destroy(&async->mutex);
+error_alloc:
+    free(async->threads);
+
+    return -1;
+}
+
+void mocr_async_stop(mocr_async *async)
+{
+    /* Jobs that were handed off come back, so wait for them before the
+     * threads go away */
+    mocr_mutex_lock(&async->mutex);
+    async->stopping = 1;
+    while (async->unfinished)
+    {
+        mocr_cond_wait(&async->idle, &async->mutex);
+    }
+    async->exiting = 1;
+    mocr_cond_broadcast(&async->queued);
+    mocr_mutex_unlock(&async->mutex);
+
+    for (size_t i = 0; i < async->count; ++i)
+    {
+        mocr_thread_join(async->threads[i]);
+    }
+
+    mocr_cond_destroy(&async->idle);
+    mocr_cond_destroy(&async->queued);
+    mocr_mutex_destroy(&async->mutex);
+    free(async->threads);
+}
+
+int mocr_async_push(mocr_async *async, mocr_async_job *job)
+{
+    mocr_mutex_lock(&async->mutex);
+    if (async->stopping)
+    {
+        mocr_mutex_unlock(&async->mutex);
+        return -1;
+    }
+    ++async->unfinished;
+    job->requeued = 0;
+    enqueue(async, job, 0);
+    mocr_mutex_unlock(&async->mutex);
+    return 0;
+}
+
+int mocr_async_push_front(mocr_async *async, mocr_async_job *job)
+{
+    mocr_mutex_lock(&async->mutex);
+    if (async->stopping)
+    {
+        mocr_mutex_unlock(&async->mutex);
+        return -1;
+    }
+    ++async->unfinished;
+    job->requeued = 1;
+    enqueue(async, job, 1);
+    mocr_mutex_unlock(&async->mutex);
+    return 0;
+}
+
+void mocr_async_requeue(mocr_async *async, mocr_async_job *job)
+{
+    mocr_mutex_lock(&async->mutex);
+    job->requeued = 1;
+    enqueue(async, job, 1);
+    mocr_mutex_unlock(&async->mutex);
+}
+
+mocr_async_job *mocr_async_shed(mocr_async *async)
+{
+    mocr_async_job *job = NULL;
+
+    mocr_mutex_lock(&async->mutex);
+    for (int priority = 0; priority < MOCR_ASYNC_PRIORITIES; ++priority)
+    {
+        /* Requeued jobs are at the front */
+        for (job = async->head[priority]; job; job = job->next)
+        {
+            if (!job->requeued)
+            {
+                break;
+            }
+        }
+        if (job)
+        {
+            unlink_job(async, job);
+            break;
+        }
+    }
+    mocr_mutex_unlock(&async->mutex);
+
+    return job;
+}
+
+void mocr_async_set_priority(
+    mocr_async *async, mocr_async_job *job, int priority)
+{
+    mocr_mutex_lock(&async->mutex);
+    if (job->queued)
+    {
+        unlink_job(async, job);
+        job->priority = priority;
+        enqueue(async, job, 0);
+    }
+    else
+    {
+        job->priority = priority;
+    }
+    mocr_mutex_unlock(&async->mutex);
+}
@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIBMOCR_ASYNC_H
+#define LIBMOCR_ASYNC_H
+
+/* Runs asynchronous reads on a few internal threads. A job can be handed off
+ * somewhere else, such as the dispatcher, and put back once it's read, so it
+ * only occupies a thread while it's actually being worked on. Jobs are queued
+ * in priority classes, and high priority jobs are taken first without
+ * starving the rest. Not part of the public API. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mocr_thread.h"
+
+/* The number of priority classes. Jobs in class 1 are taken before jobs in
+ * class 0. */
+#define MOCR_ASYNC_PRIORITIES 2
+
+/* A queued job. Embedded in whatever the job is. */
+typedef struct mocr_async_job
+{
+    /* The job queued after this one in the same class */
+    struct mocr_async_job *next;
+
+    /* The job queued before this one in the same class */
+    struct mocr_async_job *prev;
+
+    /* The priority class of the job */
+    int priority;
+
+    /* Nonzero while the job is queued */
+    int queued;
+
+    /* Nonzero if the job was put back with mocr_async_requeue() or pushed
+     * with mocr_async_push_front() */
+    int requeued;
+}
+mocr_async_job;
+
+/**
+ * @brief Works on a job taken off the queue on one of the threads
+ *
+ * @param arg The argument given to mocr_async_start()
+ * @param job The job
+ * @return 0 if the job is finished, nonzero if it was handed off and will be
+ * put back with mocr_async_requeue()
+ */
+typedef int (*mocr_async_func)(void *arg, mocr_async_job *job);
+
+/* A queue of jobs and the threads that work on them */
+typedef struct mocr_async
+{
+    /* Protects everything below */
+    mocr_mutex mutex;
+
+    /* Signaled when a job is queued or the threads are stopped */
+    mocr_cond queued;
+
+    /* Broadcast when the last unfinished job finishes */
+    mocr_cond idle;
+
+    /* The oldest queued job of each priority class */
+    mocr_async_job *head[MOCR_ASYNC_PRIORITIES];
+
+    /* The newest queued job of each priority class */
+    mocr_async_job *tail[MOCR_ASYNC_PRIORITIES];
+
+    /* The number of high priority jobs taken in a row while low priority
+     * jobs were queued */
+    size_t streak;
+
+    /* The number of jobs pushed that haven't finished, queued or not */
+    size_t unfinished;
+
+    /* Nonzero once no more jobs are accepted */
+    int stopping;
+
+    /* Nonzero once every job has finished and the threads should exit */
+    int exiting;
+
+    /* Works on each job */
+    mocr_async_func func;
+
+    /* The argument passed to func */
+    void *arg;
+
+    /* The threads */
+    mocr_thread *threads;
+
+    /* The number of threads */
+    size_t count;
+}
+mocr_async;
+
+/**
+ * @brief Starts the threads of a queue
+ *
+ * @param async The queue to start
+ * @param count The number of threads
+ * @param func Works on each job
+ * @param arg The argument passed to func
+ * @return 0 on success, nonzero on error
+ */
+int mocr_async_start(
+    mocr_async *async, size_t count, mocr_async_func func, void *arg);
+
+/**
+ * @brief Waits for every job pushed to finish, then stops the threads and
+ * frees the queue's resources. Must not be called from one of the threads.
+ *
+ * @param async The queue to stop
+ */
+void mocr_async_stop(mocr_async *async);
+
+/**
+ * @brief Queues a new job behind the other jobs of its priority class
+ *
+ * @param async The running queue
+ * @param job The job with its priority set. It must stay valid until it
+ *            finishes.
+ * @return 0 on success, nonzero if the queue is stopping
+ */
+int mocr_async_push(mocr_async *async, mocr_async_job *job);
+
+/**
+ * @brief Queues a new job that's nearly done ahead of the other jobs of its
+ * priority class. Like a requeued job, mocr_async_shed() never takes it.
+ *
+ * @param async The running queue
+ * @param job The job with its priority set. It must stay valid until it
+ *            finishes.
+ * @return 0 on success, nonzero if the queue is stopping
+ */
+int mocr_async_push_front(mocr_async *async, mocr_async_job *job);
+
+/**
+ * @brief Queues a job that was handed off again so a thread finishes it. It
+ * goes ahead of the other jobs of its class, since it's nearly done. Safe to
+ * call while the queue is stopping.
+ *
+ * @param async The queue the job was pushed to
+ * @param job The job
+ */
+void mocr_async_requeue(mocr_async *async, mocr_async_job *job);
+
+/**
+ * @brief Takes the oldest job that hasn't been worked on yet off the queue,
+ * from the lowest priority class that has one. It still counts as unfinished
+ * and must be put back with mocr_async_requeue().
+ *
+ * @param async The running queue
+ * @return The job, NULL if every queued job has been worked on
+ */
+mocr_async_job *mocr_async_shed(mocr_async *async);
+
+/**
+ * @brief Changes the priority class of a job. A queued job moves behind the
+ * other jobs of its new class.
+ *
+ * @param async The queue the job was pushed to
+ * @param job The job
+ * @param priority The new priority class
+ */
+void mocr_async_set_priority(
+    mocr_async *async, mocr_async_job *job, int priority);
+
+#endif // LIBMOCR_ASYNC_H
@@ -0,0 +1,552 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "mocr_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The primes of XXH64 */
+#define PRIME1  0x9E3779B185EBCA87ull
+#define PRIME2  0xC2B2AE3D27D4EB4Full
+#define PRIME3  0x165667B19E3779F9ull
+#define PRIME4  0x85EBCA77C2B2AE63ull
+#define PRIME5  0x27D4EB2F165667C5ull
+
+/* The number of bytes hashed at a time by the four lanes */
+#define STRIPE_BYTES 32
+
+/* The seed of the second hash in a cache key */
+#define CHECK_SEED 0x6D6F63725F636B31ull
+
+/* Rows are hashed in pieces this large, so the second hash of a piece reads it
+ * from the cache the first left it in */
+#define PIECE_BYTES 16384
+
+/* The number of buckets a shard starts with */
+#define MIN_BUCKETS 64
+
+struct mocr_cache_entry
+{
+    /* The next entry in the same bucket */
+    mocr_cache_entry *next;
+
+    /* The next more and less recently used entries */
+    mocr_cache_entry *newer;
+    mocr_cache_entry *older;
+
+    /* The image the text was read from */
+    mocr_cache_key key;
+
+    /* The bytes the entry holds, counted against the budget */
+    size_t bytes;
+
+    /* The text, NUL terminated */
+    char text[];
+};
+
+/* The state of an XXH64 hash of data given in pieces */
+typedef struct hash_state
+{
+    /* The four lanes, which have no dependencies between them so they're
+     * computed in parallel */
+    uint64_t lanes[4];
+
+    /* The bytes given that don't fill a stripe yet */
+    unsigned char buffer[STRIPE_BYTES];
+
+    /* The number of bytes in buffer */
+    size_t buffered;
+
+    /* The number of bytes given */
+    uint64_t total;
+
+    /* The seed the hash started from */
+    uint64_t seed;
+}
+hash_state;
+
+static uint64_t rotl64(uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t hash_merge(uint64_t acc, uint64_t lane)
+{
+    acc ^= hash_round(0, lane);
+    return acc * PRIME1 + PRIME4;
+}
+
+static void hash_stripe(hash_state *state, const unsigned char *p)
+{
+    state->lanes[0] = hash_round(state->lanes[0], read64(p));
+    state->lanes[1] = hash_round(state->lanes[1], read64(p + 8));
+    state->lanes[2] = hash_round(state->lanes[2], read64(p + 16));
+    state->lanes[3] = hash_round(state->lanes[3], read64(p + 24));
+}
+
+static void hash_init(hash_state *state, uint64_t seed)
+{
+    state->lanes[0] = seed + PRIME1 + PRIME2;
+    state->lanes[1] = seed + PRIME2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - PRIME1;
+    state->buffered = 0;
+    state->total = 0;
+    state->seed = seed;
+}
+
+static void hash_update(hash_state *state, const unsigned char *p, size_t size)
+{
+    state->total += size;
+
+    if (state->buffered)
+    {
+        size_t fill = STRIPE_BYTES - state->buffered;
+        if (size < fill)
+        {
+            memcpy(state->buffer + state->buffered, p, size);
+            state->buffered += size;
+            return;
+        }
+        memcpy(state->buffer + state->buffered, p, fill);
+        hash_stripe(state, state->buffer);
+        state->buffered = 0;
+        p += fill;
+        size -= fill;
+    }
+
+    while (size >= STRIPE_BYTES)
+    {
+        hash_stripe(state, p);
+        p += STRIPE_BYTES;
+        size -= STRIPE_BYTES;
+    }
+
+    memcpy(state->buffer, p, size);
+    state->buffered = size;
+}
+
+static uint64_t hash_digest(const hash_state *state)
+{
+    uint64_t h;
+    if (state->total >= STRIPE_BYTES)
+    {
+        h = rotl64(state->lanes[0], 1) + rotl64(state->lanes[1], 7) +
+            rotl64(state->lanes[2], 12) + rotl64(state->lanes[3], 18);
+        for (int i = 0; i < 4; ++i)
+        {
+            h = hash_merge(h, state->lanes[i]);
+        }
+    }
+    else
+    {
+        h = state->seed + PRIME5;
+    }
+    h += state->total;
+
+    const unsigned char *p = state->buffer;
+    size_t size = state->buffered;
+    for (; size >= 8; p += 8, size -= 8)
+    {
+        h ^= hash_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME1 + PRIME4;
+    }
+    if (size >= 4)
+    {
+        h ^= read32(p) * PRIME1;
+        h = rotl64(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+        size -= 4;
+    }
+    for (; size; ++p, --size)
+    {
+        h ^= *p * PRIME5;
+        h = rotl64(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * @brief Feeds the pixels of an image to several hashes in one pass
+ *
+ * @param states The hashes
+ * @param count The number of hashes
+ * @param data The image data
+ * @param row_bytes The number of bytes of pixels in a row
+ * @param height The number of rows
+ * @param stride The number of bytes between the start of each row
+ */
+static void hash_rows(
+    hash_state *states,
+    size_t count,
+    const void *data,
+    size_t row_bytes,
+    size_t height,
+    size_t stride)
+{
+    const unsigned char *row = data;
+
+    /* Tightly packed rows are hashed in one go */
+    if (stride == row_bytes)
+    {
+        row_bytes *= height;
+        height = 1;
+    }
+    for (size_t y = 0; y < height; ++y, row += stride)
+    {
+        for (size_t offset = 0; offset < row_bytes; offset += PIECE_BYTES)
+        {
+            size_t size = row_bytes - offset < PIECE_BYTES ?
+                row_bytes - offset : PIECE_BYTES;
+            for (size_t i = 0; i < count; ++i)
+            {
+                hash_update(&states[i], row + offset, size);
+            }
+        }
+    }
+}
+
+uint64_t mocr_cache_hash(
+    const void *data, size_t row_bytes, size_t height, size_t stride)
+{
+    hash_state state;
+    hash_init(&state, 0);
+    hash_rows(&state, 1, data, row_bytes, height, stride);
+    return hash_digest(&state);
+}
+
+void mocr_cache_key_hash(
+    const void *data,
+    size_t row_bytes,
+    size_t height,
+    size_t stride,
+    mocr_cache_key *key)
+{
+    hash_state states[2];
+    hash_init(&states[0], 0);
+    hash_init(&states[1], CHECK_SEED);
+    hash_rows(states, 2, data, row_bytes, height, stride);
+    key->hash = hash_digest(&states[0]);
+    key->check = hash_digest(&states[1]);
+}
+
+/**
+ * @brief Picks the shard an image's text belongs to
+ *
+ * @param cache The cache
+ * @param key The image
+ * @return The shard
+ */
+static mocr_cache_shard *shard_of(mocr_cache *cache, const mocr_cache_key *key)
+{
+    /* The low bits pick the bucket, so use the high ones */
+    return &cache->shards[(key->hash >> 60) % MOCR_CACHE_SHARDS];
+}
+
+static int key_equal(const mocr_cache_key *a, const mocr_cache_key *b)
+{
+    return a->hash == b->hash && a->check == b->check &&
+        a->width == b->width &&
+        a->height == b->height && a->mode == b->mode;
+}
+
+/**
+ * @brief Finds the link in a shard's table that points to an image's entry
+ *
+ * @param shard The shard. The mutex must be held and buckets must be set.
+ * @param key The image
+ * @return The link, which points to NULL if the image isn't in the shard
+ */
+static mocr_cache_entry **find_link(
+    mocr_cache_shard *shard, const mocr_cache_key *key)
+{
+    mocr_cache_entry **link =
+        &shard->buckets[key->hash & (shard->bucket_count - 1)];
+    while (*link && !key_equal(&(*link)->key, key))
+    {
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static void unlink_recency(mocr_cache_shard *shard, mocr_cache_entry *entry)
+{
+    if (entry->newer)
+    {
+        entry->newer->older = entry->older;
+    }
+    else
+    {
+        shard->newest = entry->older;
+    }
+    if (entry->older)
+    {
+        entry->older->newer = entry->newer;
+    }
+    else
+    {
+        shard->oldest = entry->newer;
+    }
+}
+
+static void push_newest(mocr_cache_shard *shard, mocr_cache_entry *entry)
+{
+    entry->newer = NULL;
+    entry->older = shard->newest;
+    if (shard->newest)
+    {
+        shard->newest->newer = entry;
+    }
+    else
+    {
+        shard->oldest = entry;
+    }
+    shard->newest = entry;
+}
+
+/**
+ * @brief Drops the least recently used entries of a shard until it holds at
+ * most a number of bytes
+ *
+ * @param shard The shard. The mutex must be held.
+ * @param max_bytes The most bytes the shard may hold
+ */
+static void evict(mocr_cache_shard *shard, uint64_t max_bytes)
+{
+    while (shard->oldest && shard->bytes > max_bytes)
+    {
+        mocr_cache_entry *entry = shard->oldest;
+        *find_link(shard, &entry->key) = entry->next;
+        unlink_recency(shard, entry);
+        --shard->count;
+        shard->bytes -= entry->bytes;
+        free(entry);
+    }
+}
+
+/**
+ * @brief Doubles the buckets of a shard, or allocates the first ones
+ *
+ * @param shard The shard. The mutex must be held.
+ * @return 0 on success, nonzero on error
+ */
+static int grow(mocr_cache_shard *shard)
+{
+    size_t count = shard->bucket_count ? shard->bucket_count * 2 : MIN_BUCKETS;
+    mocr_cache_entry **buckets = calloc(count, sizeof(mocr_cache_entry *));
+    if (buckets == NULL)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < shard->bucket_count; ++i)
+    {
+        mocr_cache_entry *entry = shard->buckets[i];
+        while (entry)
+        {
+            mocr_cache_entry *next = entry->next;
+            size_t bucket = entry->key.hash & (count - 1);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->bucket_count = count;
+    return 0;
+}
+
+int mocr_cache_init(mocr_cache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    for (size_t i = 0; i < MOCR_CACHE_SHARDS; ++i)
+    {
+        if (mocr_mutex_init(&cache->shards[i].mutex))
+        {
+            while (i--)
+            {
+                mocr_mutex_destroy(&cache->shards[i].mutex);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void mocr_cache_destroy(mocr_cache *cache)
+{
+    for (size_t i = 0; i < MOCR_CACHE_SHARDS; ++i)
+    {
+        mocr_cache_shard *shard = &cache->shards[i];
+        evict(shard, 0);
+        free(shard->buckets);
+        mocr_mutex_destroy(&shard->mutex);
+    }
+}
+
+void mocr_cache_set_budget(mocr_cache *cache, uint64_t max_bytes)
+{
+    uint64_t shard_bytes = max_bytes / MOCR_CACHE_SHARDS;
+    if (max_bytes && shard_bytes == 0)
+    {
+        shard_bytes = 1;
+    }
+    mocr_atomic_store(&cache->shard_bytes, shard_bytes);
+
+    for (size_t i = 0; i < MOCR_CACHE_SHARDS; ++i)
+    {
+        mocr_cache_shard *shard = &cache->shards[i];
+        mocr_mutex_lock(&shard->mutex);
+        evict(shard, shard_bytes);
+        mocr_mutex_unlock(&shard->mutex);
+    }
+}
+
+int mocr_cache_enabled(mocr_cache *cache)
+{
+    return mocr_atomic_load(&cache->shard_bytes) != 0;
+}
+
+char *mocr_cache_get(mocr_cache *cache, const mocr_cache_key *key)
+{
+    mocr_cache_shard *shard = shard_of(cache, key);
+    char *text = NULL;
+    int found = 0;
+
+    mocr_mutex_lock(&shard->mutex);
+    mocr_cache_entry *entry = shard->buckets ? *find_link(shard, key) : NULL;
+    if (entry)
+    {
+        found = 1;
+        unlink_recency(shard, entry);
+        push_newest(shard, entry);
+        text = strdup(entry->text);
+    }
+    mocr_mutex_unlock(&shard->mutex);
+
+    mocr_atomic_add(found ? &cache->hits : &cache->misses, 1);
+    return text;
+}
+
+void mocr_cache_put(
+    mocr_cache *cache, const mocr_cache_key *key, const char *text)
+{
+    mocr_cache_shard *shard = shard_of(cache, key);
+    size_t length = strlen(text) + 1;
+    size_t bytes = sizeof(mocr_cache_entry) + length;
+
+    if (bytes > mocr_atomic_load(&cache->shard_bytes))
+    {
+        return;
+    }
+
+    mocr_cache_entry *entry = malloc(bytes);
+    if (entry == NULL)
+    {
+        return;
+    }
+    entry->key = *key;
+    entry->bytes = bytes;
+    entry->next = NULL;
+    memcpy(entry->text, text, length);
+
+    mocr_mutex_lock(&shard->mutex);
+
+    /* The budget is read again under the lock so a text can't outlive
+     * mocr_cache_set_budget() disabling the cache */
+    uint64_t max_bytes = mocr_atomic_load(&cache->shard_bytes);
+    if (bytes > max_bytes ||
+        (shard->count >= shard->bucket_count && grow(shard) &&
+         shard->buckets == NULL))
+    {
+        mocr_mutex_unlock(&shard->mutex);
+        free(entry);
+        return;
+    }
+
+    /* Two reads of the same image can race to add it */
+    mocr_cache_entry **link = find_link(shard, key);
+    if (*link)
+    {
+        mocr_mutex_unlock(&shard->mutex);
+        free(entry);
+        return;
+    }
+    *link = entry;
+    push_newest(shard, entry);
+    ++shard->count;
+    shard->bytes += bytes;
+    evict(shard, max_bytes);
+    mocr_mutex_unlock(&shard->mutex);
+}
+
+void mocr_cache_get_stats(
+    mocr_cache *cache,
+    uint64_t *hits,
+    uint64_t *misses,
+    uint64_t *entries,
+    uint64_t *bytes)
+{
+    *hits = mocr_atomic_load(&cache->hits);
+    *misses = mocr_atomic_load(&cache->misses);
+    *entries = 0;
+    *bytes = 0;
+
+    for (size_t i = 0; i < MOCR_CACHE_SHARDS; ++i)
+    {
+        mocr_cache_shard *shard = &cache->shards[i];
+        mocr_mutex_lock(&shard->mutex);
+        *entries += shard->count;
+        *bytes += shard->bytes;
+        mocr_mutex_unlock(&shard->mutex);
+    }
+}
@@ -0,0 +1,202 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef LIBMOCR_CACHE_H
+#define LIBMOCR_CACHE_H
+
+/* Remembers the text read from recent images, keyed by a hash of their pixels,
+ * so an image that comes back is answered without the model. Not part of the
+ * public API. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mocr_thread.h"
+
+/* The number of independently locked parts of a cache */
+#define MOCR_CACHE_SHARDS 16
+
+/* Identifies the image a text was read from */
+typedef struct mocr_cache_key
+{
+    /* The hash of the image's pixels from mocr_cache_key_hash() */
+    uint64_t hash;
+
+    /* A second, differently seeded hash of the pixels. Two images are only
+     * mistaken for each other if both hashes collide. */
+    uint64_t check;
+
+    /* The width of the image in pixels */
+    size_t width;
+
+    /* The height of the image in pixels */
+    size_t height;
+
+    /* The format of the image data */
+    int mode;
+}
+mocr_cache_key;
+
+/* A text in a cache */
+typedef struct mocr_cache_entry mocr_cache_entry;
+
+/* A part of a cache with its own lock, table, and recency list */
+typedef struct mocr_cache_shard
+{
+    /* Protects everything below */
+    mocr_mutex mutex;
+
+    /* Chains of entries by hash, NULL until the first entry is added */
+    mocr_cache_entry **buckets;
+
+    /* The number of buckets, a power of 2 */
+    size_t bucket_count;
+
+    /* The number of entries */
+    size_t count;
+
+    /* The bytes held by the entries */
+    uint64_t bytes;
+
+    /* The most and least recently used entries */
+    mocr_cache_entry *newest;
+    mocr_cache_entry *oldest;
+}
+mocr_cache_shard;
+
+/* A least recently used cache of texts with a byte budget */
+typedef struct mocr_cache
+{
+    /* The entries, spread across shards by hash so concurrent lookups rarely
+     * wait on each other */
+    mocr_cache_shard shards[MOCR_CACHE_SHARDS];
+
+    /* The most bytes each shard holds, 0 if the cache is disabled */
+    volatile uint64_t shard_bytes;
+
+    /* The number of lookups that found a text */
+    volatile uint64_t hits;
+
+    /* The number of lookups that didn't */
+    volatile uint64_t misses;
+}
+mocr_cache;
+
+/**
+ * @brief Hashes the pixels of an image. Padding between rows isn't hashed.
+ *
+ * @param data The image data
+ * @param row_bytes The number of bytes of pixels in a row
+ * @param height The number of rows
+ * @param stride The number of bytes between the start of each row
+ * @return The hash
+ */
+uint64_t mocr_cache_hash(
+    const void *data, size_t row_bytes, size_t height, size_t stride);
+
+/**
+ * @brief Hashes the pixels of an image into both hashes of its key. Padding
+ * between rows isn't hashed.
+ *
+ * @param data The image data
+ * @param row_bytes The number of bytes of pixels in a row
+ * @param height The number of rows
+ * @param stride The number of bytes between the start of each row
+ * @param[out] key Receives the hashes. The other fields are left alone.
+ */
+void mocr_cache_key_hash(
+    const void *data,
+    size_t row_bytes,
+    size_t height,
+    size_t stride,
+    mocr_cache_key *key);
+
+/**
+ * @brief Initializes a disabled cache
+ *
+ * @param cache The cache to initialize
+ * @return 0 on success, nonzero on error
+ */
+int mocr_cache_init(mocr_cache *cache);
+
+/**
+ * @brief Frees a cache and every text in it
+ *
+ * @param cache The cache to destroy
+ */
+void mocr_cache_destroy(mocr_cache *cache);
+
+/**
+ * @brief Changes the byte budget of a cache, dropping the least recently used
+ * texts that no longer fit
+ *
+ * @param cache The cache
+ * @param max_bytes The most bytes the cache holds, 0 to disable it and drop
+ *                  every text
+ */
+void mocr_cache_set_budget(mocr_cache *cache, uint64_t max_bytes);
+
+/**
+ * @brief Checks whether a cache is enabled
+ *
+ * @param cache The cache
+ * @return Nonzero if texts are looked up and added
+ */
+int mocr_cache_enabled(mocr_cache *cache);
+
+/**
+ * @brief Looks up the text read from an image and marks it recently used
+ *
+ * @param cache The cache
+ * @param key The image
+ * @return A copy of the text, NULL if it isn't cached. Must be freed with
+ * free().
+ */
+char *mocr_cache_get(mocr_cache *cache, const mocr_cache_key *key);
+
+/**
+ * @brief Adds the text read from an image, dropping the least recently used
+ * texts to make room. Texts larger than a shard's budget aren't added.
+ *
+ * @param cache The cache
+ * @param key The image
+ * @param text The text, copied into the cache
+ */
+void mocr_cache_put(
+    mocr_cache *cache, const mocr_cache_key *key, const char *text);
+
+/**
+ * @brief Gets the counters of a cache
+ *
+ * @param cache The cache
+ * @param[out] hits Receives the number of lookups that found a text
+ * @param[out] misses Receives the number of lookups that didn't
+ * @param[out] entries Receives the number of texts held
+ * @param[out] bytes Receives the bytes the texts hold
+ */
+void mocr_cache_get_stats(
+    mocr_cache *cache,
+    uint64_t *hits,
+    uint64_t *misses,
+    uint64_t *entries,
+    uint64_t *bytes);
+
+#endif // LIBMOCR_CACHE_H
@@ -0,0 +1,256 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+/* fcntl() and pipe() are POSIX, not C99 */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "mocr_cq.h"
+
+#include <stdint.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32)
+
+#if !defined(__linux__)
+/**
+ * @brief Makes a descriptor nonblocking and closes it across exec()
+ *
+ * @param fd The descriptor
+ * @return 0 on success, nonzero on error
+ */
+static int set_fd_flags(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        return -1;
+    }
+    flags = fcntl(fd, F_GETFD);
+    if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1)
+    {
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief Creates the descriptor of a queue
+ *
+ * @param cq The queue. The mutex must be held.
+ * @return 0 on success, nonzero on error
+ */
+static int open_fds(mocr_cq *cq)
+{
+#if defined(__linux__)
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    cq->read_fd = fd;
+    cq->write_fd = fd;
+#else
+    int fds[2];
+    if (pipe(fds))
+    {
+        return -1;
+    }
+    if (set_fd_flags(fds[0]) || set_fd_flags(fds[1]))
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    cq->read_fd = fds[0];
+    cq->write_fd = fds[1];
+#endif
+    return 0;
+}
+
+/**
+ * @brief Makes the descriptor of a queue readable
+ *
+ * @param cq The queue. The mutex must be held.
+ */
+static void signal_fd(mocr_cq *cq)
+{
+    if (cq->write_fd == -1 || cq->signaled)
+    {
+        return;
+    }
+#if defined(__linux__)
+    uint64_t value = 1;
+#else
+    uint8_t value = 1;
+#endif
+    ssize_t ret;
+    do
+    {
+        ret = write(cq->write_fd, &value, sizeof(value));
+    }
+    while (ret == -1 && errno == EINTR);
+    cq->signaled = 1;
+}
+
+/**
+ * @brief Makes the descriptor of a queue unreadable again
+ *
+ * @param cq The queue. The mutex must be held.
+ */
+static void clear_fd(mocr_cq *cq)
+{
+    if (cq->read_fd == -1 || !cq->signaled)
+    {
+        return;
+    }
+    /* Only one byte or count is ever outstanding */
+    uint64_t value;
+    ssize_t ret;
+    do
+    {
+        ret = read(cq->read_fd, &value, sizeof(value));
+    }
+    while (ret == -1 && errno == EINTR);
+    cq->signaled = 0;
+}
+
+#else
+
+/* Windows has nothing an event loop could select() on, so callers poll */
+
+static int open_fds(mocr_cq *cq)
+{
+    (void)cq;
+    return -1;
+}
+
+static void signal_fd(mocr_cq *cq)
+{
+    (void)cq;
+}
+
+static void clear_fd(mocr_cq *cq)
+{
+    (void)cq;
+}
+
+#endif
+
+int mocr_cq_init(mocr_cq *cq)
+{
+    cq->head = NULL;
+    cq->tail = NULL;
+    cq->read_fd = -1;
+    cq->write_fd = -1;
+    cq->signaled = 0;
+    return mocr_mutex_init(&cq->mutex);
+}
+
+void mocr_cq_destroy(mocr_cq *cq)
+{
+#if !defined(_WIN32)
+    if (cq->read_fd != -1)
+    {
+        close(cq->read_fd);
+    }
+    if (cq->write_fd != -1 && cq->write_fd != cq->read_fd)
+    {
+        close(cq->write_fd);
+    }
+#endif
+    mocr_mutex_destroy(&cq->mutex);
+}
+
+int mocr_cq_fd(mocr_cq *cq)
+{
+    int fd = -1;
+
+    mocr_mutex_lock(&cq->mutex);
+    if (cq->read_fd == -1 && open_fds(cq) == 0 && cq->head)
+    {
+        /* Completions queued before the descriptor existed */
+        signal_fd(cq);
+    }
+    fd = cq->read_fd;
+    mocr_mutex_unlock(&cq->mutex);
+
+    return fd;
+}
+
+void mocr_cq_push(mocr_cq *cq, mocr_cq_entry *entry)
+{
+    entry->next = NULL;
+
+    mocr_mutex_lock(&cq->mutex);
+    if (cq->tail)
+    {
+        cq->tail->next = entry;
+    }
+    else
+    {
+        cq->head = entry;
+        signal_fd(cq);
+    }
+    cq->tail = entry;
+    mocr_mutex_unlock(&cq->mutex);
+}
+
+mocr_cq_entry *mocr_cq_pop(mocr_cq *cq, size_t max)
+{
+    mocr_cq_entry *first = NULL;
+
+    if (max == 0)
+    {
+        return NULL;
+    }
+
+    mocr_mutex_lock(&cq->mutex);
+    first = cq->head;
+    if (first)
+    {
+        mocr_cq_entry *last = first;
+        for (size_t i = 1; i < max && last->next; ++i)
+        {
+            last = last->next;
+        }
+        cq->head = last->next;
+        last->next = NULL;
+        if (cq->head == NULL)
+        {
+            cq->tail = NULL;
+            clear_fd(cq);
+        }
+    }
+    mocr_mutex_unlock(&cq->mutex);
+
+    return first;
+}
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef LIBMOCR_CQ_H
+#define LIBMOCR_CQ_H
+
+/* A queue of finished asynchronous reads for callers that run their own event
+ * loop. A file descriptor becomes readable while anything is queued, so the
+ * loop wakes once for a whole run of completions rather than once per read.
+ * Not part of the public API. */
+
+#include <stddef.h>
+
+#include "mocr_thread.h"
+
+/* A queued completion. Embedded in whatever finished. */
+typedef struct mocr_cq_entry
+{
+    /* The completion queued after this one */
+    struct mocr_cq_entry *next;
+}
+mocr_cq_entry;
+
+/* A queue of completions and the descriptor that signals them */
+typedef struct mocr_cq
+{
+    /* Protects everything below */
+    mocr_mutex mutex;
+
+    /* The oldest queued completion */
+    mocr_cq_entry *head;
+
+    /* The newest queued completion */
+    mocr_cq_entry *tail;
+
+    /* The descriptor that's readable while anything is queued, -1 until
+     * mocr_cq_fd() is called. The same eventfd as write_fd on Linux, the read
+     * end of a pipe elsewhere. */
+    int read_fd;
+
+    /* The descriptor written to signal read_fd, -1 until mocr_cq_fd() */
+    int write_fd;
+
+    /* Nonzero while read_fd is readable */
+    int signaled;
+}
+mocr_cq;
+
+/**
+ * @brief Initializes an empty queue. Its descriptor isn't created until it's
+ * asked for.
+ *
+ * @param cq The queue to initialize
+ * @return 0 on success, nonzero on error
+ */
+int mocr_cq_init(mocr_cq *cq);
+
+/**
+ * @brief Closes the descriptor of an empty queue and frees its resources
+ *
+ * @param cq The queue to destroy
+ */
+void mocr_cq_destroy(mocr_cq *cq);
+
+/**
+ * @brief Gets the descriptor that's readable while anything is queued,
+ * creating it the first time
+ *
+ * @param cq The queue
+ * @return The descriptor, -1 on error or if the platform has none
+ */
+int mocr_cq_fd(mocr_cq *cq);
+
+/**
+ * @brief Queues a completion and signals the descriptor if the queue was empty
+ *
+ * @param cq The queue
+ * @param entry The completion
+ */
+void mocr_cq_push(mocr_cq *cq, mocr_cq_entry *entry);
+
+/**
+ * @brief Takes the oldest completions off the queue without blocking. The
+ * descriptor stops being readable once the queue is empty.
+ *
+ * @param cq The queue
+ * @param max The most completions to take
+ * @return The completions linked oldest first, NULL if nothing is queued
+ */
+mocr_cq_entry *mocr_cq_pop(mocr_cq *cq, size_t max);
+
+#endif // LIBMOCR_CQ_H
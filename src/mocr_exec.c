@@ -0,0 +1,237 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* Python MUST be included before all else */
+#include "mocr_exec.h"
+
+#include <stdlib.h>
+
+/**
+ * @brief Adds a job to the head of an executor's queue. Safe to call from any
+ * number of threads at once.
+ *
+ * @param executor The executor to queue the job on
+ * @param job The job to queue
+ */
+static void executor_push(mocr_executor *executor, mocr_exec_job *job)
+{
+    mocr_atomic_store_ptr(&job->next, NULL);
+    mocr_exec_job *prev = mocr_atomic_exchange_ptr(&executor->head, job);
+
+    /* Until this store the executor sees the queue end at prev */
+    mocr_atomic_store_ptr(&prev->next, job);
+}
+
+/**
+ * @brief Takes the oldest job off an executor's queue. Only called by the
+ * executor.
+ *
+ * @param executor The executor to take a job from
+ * @return The oldest job, NULL if the queue is empty or a push is still
+ * linking its job in
+ */
+static mocr_exec_job *executor_pop(mocr_executor *executor)
+{
+    mocr_exec_job *tail = executor->tail;
+    mocr_exec_job *next = mocr_atomic_load_ptr(&tail->next);
+
+    if (tail == &executor->stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        executor->tail = next;
+        tail = next;
+        next = mocr_atomic_load_ptr(&next->next);
+    }
+    if (next)
+    {
+        executor->tail = next;
+        return tail;
+    }
+
+    /* tail is the last job. Push the stub behind it so it can be taken without
+     * leaving the queue empty. */
+    if (tail != mocr_atomic_load_ptr(&executor->head))
+    {
+        return NULL;
+    }
+    executor_push(executor, &executor->stub);
+    next = mocr_atomic_load_ptr(&tail->next);
+    if (next)
+    {
+        executor->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs queued jobs until the executor is stopped and its queue is
+ * empty. The thread state is created once and the GIL is only taken while
+ * there's work.
+ *
+ * @param arg The executor
+ */
+static void executor_main(void *arg)
+{
+    mocr_executor *executor = arg;
+    PyGILState_STATE gstate = PyGILState_UNLOCKED;
+    PyThreadState *tstate;
+
+    /* The GILState API only knows about the main interpreter */
+    if (executor->interp)
+    {
+        tstate = PyThreadState_New(executor->interp);
+    }
+    else
+    {
+        gstate = PyGILState_Ensure();
+        tstate = PyEval_SaveThread();
+    }
+
+    for (;;)
+    {
+        /* Producers wake the executor if it may be asleep, so announce that
+         * before checking the queue one last time */
+        mocr_atomic_store32(&executor->idle, 1);
+        uint32_t signals = mocr_atomic_load32(&executor->signals);
+        mocr_exec_job *job = executor_pop(executor);
+        if (job == NULL)
+        {
+            if (mocr_atomic_load32(&executor->stopping))
+            {
+                break;
+            }
+            mocr_futex_wait(&executor->signals, signals);
+            continue;
+        }
+        mocr_atomic_store32(&executor->idle, 0);
+
+        /* Hold the GIL until the queue runs dry. Calls made with it held take
+         * it again without blocking. */
+        PyEval_RestoreThread(tstate);
+        do
+        {
+            job->func(job->arg);
+
+            /* The job may be gone as soon as done is set */
+            mocr_atomic_store32(&job->done, 1);
+            mocr_futex_wake(&job->done);
+        }
+        while ((job = executor_pop(executor)) != NULL);
+        tstate = PyEval_SaveThread();
+    }
+
+    PyEval_RestoreThread(tstate);
+    if (executor->interp)
+    {
+        PyThreadState_Clear(tstate);
+        PyThreadState_DeleteCurrent();
+    }
+    else
+    {
+        PyGILState_Release(gstate);
+    }
+}
+
+/**
+ * @brief Wakes an executor if it may be asleep
+ *
+ * @param executor The executor to wake
+ */
+static void executor_signal(mocr_executor *executor)
+{
+    mocr_atomic_add32(&executor->signals, 1);
+    if (mocr_atomic_load32(&executor->idle))
+    {
+        mocr_futex_wake(&executor->signals);
+    }
+}
+
+/**
+ * @brief Stops the first count executors of a set
+ *
+ * @param exec The executors
+ * @param count The number of executors that were started
+ */
+static void stop_executors(mocr_exec *exec, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        mocr_atomic_store32(&exec->executors[i].stopping, 1);
+        executor_signal(&exec->executors[i]);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        mocr_thread_join(exec->executors[i].thread);
+    }
+}
+
+int mocr_exec_start(mocr_exec *exec, size_t count, PyInterpreterState *interp)
+{
+    exec->executors = calloc(count, sizeof(mocr_executor));
+    if (exec->executors == NULL)
+    {
+        return -1;
+    }
+    exec->count = count;
+    exec->next = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        mocr_executor *executor = &exec->executors[i];
+        executor->head = &executor->stub;
+        executor->tail = &executor->stub;
+        executor->interp = interp;
+        if (mocr_thread_create(&executor->thread, executor_main, executor))
+        {
+            stop_executors(exec, i);
+            free(exec->executors);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void mocr_exec_stop(mocr_exec *exec)
+{
+    stop_executors(exec, exec->count);
+    free(exec->executors);
+}
+
+void mocr_exec_call(mocr_exec *exec, mocr_exec_func func, void *arg)
+{
+    mocr_exec_job job;
+    job.func = func;
+    job.arg = arg;
+    job.done = 0;
+
+    uint64_t index = mocr_atomic_add(&exec->next, 1) % exec->count;
+    mocr_executor *executor = &exec->executors[index];
+    executor_push(executor, &job);
+    executor_signal(executor);
+
+    while (!mocr_atomic_load32(&job.done))
+    {
+        mocr_futex_wait(&job.done, 0);
+    }
+}
@@ -0,0 +1,132 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIBMOCR_EXEC_H
+#define LIBMOCR_EXEC_H
+
+/* Runs calls into Python on executor threads that keep their thread state and
+ * hold the GIL while work is queued. Not part of the public API. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mocr_thread.h"
+
+/**
+ * @brief A function run on an executor thread with the GIL held
+ *
+ * @param arg The argument given to mocr_exec_call()
+ */
+typedef void (*mocr_exec_func)(void *arg);
+
+/* A queued call. Lives on the stack of the thread making the call. */
+typedef struct mocr_exec_job
+{
+    /* The job queued after this one */
+    void *volatile next;
+
+    /* The function to run and its argument */
+    mocr_exec_func func;
+    void *arg;
+
+    /* Set to 1 once func has returned */
+    volatile uint32_t done;
+}
+mocr_exec_job;
+
+/* An executor thread and the queue it takes jobs from. The queue is an
+ * intrusive multi-producer single-consumer list: producers swap themselves in
+ * at head, the executor takes jobs from tail. */
+typedef struct mocr_executor
+{
+    /* The newest job, swapped in by producers */
+    void *volatile head;
+
+    /* The oldest job, only touched by the executor */
+    mocr_exec_job *tail;
+
+    /* Keeps the queue from ever being empty */
+    mocr_exec_job stub;
+
+    /* Bumped after every push. The executor sleeps on it. */
+    volatile uint32_t signals;
+
+    /* Nonzero while the executor may be asleep */
+    volatile uint32_t idle;
+
+    /* Nonzero once the executor should exit when its queue is empty */
+    volatile uint32_t stopping;
+
+    /* The interpreter calls run in, NULL for the main interpreter */
+    PyInterpreterState *interp;
+
+    /* The executor thread */
+    mocr_thread thread;
+}
+mocr_executor;
+
+/* A set of executors calls are spread across */
+typedef struct mocr_exec
+{
+    /* The executors */
+    mocr_executor *executors;
+
+    /* The number of executors */
+    size_t count;
+
+    /* Picks the executor of the next call */
+    volatile uint64_t next;
+}
+mocr_exec;
+
+/**
+ * @brief Starts executor threads. Python must be initialized and the GIL must
+ * not be held.
+ *
+ * @param exec The executors to start
+ * @param count The number of executor threads
+ * @param interp The interpreter calls run in, NULL for the main interpreter.
+ *               Each executor makes its own thread state in it.
+ * @return 0 on success, nonzero on error
+ */
+int mocr_exec_start(mocr_exec *exec, size_t count, PyInterpreterState *interp);
+
+/**
+ * @brief Runs every queued call, then stops the executor threads and frees
+ * their resources. The GIL must not be held.
+ *
+ * @param exec The executors to stop
+ */
+void mocr_exec_stop(mocr_exec *exec);
+
+/**
+ * @brief Runs a function on one of the executor threads and blocks until it
+ * returns
+ *
+ * @param exec The running executors
+ * @param func The function to run with the GIL held
+ * @param arg The argument passed to func
+ */
+void mocr_exec_call(mocr_exec *exec, mocr_exec_func func, void *arg);
+
+#endif // LIBMOCR_EXEC_H
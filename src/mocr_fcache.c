@@ -0,0 +1,683 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+/* mmap() and ftruncate() are POSIX, not C99, realpath() is an X/Open
+ * extension, glibc hides flock() without its defaults, and macOS hides the
+ * nanoseconds of file times without its own */
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE
+#endif
+
+#include "mocr_fcache.h"
+#include "mocr_cache.h"
+#include "mocr_thread.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32)
+
+/* Identifies a cache file written by this version on a machine with the same
+ * byte order */
+static const char g_magic[8] = {'M', 'O', 'C', 'R', 'F', 'C', '\0', '\1'};
+#define BYTE_ORDER_MARK 0x01020304u
+
+/* The number of slots the index starts with */
+#define MIN_SLOTS 256
+
+/* The start of a cache file */
+typedef struct file_header
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t reserved;
+}
+file_header;
+
+/* The start of a record, followed by the path, the text, and padding to a
+ * multiple of 8 bytes */
+typedef struct record_header
+{
+    /* A hash of the rest of the record, including the path and text */
+    uint64_t check;
+
+    /* The index key of the record from index_key() */
+    uint64_t key;
+
+    /* The fields of the mocr_fcache_key the record was written with */
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t model;
+    uint64_t content;
+
+    /* The length of the path and the text in bytes, not counting a NUL */
+    uint32_t path_length;
+    uint32_t text_length;
+}
+record_header;
+
+/* A record in the index */
+typedef struct index_slot
+{
+    /* The index key of the record, 0 if the slot is empty */
+    uint64_t key;
+
+    /* The offset of the record in the file */
+    uint64_t offset;
+}
+index_slot;
+
+struct mocr_fcache
+{
+    /* Protects everything below */
+    mocr_mutex mutex;
+
+    /* The cache file, opened for appending */
+    int fd;
+
+    /* The file mapped into memory, NULL if nothing is mapped */
+    const unsigned char *map;
+
+    /* The number of bytes mapped, which can be more than the file holds */
+    size_t map_size;
+
+    /* The newest record of each file, a table with linear probing */
+    index_slot *slots;
+
+    /* The number of slots, a power of 2 */
+    size_t slot_count;
+
+    /* The number of slots in use */
+    size_t used;
+};
+
+/**
+ * @brief Gets the number of bytes a record takes in the file
+ *
+ * @param header The record's header
+ * @return The number of bytes including padding
+ */
+static uint64_t record_size(const record_header *header)
+{
+    uint64_t size = sizeof(record_header) + (uint64_t)header->path_length +
+        header->text_length;
+    return (size + 7) & ~(uint64_t)7;
+}
+
+/**
+ * @brief Hashes a record the way its check field is computed
+ *
+ * @param record The start of the record
+ * @param header The record's header
+ * @return The hash of everything after the check field, excluding padding
+ */
+static uint64_t record_check(
+    const unsigned char *record, const record_header *header)
+{
+    size_t checked = sizeof(*header) - sizeof(header->check) +
+        header->path_length + header->text_length;
+    return mocr_cache_hash(
+        record + sizeof(header->check), checked, 1, checked
+    );
+}
+
+/**
+ * @brief Locks the cache file. Appending to it or cutting a torn record off
+ * its end takes the lock exclusively, so a process never cuts off a record
+ * that's being written or misplaces its own record. Reading a record takes
+ * it shared, so the record can't be cut off while it's read.
+ *
+ * @param fd The cache file
+ * @param operation LOCK_EX or LOCK_SH
+ * @return 0 on success, nonzero on error
+ */
+static int lock_file(int fd, int operation)
+{
+    while (flock(fd, operation))
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Gets the key a file's records are indexed under
+ *
+ * @param path The absolute path of the file
+ * @param model The hash of the model
+ * @return The key, never 0
+ */
+static uint64_t index_key(const char *path, uint64_t model)
+{
+    size_t length = strlen(path);
+    uint64_t key = mocr_cache_hash(path, length, 1, length) ^
+        (model * 0x9E3779B97F4A7C15ull);
+    return key ? key : 1;
+}
+
+/**
+ * @brief Points the index at a record, replacing the one for the same file
+ *
+ * @param fcache The cache. The mutex must be held.
+ * @param key The index key of the record
+ * @param offset The offset of the record in the file
+ * @return 0 on success, nonzero on error
+ */
+static int index_insert(mocr_fcache *fcache, uint64_t key, uint64_t offset)
+{
+    /* Keep the table at most half full */
+    if ((fcache->used + 1) * 2 > fcache->slot_count)
+    {
+        size_t count = fcache->slot_count ? fcache->slot_count * 2 : MIN_SLOTS;
+        index_slot *slots = calloc(count, sizeof(index_slot));
+        if (slots == NULL)
+        {
+            return -1;
+        }
+        for (size_t i = 0; i < fcache->slot_count; ++i)
+        {
+            if (fcache->slots[i].key)
+            {
+                size_t j = fcache->slots[i].key & (count - 1);
+                while (slots[j].key)
+                {
+                    j = (j + 1) & (count - 1);
+                }
+                slots[j] = fcache->slots[i];
+            }
+        }
+        free(fcache->slots);
+        fcache->slots = slots;
+        fcache->slot_count = count;
+    }
+
+    size_t i = key & (fcache->slot_count - 1);
+    while (fcache->slots[i].key && fcache->slots[i].key != key)
+    {
+        i = (i + 1) & (fcache->slot_count - 1);
+    }
+    if (fcache->slots[i].key == 0)
+    {
+        fcache->slots[i].key = key;
+        ++fcache->used;
+    }
+    fcache->slots[i].offset = offset;
+    return 0;
+}
+
+/**
+ * @brief Finds the newest record of a file in the index
+ *
+ * @param fcache The cache. The mutex must be held.
+ * @param key The index key of the file
+ * @return The offset of the record in the file, 0 if there isn't one
+ */
+static uint64_t index_find(const mocr_fcache *fcache, uint64_t key)
+{
+    if (fcache->slot_count == 0)
+    {
+        return 0;
+    }
+    size_t i = key & (fcache->slot_count - 1);
+    while (fcache->slots[i].key)
+    {
+        if (fcache->slots[i].key == key)
+        {
+            return fcache->slots[i].offset;
+        }
+        i = (i + 1) & (fcache->slot_count - 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Maps the cache file into memory, replacing the old mapping
+ *
+ * @param fcache The cache. The mutex must be held.
+ * @param size The number of bytes to map
+ * @return 0 on success, nonzero on error, in which case the old mapping is
+ * kept
+ */
+static int remap(mocr_fcache *fcache, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fcache->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+    if (fcache->map)
+    {
+        munmap((void *)fcache->map, fcache->map_size);
+    }
+    fcache->map = map;
+    fcache->map_size = size;
+    return 0;
+}
+
+/**
+ * @brief Indexes the records of a cache file and cuts off a torn record left
+ * at its end by a crash. Records other processes appended after the torn one
+ * are cut off with it, which mocr_fcache_get() in those processes checks for.
+ *
+ * @param fcache The cache. The mutex and the file lock must be held and
+ *               exactly the file mapped.
+ * @return 0 on success, nonzero on error
+ */
+static int scan(mocr_fcache *fcache)
+{
+    uint64_t offset = sizeof(file_header);
+    while (fcache->map_size - offset >= sizeof(record_header))
+    {
+        record_header header;
+        memcpy(&header, fcache->map + offset, sizeof(header));
+        uint64_t size = record_size(&header);
+        if (size > fcache->map_size - offset)
+        {
+            break;
+        }
+        if (record_check(fcache->map + offset, &header) != header.check)
+        {
+            break;
+        }
+        if (index_insert(fcache, header.key, offset))
+        {
+            return -1;
+        }
+        offset += size;
+    }
+
+    if (offset != fcache->map_size)
+    {
+        if (ftruncate(fcache->fd, (off_t)offset))
+        {
+            return -1;
+        }
+        return remap(fcache, offset);
+    }
+    return 0;
+}
+
+mocr_fcache *mocr_fcache_open(const char *path)
+{
+    mocr_fcache *fcache = calloc(1, sizeof(mocr_fcache));
+    if (fcache == NULL)
+    {
+        return NULL;
+    }
+    if (mocr_mutex_init(&fcache->mutex))
+    {
+        free(fcache);
+        return NULL;
+    }
+
+    fcache->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fcache->fd < 0)
+    {
+        goto error;
+    }
+
+    /* Held until the file is indexed. Closing the file on error drops it. */
+    if (lock_file(fcache->fd, LOCK_EX))
+    {
+        goto error;
+    }
+
+    struct stat st;
+    if (fstat(fcache->fd, &st))
+    {
+        goto error;
+    }
+    if (st.st_size == 0)
+    {
+        file_header header = {{0}, BYTE_ORDER_MARK, 0};
+        memcpy(header.magic, g_magic, sizeof(g_magic));
+        if (write(fcache->fd, &header, sizeof(header)) != sizeof(header))
+        {
+            goto error;
+        }
+        st.st_size = sizeof(header);
+    }
+    if ((uint64_t)st.st_size < sizeof(file_header) ||
+        (uint64_t)st.st_size > SIZE_MAX)
+    {
+        goto error;
+    }
+
+    /* Never touch a file that isn't a cache file */
+    if (remap(fcache, (size_t)st.st_size))
+    {
+        goto error;
+    }
+    file_header header;
+    memcpy(&header, fcache->map, sizeof(header));
+    if (memcmp(header.magic, g_magic, sizeof(g_magic)) ||
+        header.byte_order != BYTE_ORDER_MARK)
+    {
+        goto error;
+    }
+
+    mocr_mutex_lock(&fcache->mutex);
+    int ret = scan(fcache);
+    mocr_mutex_unlock(&fcache->mutex);
+    if (ret)
+    {
+        goto error;
+    }
+    flock(fcache->fd, LOCK_UN);
+    return fcache;
+
+error:
+    mocr_fcache_close(fcache);
+    return NULL;
+}
+
+void mocr_fcache_close(mocr_fcache *fcache)
+{
+    if (fcache->map)
+    {
+        munmap((void *)fcache->map, fcache->map_size);
+    }
+    if (fcache->fd >= 0)
+    {
+        close(fcache->fd);
+    }
+    free(fcache->slots);
+    mocr_mutex_destroy(&fcache->mutex);
+    free(fcache);
+}
+
+int mocr_fcache_key_init(
+    const char *path,
+    const char *model,
+    int hash_content,
+    mocr_fcache_key *key)
+{
+    memset(key, 0, sizeof(*key));
+
+    key->path = realpath(path, NULL);
+    if (key->path == NULL)
+    {
+        return -1;
+    }
+
+    int fd = open(key->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        goto error;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+    {
+        goto error_close;
+    }
+    key->size = (uint64_t)st.st_size;
+#if defined(__APPLE__)
+    key->mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+        st.st_mtimespec.tv_nsec;
+#else
+    key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+        st.st_mtim.tv_nsec;
+#endif
+    size_t length = strlen(model);
+    key->model = mocr_cache_hash(model, length, 1, length);
+
+    if (hash_content && key->size)
+    {
+        if (key->size > SIZE_MAX)
+        {
+            goto error_close;
+        }
+        size_t size = (size_t)key->size;
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            goto error_close;
+        }
+        key->content = mocr_cache_hash(map, size, 1, size);
+        munmap(map, size);
+
+        /* 0 means the content isn't compared */
+        if (key->content == 0)
+        {
+            key->content = 1;
+        }
+    }
+    else if (hash_content)
+    {
+        key->content = 1;
+    }
+
+    close(fd);
+    return 0;
+
+error_close:
+    close(fd);
+error:
+    mocr_fcache_key_free(key);
+    return -1;
+}
+
+void mocr_fcache_key_free(mocr_fcache_key *key)
+{
+    free(key->path);
+    key->path = NULL;
+}
+
+char *mocr_fcache_get(mocr_fcache *fcache, const mocr_fcache_key *key)
+{
+    char *text = NULL;
+    int locked = 0;
+    size_t path_length = strlen(key->path);
+
+    mocr_mutex_lock(&fcache->mutex);
+    uint64_t offset = index_find(fcache, index_key(key->path, key->model));
+    if (offset == 0)
+    {
+        goto done;
+    }
+
+    /* Another process may have cut the record off the file since it was
+     * indexed, and reading a mapped page past the end of the file crashes.
+     * The shared lock keeps it from happening while the record is read. */
+    if (lock_file(fcache->fd, LOCK_SH))
+    {
+        goto done;
+    }
+    locked = 1;
+    struct stat st;
+    if (fstat(fcache->fd, &st))
+    {
+        goto done;
+    }
+    uint64_t available = (uint64_t)st.st_size < fcache->map_size ?
+        (uint64_t)st.st_size : fcache->map_size;
+    if (offset > available || available - offset < sizeof(record_header))
+    {
+        goto done;
+    }
+    record_header header;
+    memcpy(&header, fcache->map + offset, sizeof(header));
+    if (record_size(&header) > available - offset ||
+        record_check(fcache->map + offset, &header) != header.check)
+    {
+        goto done;
+    }
+
+    const char *path = (const char *)fcache->map + offset + sizeof(header);
+    if (header.size != key->size || header.mtime_ns != key->mtime_ns ||
+        header.model != key->model ||
+        (key->content && header.content != key->content) ||
+        header.path_length != path_length ||
+        memcmp(path, key->path, path_length))
+    {
+        goto done;
+    }
+
+    text = malloc((size_t)header.text_length + 1);
+    if (text)
+    {
+        memcpy(text, path + path_length, header.text_length);
+        text[header.text_length] = '\0';
+    }
+
+done:
+    if (locked)
+    {
+        flock(fcache->fd, LOCK_UN);
+    }
+    mocr_mutex_unlock(&fcache->mutex);
+    return text;
+}
+
+int mocr_fcache_put(
+    mocr_fcache *fcache, const mocr_fcache_key *key, const char *text)
+{
+    int ret = -1;
+    size_t path_length = strlen(key->path);
+    size_t text_length = strlen(text);
+    if (path_length > UINT32_MAX || text_length > UINT32_MAX)
+    {
+        return -1;
+    }
+
+    record_header header;
+    header.check = 0;
+    header.key = index_key(key->path, key->model);
+    header.size = key->size;
+    header.mtime_ns = key->mtime_ns;
+    header.model = key->model;
+    header.content = key->content;
+    header.path_length = (uint32_t)path_length;
+    header.text_length = (uint32_t)text_length;
+
+    size_t size = (size_t)record_size(&header);
+    unsigned char *record = calloc(1, size);
+    if (record == NULL)
+    {
+        return -1;
+    }
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), key->path, path_length);
+    memcpy(record + sizeof(header) + path_length, text, text_length);
+    header.check = record_check(record, &header);
+    memcpy(record, &header.check, sizeof(header.check));
+
+    /* The file lock keeps other processes from appending between the write
+     * and finding where it went */
+    mocr_mutex_lock(&fcache->mutex);
+    if (lock_file(fcache->fd, LOCK_EX))
+    {
+        goto done;
+    }
+    ssize_t written = write(fcache->fd, record, size);
+    off_t end = lseek(fcache->fd, 0, SEEK_CUR);
+    flock(fcache->fd, LOCK_UN);
+    if (written != (ssize_t)size || end < (off_t)size ||
+        (uint64_t)end > SIZE_MAX)
+    {
+        goto done;
+    }
+
+    /* Map past the end of the file so most appends don't need a new mapping.
+     * Only records within the file are ever read. */
+    if ((size_t)end > fcache->map_size)
+    {
+        size_t reserve = fcache->map_size * 2;
+        if (remap(fcache, reserve > (size_t)end ? reserve : (size_t)end))
+        {
+            goto done;
+        }
+    }
+    ret = index_insert(fcache, header.key, (uint64_t)end - size);
+
+done:
+    mocr_mutex_unlock(&fcache->mutex);
+    free(record);
+    return ret;
+}
+
+#else
+
+mocr_fcache *mocr_fcache_open(const char *path)
+{
+    (void)path;
+    return NULL;
+}
+
+void mocr_fcache_close(mocr_fcache *fcache)
+{
+    (void)fcache;
+}
+
+int mocr_fcache_key_init(
+    const char *path,
+    const char *model,
+    int hash_content,
+    mocr_fcache_key *key)
+{
+    (void)path;
+    (void)model;
+    (void)hash_content;
+    key->path = NULL;
+    return -1;
+}
+
+void mocr_fcache_key_free(mocr_fcache_key *key)
+{
+    (void)key;
+}
+
+char *mocr_fcache_get(mocr_fcache *fcache, const mocr_fcache_key *key)
+{
+    (void)fcache;
+    (void)key;
+    return NULL;
+}
+
+int mocr_fcache_put(
+    mocr_fcache *fcache, const mocr_fcache_key *key, const char *text)
+{
+    (void)fcache;
+    (void)key;
+    (void)text;
+    return -1;
+}
+
+#endif
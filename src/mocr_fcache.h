@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef LIBMOCR_FCACHE_H
+#define LIBMOCR_FCACHE_H
+
+/* Keeps the text read from image files in an append-only file that's mapped
+ * into memory, so unchanged files are answered from disk across restarts.
+ * Records are checksummed, and a torn record at the end of the file is cut
+ * off when it's opened. Not part of the public API. */
+
+#include <stdint.h>
+
+/* An open cache file */
+typedef struct mocr_fcache mocr_fcache;
+
+/* Identifies the version of an image file a text was read from */
+typedef struct mocr_fcache_key
+{
+    /* The absolute path of the file. Must be freed with free(). */
+    char *path;
+
+    /* The size of the file in bytes */
+    uint64_t size;
+
+    /* The time the file was last modified in nanoseconds since the epoch */
+    int64_t mtime_ns;
+
+    /* A hash of the model the text was read with */
+    uint64_t model;
+
+    /* A hash of the contents of the file, 0 if it isn't compared */
+    uint64_t content;
+}
+mocr_fcache_key;
+
+/**
+ * @brief Opens a cache file, creating it if it doesn't exist, and indexes the
+ * records in it
+ *
+ * @param path The path of the cache file
+ * @return The cache, NULL on error or if the file isn't a cache file
+ */
+mocr_fcache *mocr_fcache_open(const char *path);
+
+/**
+ * @brief Closes a cache file
+ *
+ * @param fcache The cache to close
+ */
+void mocr_fcache_close(mocr_fcache *fcache);
+
+/**
+ * @brief Gets the key of the current version of an image file
+ *
+ * @param path The path of the image file
+ * @param model The model the text is read with
+ * @param hash_content Nonzero to hash the contents of the file into the key
+ * @param[out] key Receives the key. Must be freed with mocr_fcache_key_free().
+ * @return 0 on success, nonzero if the file can't be found or read
+ */
+int mocr_fcache_key_init(
+    const char *path,
+    const char *model,
+    int hash_content,
+    mocr_fcache_key *key);
+
+/**
+ * @brief Frees a key made by mocr_fcache_key_init()
+ *
+ * @param key The key to free
+ */
+void mocr_fcache_key_free(mocr_fcache_key *key);
+
+/**
+ * @brief Looks up the text read from a version of an image file
+ *
+ * @param fcache The cache
+ * @param key The version of the file
+ * @return A copy of the text, NULL if it isn't cached. Must be freed with
+ * free().
+ */
+char *mocr_fcache_get(mocr_fcache *fcache, const mocr_fcache_key *key);
+
+/**
+ * @brief Appends the text read from a version of an image file. It replaces
+ * any text cached for earlier versions of the file.
+ *
+ * @param fcache The cache
+ * @param key The version of the file
+ * @param text The text
+ * @return 0 on success, nonzero on error
+ */
+int mocr_fcache_put(
+    mocr_fcache *fcache, const mocr_fcache_key *key, const char *text);
+
+#endif // LIBMOCR_FCACHE_H
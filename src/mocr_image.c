@@ -0,0 +1,1236 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "mocr_image.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MOCR_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+/* AVX2 kernels are compiled separately and picked at runtime */
+#define MOCR_AVX2
+#define MOCR_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MOCR_NEON
+#include <arm_neon.h>
+#endif
+
+/* PIL's fixed point weights for converting RGB to L. These sum to 1 << 16. */
+#define LUMA_WEIGHT_R   19595
+#define LUMA_WEIGHT_G   38470
+#define LUMA_WEIGHT_B   7471
+#define LUMA_ROUND      0x8000
+#define LUMA_SHIFT      16
+
+/* The number of pixels handled per iteration by the vectorized kernels */
+#define LUMA_BLOCK      16
+
+/* The number of fractional bits PIL uses for 8-bit resampling coefficients */
+#define PRECISION_BITS  (32 - 8 - 2)
+
+/* Converts a row of pixels to luma */
+typedef void (*row_kernel)(const uint8_t *src, size_t width, uint8_t *dst);
+
+/**
+ * @brief Converts a single RGB pixel to luma
+ *
+ * @param r The red value
+ * @param g The green value
+ * @param b The blue value
+ * @return The luma of the pixel
+ */
+static inline uint8_t luma(int r, int g, int b)
+{
+    return (uint8_t)(
+        (r * LUMA_WEIGHT_R + g * LUMA_WEIGHT_G + b * LUMA_WEIGHT_B +
+            LUMA_ROUND) >> LUMA_SHIFT
+    );
+}
+
+/**
+ * @brief Computes (a * b) / 255 rounded the way PIL's MULDIV255 does
+ *
+ * @param a An 8-bit value
+ * @param b An 8-bit value
+ * @return The product
+ */
+static inline int muldiv255(int a, int b)
+{
+    int tmp = a * b + 128;
+    return ((tmp >> 8) + tmp) >> 8;
+}
+
+/**
+ * @brief Converts a single CMYK pixel to luma. PIL converts CMYK to RGB before
+ * converting to L.
+ *
+ * @param px The cyan, magenta, yellow, and key values
+ * @return The luma of the pixel
+ */
+static inline uint8_t cmyk_luma(const uint8_t *px)
+{
+    int nk = 255 - px[3];
+    return luma(
+        nk - muldiv255(px[0], nk),
+        nk - muldiv255(px[1], nk),
+        nk - muldiv255(px[2], nk)
+    );
+}
+
+/**
+ * @brief Converts a single HSV pixel to luma. This is PIL's hsv2rgb() followed
+ * by the RGB to L conversion.
+ *
+ * @param px The hue, saturation, and value
+ * @return The luma of the pixel
+ */
+static uint8_t hsv_luma(const uint8_t *px)
+{
+    uint8_t h = px[0];
+    uint8_t s = px[1];
+    uint8_t v = px[2];
+    if (s == 0)
+    {
+        return luma(v, v, v);
+    }
+
+    int i = (int)floor((float)h * 6.0 / 255.0);
+    float f = (float)((float)h * 6.0 / 255.0 - (float)i);
+    float fs = (float)s / 255.0f;
+    int p = (int)round((float)v * (1.0 - fs));
+    int q = (int)round((float)v * (1.0 - fs * f));
+    int t = (int)round((float)v * (1.0 - fs * (1.0 - f)));
+    p = p < 0 ? 0 : p > 255 ? 255 : p;
+    q = q < 0 ? 0 : q > 255 ? 255 : q;
+    t = t < 0 ? 0 : t > 255 ? 255 : t;
+
+    switch (i % 6)
+    {
+        case 0:
+            return luma(v, t, p);
+        case 1:
+            return luma(q, v, p);
+        case 2:
+            return luma(p, v, t);
+        case 3:
+            return luma(p, q, v);
+        case 4:
+            return luma(t, p, v);
+        default:
+            return luma(v, p, q);
+    }
+}
+
+/**
+ * @brief Clamps a 32-bit integer to an 8-bit value
+ *
+ * @param v The value to clamp
+ * @return The clamped value
+ */
+static inline uint8_t clamp_i32(int32_t v)
+{
+    return v <= 0 ? 0 : v >= 255 ? 255 : (uint8_t)v;
+}
+
+/**
+ * @brief Clamps a float to an 8-bit value, truncating like PIL
+ *
+ * @param v The value to clamp
+ * @return The clamped value
+ */
+static inline uint8_t clamp_f32(float v)
+{
+    return v <= 0.0f ? 0 : v >= 255.0f ? 255 : (uint8_t)v;
+}
+
+/**
+ * @brief Loads 4 unaligned bytes
+ *
+ * @param p The address to load from
+ * @return The bytes as a 32-bit integer
+ */
+static inline int32_t load_i32(const uint8_t *p)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Loads an unaligned float
+ *
+ * @param p The address to load from
+ * @return The float
+ */
+static inline float load_f32(const uint8_t *p)
+{
+    float v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Scalar kernels. These finish the pixels left over by the vector kernels. */
+
+static void tail_1(const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        dst[x] = src[x] ? 255 : 0;
+    }
+}
+
+static void tail_1_packed(
+    const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        dst[x] = (src[x / 8] & (0x80 >> (x % 8))) ? 255 : 0;
+    }
+}
+
+static void tail_rgb(const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        const uint8_t *px = src + x * 3;
+        dst[x] = luma(px[0], px[1], px[2]);
+    }
+}
+
+static void tail_rgbx(const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        const uint8_t *px = src + x * 4;
+        dst[x] = luma(px[0], px[1], px[2]);
+    }
+}
+
+static void tail_cmyk(const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        dst[x] = cmyk_luma(src + x * 4);
+    }
+}
+
+static void tail_band0(
+    const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        dst[x] = src[x * 3];
+    }
+}
+
+static void tail_i32(const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        dst[x] = clamp_i32(load_i32(src + x * 4));
+    }
+}
+
+static void tail_f32(const uint8_t *src, size_t x, size_t width, uint8_t *dst)
+{
+    for (; x < width; ++x)
+    {
+        dst[x] = clamp_f32(load_f32(src + x * 4));
+    }
+}
+
+#if defined(MOCR_SSE2)
+
+/**
+ * @brief Computes the luma of 4 pixels stored in the low 3 bytes of each
+ * 32-bit lane
+ *
+ * @param px The pixels with red in the lowest byte of each lane
+ * @return The luma of each pixel in the 32-bit lanes
+ */
+static inline __m128i luma_sse2(__m128i px)
+{
+    /* g * 38470 doesn't fit a signed 16-bit multiply, so it's done as
+     * (g * 19235) << 1 */
+    const __m128i mask_rb = _mm_set1_epi32(0x00FF00FF);
+    const __m128i mask_g = _mm_set1_epi32(0x000000FF);
+    const __m128i weight_rb =
+        _mm_set1_epi32((LUMA_WEIGHT_B << 16) | LUMA_WEIGHT_R);
+    const __m128i weight_g = _mm_set1_epi32(LUMA_WEIGHT_G / 2);
+    const __m128i bias = _mm_set1_epi32(LUMA_ROUND);
+
+    __m128i rb = _mm_and_si128(px, mask_rb);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(px, 8), mask_g);
+    __m128i sum = _mm_madd_epi16(rb, weight_rb);
+    sum = _mm_add_epi32(sum, _mm_slli_epi32(_mm_madd_epi16(g, weight_g), 1));
+    sum = _mm_add_epi32(sum, bias);
+    return _mm_srli_epi32(sum, LUMA_SHIFT);
+}
+
+/**
+ * @brief Computes nk - MULDIV255(v, nk) for 4 values. Every intermediate fits
+ * in 16 bits, so the multiply is done on the low half of each 32-bit lane.
+ *
+ * @param v The cyan, magenta, or yellow values
+ * @param nk 255 minus the key values
+ * @return The red, green, or blue values
+ */
+static inline __m128i cmyk_channel_sse2(__m128i v, __m128i nk)
+{
+    __m128i tmp = _mm_add_epi32(_mm_mullo_epi16(v, nk), _mm_set1_epi32(128));
+    tmp = _mm_srli_epi32(_mm_add_epi32(_mm_srli_epi32(tmp, 8), tmp), 8);
+    return _mm_sub_epi32(nk, tmp);
+}
+
+/**
+ * @brief Converts 4 CMYK pixels to RGB the way PIL's cmyk2rgb() does
+ *
+ * @param px The pixels with cyan in the lowest byte of each lane
+ * @return The pixels with red in the lowest byte of each lane
+ */
+static inline __m128i cmyk_to_rgb_sse2(__m128i px)
+{
+    const __m128i mask = _mm_set1_epi32(0xFF);
+
+    __m128i nk = _mm_sub_epi32(mask, _mm_srli_epi32(px, 24));
+    __m128i r = cmyk_channel_sse2(_mm_and_si128(px, mask), nk);
+    __m128i g = cmyk_channel_sse2(
+        _mm_and_si128(_mm_srli_epi32(px, 8), mask), nk
+    );
+    __m128i b = cmyk_channel_sse2(
+        _mm_and_si128(_mm_srli_epi32(px, 16), mask), nk
+    );
+    return _mm_or_si128(
+        _mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_slli_epi32(b, 16)
+    );
+}
+
+/**
+ * @brief Packs 16 values between 0 and 255 held in 32-bit lanes into bytes
+ * and stores them
+ *
+ * @param dst Where to store the 16 bytes
+ * @param a Values 0-3
+ * @param b Values 4-7
+ * @param c Values 8-11
+ * @param d Values 12-15
+ */
+static inline void store_u8_sse2(
+    uint8_t *dst, __m128i a, __m128i b, __m128i c, __m128i d)
+{
+    __m128i lo = _mm_packs_epi32(a, b);
+    __m128i hi = _mm_packs_epi32(c, d);
+    _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(lo, hi));
+}
+
+/**
+ * @brief Loads 4 three byte pixels into the low 3 bytes of each 32-bit lane.
+ * The byte after the last pixel is read, so it must be within the buffer.
+ *
+ * @param p The first pixel
+ * @return The pixels
+ */
+static inline __m128i load_rgb_sse2(const uint8_t *p)
+{
+    return _mm_setr_epi32(
+        load_i32(p), load_i32(p + 3), load_i32(p + 6), load_i32(p + 9)
+    );
+}
+
+static void row_1(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi8(-1);
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+        v = _mm_xor_si128(_mm_cmpeq_epi8(v, zero), full);
+        _mm_storeu_si128((__m128i *)(dst + x), v);
+    }
+    tail_1(src, x, width, dst);
+}
+
+static void row_1_packed(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    /* Each byte is broadcast to 8 lanes and every lane tests one bit */
+    const __m128i bits = _mm_setr_epi8(
+        (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+    );
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        const uint8_t *p = src + x / 8;
+        __m128i v = _mm_cvtsi32_si128(p[0] | (p[1] << 8));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+        _mm_storeu_si128((__m128i *)(dst + x), v);
+    }
+    tail_1_packed(src, x, width, dst);
+}
+
+static void row_rgb(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    /* The last pixel of a block is loaded as 4 bytes, so a block must not end
+     * the row */
+    for (; x + LUMA_BLOCK < width; x += LUMA_BLOCK)
+    {
+        const uint8_t *p = src + x * 3;
+        store_u8_sse2(
+            dst + x,
+            luma_sse2(load_rgb_sse2(p + 0)),
+            luma_sse2(load_rgb_sse2(p + 12)),
+            luma_sse2(load_rgb_sse2(p + 24)),
+            luma_sse2(load_rgb_sse2(p + 36))
+        );
+    }
+    tail_rgb(src, x, width, dst);
+}
+
+static void row_rgbx(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        const __m128i *p = (const __m128i *)(src + x * 4);
+        store_u8_sse2(
+            dst + x,
+            luma_sse2(_mm_loadu_si128(p + 0)),
+            luma_sse2(_mm_loadu_si128(p + 1)),
+            luma_sse2(_mm_loadu_si128(p + 2)),
+            luma_sse2(_mm_loadu_si128(p + 3))
+        );
+    }
+    tail_rgbx(src, x, width, dst);
+}
+
+static void row_cmyk(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        const __m128i *p = (const __m128i *)(src + x * 4);
+        store_u8_sse2(
+            dst + x,
+            luma_sse2(cmyk_to_rgb_sse2(_mm_loadu_si128(p + 0))),
+            luma_sse2(cmyk_to_rgb_sse2(_mm_loadu_si128(p + 1))),
+            luma_sse2(cmyk_to_rgb_sse2(_mm_loadu_si128(p + 2))),
+            luma_sse2(cmyk_to_rgb_sse2(_mm_loadu_si128(p + 3)))
+        );
+    }
+    tail_cmyk(src, x, width, dst);
+}
+
+static void row_band0(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    size_t x = 0;
+    for (; x + LUMA_BLOCK < width; x += LUMA_BLOCK)
+    {
+        const uint8_t *p = src + x * 3;
+        store_u8_sse2(
+            dst + x,
+            _mm_and_si128(load_rgb_sse2(p + 0), mask),
+            _mm_and_si128(load_rgb_sse2(p + 12), mask),
+            _mm_and_si128(load_rgb_sse2(p + 24), mask),
+            _mm_and_si128(load_rgb_sse2(p + 36), mask)
+        );
+    }
+    tail_band0(src, x, width, dst);
+}
+
+static void row_i32(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    /* Saturating packs clamp to [0, 255] exactly like PIL */
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        const __m128i *p = (const __m128i *)(src + x * 4);
+        store_u8_sse2(
+            dst + x,
+            _mm_loadu_si128(p + 0),
+            _mm_loadu_si128(p + 1),
+            _mm_loadu_si128(p + 2),
+            _mm_loadu_si128(p + 3)
+        );
+    }
+    tail_i32(src, x, width, dst);
+}
+
+/**
+ * @brief Clamps 4 floats to [0, 255] and truncates them to integers
+ *
+ * @param p The address of the floats
+ * @return The integers in 32-bit lanes
+ */
+static inline __m128i load_f32_sse2(const uint8_t *p)
+{
+    /* max() returns the second operand for NaN, so NaN becomes 0 */
+    __m128 v = _mm_loadu_ps((const float *)p);
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(v);
+}
+
+static void row_f32(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        const uint8_t *p = src + x * 4;
+        store_u8_sse2(
+            dst + x,
+            load_f32_sse2(p + 0),
+            load_f32_sse2(p + 16),
+            load_f32_sse2(p + 32),
+            load_f32_sse2(p + 48)
+        );
+    }
+    tail_f32(src, x, width, dst);
+}
+
+#elif defined(MOCR_NEON)
+
+/**
+ * @brief Computes the luma of 4 pixels
+ *
+ * @param r The red values
+ * @param g The green values
+ * @param b The blue values
+ * @return The luma of each pixel
+ */
+static inline uint16x4_t luma_neon_4(uint16x4_t r, uint16x4_t g, uint16x4_t b)
+{
+    uint32x4_t sum = vmull_n_u16(r, LUMA_WEIGHT_R);
+    sum = vmlal_n_u16(sum, g, LUMA_WEIGHT_G);
+    sum = vmlal_n_u16(sum, b, LUMA_WEIGHT_B);
+    sum = vaddq_u32(sum, vdupq_n_u32(LUMA_ROUND));
+    return vshrn_n_u32(sum, LUMA_SHIFT);
+}
+
+/**
+ * @brief Computes the luma of 8 pixels
+ *
+ * @param r The red values
+ * @param g The green values
+ * @param b The blue values
+ * @return The luma of each pixel
+ */
+static inline uint8x8_t luma_neon_8(uint16x8_t r, uint16x8_t g, uint16x8_t b)
+{
+    return vmovn_u16(vcombine_u16(
+        luma_neon_4(vget_low_u16(r), vget_low_u16(g), vget_low_u16(b)),
+        luma_neon_4(vget_high_u16(r), vget_high_u16(g), vget_high_u16(b))
+    ));
+}
+
+/**
+ * @brief Computes the luma of 16 pixels
+ *
+ * @param r The red values
+ * @param g The green values
+ * @param b The blue values
+ * @return The luma of each pixel
+ */
+static inline uint8x16_t luma_neon(uint8x16_t r, uint8x16_t g, uint8x16_t b)
+{
+    return vcombine_u8(
+        luma_neon_8(
+            vmovl_u8(vget_low_u8(r)),
+            vmovl_u8(vget_low_u8(g)),
+            vmovl_u8(vget_low_u8(b))
+        ),
+        luma_neon_8(
+            vmovl_u8(vget_high_u8(r)),
+            vmovl_u8(vget_high_u8(g)),
+            vmovl_u8(vget_high_u8(b))
+        )
+    );
+}
+
+/**
+ * @brief Computes nk - MULDIV255(v, nk) for 8 values
+ *
+ * @param v The cyan, magenta, or yellow values
+ * @param nk 255 minus the key values
+ * @return The red, green, or blue values
+ */
+static inline uint16x8_t cmyk_channel_neon(uint16x8_t v, uint16x8_t nk)
+{
+    uint16x8_t tmp = vaddq_u16(vmulq_u16(v, nk), vdupq_n_u16(128));
+    tmp = vshrq_n_u16(vaddq_u16(vshrq_n_u16(tmp, 8), tmp), 8);
+    return vsubq_u16(nk, tmp);
+}
+
+static void row_1(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        uint8x16_t v = vld1q_u8(src + x);
+        vst1q_u8(dst + x, vtstq_u8(v, v));
+    }
+    tail_1(src, x, width, dst);
+}
+
+static void row_1_packed(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    /* Each byte is broadcast to 8 lanes and every lane tests one bit */
+    static const uint8_t bit_values[16] = {
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+        0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+    };
+    const uint8x16_t bits = vld1q_u8(bit_values);
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        const uint8_t *p = src + x / 8;
+        uint8x16_t v = vcombine_u8(vdup_n_u8(p[0]), vdup_n_u8(p[1]));
+        vst1q_u8(dst + x, vtstq_u8(v, bits));
+    }
+    tail_1_packed(src, x, width, dst);
+}
+
+static void row_rgb(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        uint8x16x3_t px = vld3q_u8(src + x * 3);
+        vst1q_u8(dst + x, luma_neon(px.val[0], px.val[1], px.val[2]));
+    }
+    tail_rgb(src, x, width, dst);
+}
+
+static void row_rgbx(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        uint8x16x4_t px = vld4q_u8(src + x * 4);
+        vst1q_u8(dst + x, luma_neon(px.val[0], px.val[1], px.val[2]));
+    }
+    tail_rgbx(src, x, width, dst);
+}
+
+static void row_cmyk(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK / 2 <= width; x += LUMA_BLOCK / 2)
+    {
+        uint8x8x4_t px = vld4_u8(src + x * 4);
+        uint16x8_t nk = vsubq_u16(vdupq_n_u16(255), vmovl_u8(px.val[3]));
+        vst1_u8(dst + x, luma_neon_8(
+            cmyk_channel_neon(vmovl_u8(px.val[0]), nk),
+            cmyk_channel_neon(vmovl_u8(px.val[1]), nk),
+            cmyk_channel_neon(vmovl_u8(px.val[2]), nk)
+        ));
+    }
+    tail_cmyk(src, x, width, dst);
+}
+
+static void row_band0(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK <= width; x += LUMA_BLOCK)
+    {
+        vst1q_u8(dst + x, vld3q_u8(src + x * 3).val[0]);
+    }
+    tail_band0(src, x, width, dst);
+}
+
+static void row_i32(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK / 2 <= width; x += LUMA_BLOCK / 2)
+    {
+        const int32_t *p = (const int32_t *)(src + x * 4);
+        int16x8_t v = vcombine_s16(
+            vqmovn_s32(vld1q_s32(p)), vqmovn_s32(vld1q_s32(p + 4))
+        );
+        vst1_u8(dst + x, vqmovun_s16(v));
+    }
+    tail_i32(src, x, width, dst);
+}
+
+static void row_f32(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t full = vdupq_n_f32(255.0f);
+    size_t x = 0;
+    for (; x + LUMA_BLOCK / 2 <= width; x += LUMA_BLOCK / 2)
+    {
+        const float *p = (const float *)(src + x * 4);
+        uint32x4_t lo = vcvtq_u32_f32(
+            vminq_f32(vmaxq_f32(vld1q_f32(p), zero), full)
+        );
+        uint32x4_t hi = vcvtq_u32_f32(
+            vminq_f32(vmaxq_f32(vld1q_f32(p + 4), zero), full)
+        );
+        vst1_u8(
+            dst + x, vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)))
+        );
+    }
+    tail_f32(src, x, width, dst);
+}
+
+#else
+
+static void row_1(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_1(src, 0, width, dst);
+}
+
+static void row_1_packed(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_1_packed(src, 0, width, dst);
+}
+
+static void row_rgb(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_rgb(src, 0, width, dst);
+}
+
+static void row_rgbx(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_rgbx(src, 0, width, dst);
+}
+
+static void row_cmyk(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_cmyk(src, 0, width, dst);
+}
+
+static void row_band0(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_band0(src, 0, width, dst);
+}
+
+static void row_i32(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_i32(src, 0, width, dst);
+}
+
+static void row_f32(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    tail_f32(src, 0, width, dst);
+}
+
+#endif
+
+#if defined(MOCR_AVX2)
+
+/* The number of pixels handled per iteration by the AVX2 kernels */
+#define LUMA_BLOCK_AVX2 32
+
+/**
+ * @brief Computes the luma of 8 pixels stored in the low 3 bytes of each
+ * 32-bit lane. See luma_sse2().
+ *
+ * @param px The pixels with red in the lowest byte of each lane
+ * @return The luma of each pixel in the 32-bit lanes
+ */
+MOCR_TARGET_AVX2
+static inline __m256i luma_avx2(__m256i px)
+{
+    const __m256i mask_rb = _mm256_set1_epi32(0x00FF00FF);
+    const __m256i mask_g = _mm256_set1_epi32(0x000000FF);
+    const __m256i weight_rb =
+        _mm256_set1_epi32((LUMA_WEIGHT_B << 16) | LUMA_WEIGHT_R);
+    const __m256i weight_g = _mm256_set1_epi32(LUMA_WEIGHT_G / 2);
+    const __m256i bias = _mm256_set1_epi32(LUMA_ROUND);
+
+    __m256i rb = _mm256_and_si256(px, mask_rb);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(px, 8), mask_g);
+    __m256i sum = _mm256_madd_epi16(rb, weight_rb);
+    sum = _mm256_add_epi32(
+        sum, _mm256_slli_epi32(_mm256_madd_epi16(g, weight_g), 1)
+    );
+    sum = _mm256_add_epi32(sum, bias);
+    return _mm256_srli_epi32(sum, LUMA_SHIFT);
+}
+
+/**
+ * @brief Packs 32 values between 0 and 255 held in 32-bit lanes into bytes
+ * and stores them
+ *
+ * @param dst Where to store the 32 bytes
+ * @param a Values 0-7
+ * @param b Values 8-15
+ * @param c Values 16-23
+ * @param d Values 24-31
+ */
+MOCR_TARGET_AVX2
+static inline void store_u8_avx2(
+    uint8_t *dst, __m256i a, __m256i b, __m256i c, __m256i d)
+{
+    /* Packing works within 128-bit lanes, so the result is put back in order
+     * with a permute */
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i lo = _mm256_packs_epi32(a, b);
+    __m256i hi = _mm256_packs_epi32(c, d);
+    __m256i packed = _mm256_packus_epi16(lo, hi);
+    _mm256_storeu_si256(
+        (__m256i *)dst, _mm256_permutevar8x32_epi32(packed, order)
+    );
+}
+
+/**
+ * @brief Loads 8 three byte pixels into the low 3 bytes of each 32-bit lane.
+ * 4 bytes past the last pixel are read, so they must be within the buffer.
+ *
+ * @param p The first pixel
+ * @return The pixels
+ */
+MOCR_TARGET_AVX2
+static inline __m256i load_rgb_avx2(const uint8_t *p)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+    );
+    __m256i v = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+        _mm_loadu_si128((const __m128i *)(p + 12)),
+        1
+    );
+    return _mm256_shuffle_epi8(v, shuffle);
+}
+
+MOCR_TARGET_AVX2
+static void row_rgb_avx2(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    /* The last load of a block reads 4 bytes past the end of the block */
+    for (; (x + LUMA_BLOCK_AVX2) * 3 + 4 <= width * 3; x += LUMA_BLOCK_AVX2)
+    {
+        const uint8_t *p = src + x * 3;
+        store_u8_avx2(
+            dst + x,
+            luma_avx2(load_rgb_avx2(p + 0)),
+            luma_avx2(load_rgb_avx2(p + 24)),
+            luma_avx2(load_rgb_avx2(p + 48)),
+            luma_avx2(load_rgb_avx2(p + 72))
+        );
+    }
+    row_rgb(src + x * 3, width - x, dst + x);
+}
+
+MOCR_TARGET_AVX2
+static void row_rgbx_avx2(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK_AVX2 <= width; x += LUMA_BLOCK_AVX2)
+    {
+        const __m256i *p = (const __m256i *)(src + x * 4);
+        store_u8_avx2(
+            dst + x,
+            luma_avx2(_mm256_loadu_si256(p + 0)),
+            luma_avx2(_mm256_loadu_si256(p + 1)),
+            luma_avx2(_mm256_loadu_si256(p + 2)),
+            luma_avx2(_mm256_loadu_si256(p + 3))
+        );
+    }
+    row_rgbx(src + x * 4, width - x, dst + x);
+}
+
+MOCR_TARGET_AVX2
+static void row_i32_avx2(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    size_t x = 0;
+    for (; x + LUMA_BLOCK_AVX2 <= width; x += LUMA_BLOCK_AVX2)
+    {
+        const __m256i *p = (const __m256i *)(src + x * 4);
+        store_u8_avx2(
+            dst + x,
+            _mm256_loadu_si256(p + 0),
+            _mm256_loadu_si256(p + 1),
+            _mm256_loadu_si256(p + 2),
+            _mm256_loadu_si256(p + 3)
+        );
+    }
+    row_i32(src + x * 4, width - x, dst + x);
+}
+
+/**
+ * @brief Whether or not the CPU supports AVX2
+ *
+ * @return nonzero if AVX2 is supported
+ */
+static int has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+static void row_copy(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    memcpy(dst, src, width);
+}
+
+static void row_hsv(const uint8_t *src, size_t width, uint8_t *dst)
+{
+    for (size_t x = 0; x < width; ++x)
+    {
+        dst[x] = hsv_luma(src + x * 3);
+    }
+}
+
+/**
+ * @brief Gets the kernel that converts a row of a mode to luma
+ *
+ * @param mode The mode to convert
+ * @return The kernel, NULL if the mode is invalid
+ */
+static row_kernel mode_to_kernel(mocr_mode mode)
+{
+    switch (mode)
+    {
+        case mocr_mode_1:
+            return row_1;
+
+        case mocr_mode_1_packed:
+            return row_1_packed;
+
+        case mocr_mode_L:
+        case mocr_mode_P:
+            return row_copy;
+
+        case mocr_mode_RGB:
+#if defined(MOCR_AVX2)
+            if (has_avx2())
+            {
+                return row_rgb_avx2;
+            }
+#endif
+            return row_rgb;
+
+        case mocr_mode_RGBA:
+#if defined(MOCR_AVX2)
+            if (has_avx2())
+            {
+                return row_rgbx_avx2;
+            }
+#endif
+            return row_rgbx;
+
+        case mocr_mode_CMYK:
+            return row_cmyk;
+
+        case mocr_mode_YCbCr:
+        case mocr_mode_LAB:
+            return row_band0;
+
+        case mocr_mode_HSV:
+            return row_hsv;
+
+        case mocr_mode_I:
+#if defined(MOCR_AVX2)
+            if (has_avx2())
+            {
+                return row_i32_avx2;
+            }
+#endif
+            return row_i32;
+
+        case mocr_mode_F:
+            return row_f32;
+    }
+    return NULL;
+}
+
+int mocr_image_luma_supported(mocr_mode mode)
+{
+    return mode_to_kernel(mode) != NULL;
+}
+
+int mocr_image_to_luma(
+    const void *src,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode,
+    uint8_t *dst)
+{
+    row_kernel kernel = mode_to_kernel(mode);
+    if (kernel == NULL)
+    {
+        return -1;
+    }
+
+    const uint8_t *row = src;
+    for (size_t y = 0; y < height; ++y, row += stride, dst += width)
+    {
+        kernel(row, width, dst);
+    }
+    return 0;
+}
+
+/**
+ * @brief PIL's bilinear filter
+ *
+ * @param x The distance from the center of the filter
+ * @return The weight at x
+ */
+static double bilinear_filter(double x)
+{
+    if (x < 0.0)
+    {
+        x = -x;
+    }
+    if (x < 1.0)
+    {
+        return 1.0 - x;
+    }
+    return 0.0;
+}
+
+/**
+ * @brief Computes the fixed point filter coefficients for resizing along one
+ * axis. This is a port of precompute_coeffs() and normalize_coeffs_8bpc() from
+ * PIL's Resample.c.
+ *
+ * @param in_size The size of the axis in the source image
+ * @param out_size The size of the axis in the destination image
+ * @param[out] bounds_out The first source pixel and number of source pixels
+ *                        used by each destination pixel. Must be freed.
+ * @param[out] kk_out The coefficients of each destination pixel. Must be freed.
+ * @return The number of coefficients per destination pixel, 0 on error
+ */
+static size_t precompute_coeffs(
+    size_t in_size, size_t out_size, int **bounds_out, int32_t **kk_out)
+{
+    double scale = (double)in_size / out_size;
+    double filterscale = scale < 1.0 ? 1.0 : scale;
+    double support = 1.0 * filterscale;
+    size_t ksize = (size_t)ceil(support) * 2 + 1;
+
+    int *bounds = malloc(out_size * 2 * sizeof(int));
+    int32_t *kk = malloc(out_size * ksize * sizeof(int32_t));
+    double *k = malloc(ksize * sizeof(double));
+    if (bounds == NULL || kk == NULL || k == NULL)
+    {
+        free(bounds);
+        free(kk);
+        free(k);
+        return 0;
+    }
+
+    for (size_t xx = 0; xx < out_size; ++xx)
+    {
+        double center = (xx + 0.5) * scale;
+        double ww = 0.0;
+        double ss = 1.0 / filterscale;
+
+        int xmin = (int)(center - support + 0.5);
+        if (xmin < 0)
+        {
+            xmin = 0;
+        }
+        int xmax = (int)(center + support + 0.5);
+        if (xmax > (int)in_size)
+        {
+            xmax = (int)in_size;
+        }
+        xmax -= xmin;
+
+        int x;
+        for (x = 0; x < xmax; ++x)
+        {
+            double w = bilinear_filter((x + xmin - center + 0.5) * ss);
+            k[x] = w;
+            ww += w;
+        }
+        for (x = 0; x < xmax; ++x)
+        {
+            if (ww != 0.0)
+            {
+                k[x] /= ww;
+            }
+        }
+        for (; x < (int)ksize; ++x)
+        {
+            k[x] = 0.0;
+        }
+
+        for (x = 0; x < (int)ksize; ++x)
+        {
+            kk[xx * ksize + x] = k[x] < 0 ?
+                (int32_t)(-0.5 + k[x] * (1 << PRECISION_BITS)) :
+                (int32_t)(0.5 + k[x] * (1 << PRECISION_BITS));
+        }
+        bounds[xx * 2 + 0] = xmin;
+        bounds[xx * 2 + 1] = xmax;
+    }
+    free(k);
+
+    *bounds_out = bounds;
+    *kk_out = kk;
+    return ksize;
+}
+
+/**
+ * @brief Clamps a fixed point accumulator to an 8-bit value
+ *
+ * @param in The accumulator
+ * @return The clamped value
+ */
+static inline uint8_t clip8(int32_t in)
+{
+    if (in >= (1 << PRECISION_BITS << 8))
+    {
+        return 255;
+    }
+    if (in <= 0)
+    {
+        return 0;
+    }
+    return (uint8_t)(in >> PRECISION_BITS);
+}
+
+int mocr_image_resize(
+    const uint8_t *src,
+    size_t src_width,
+    size_t src_height,
+    size_t src_stride,
+    uint8_t *dst,
+    size_t dst_width,
+    size_t dst_height)
+{
+    int ret = -1;
+    int *bounds_horiz = NULL;
+    int *bounds_vert = NULL;
+    int32_t *kk_horiz = NULL;
+    int32_t *kk_vert = NULL;
+    uint8_t *tmp = NULL;
+
+    size_t ksize_horiz =
+        precompute_coeffs(src_width, dst_width, &bounds_horiz, &kk_horiz);
+    size_t ksize_vert =
+        precompute_coeffs(src_height, dst_height, &bounds_vert, &kk_vert);
+    if (ksize_horiz == 0 || ksize_vert == 0)
+    {
+        goto cleanup;
+    }
+
+    /* Only the source rows used by the vertical pass are resized
+     * horizontally */
+    size_t ybox_first = bounds_vert[0];
+    size_t ybox_last =
+        bounds_vert[dst_height * 2 - 2] + bounds_vert[dst_height * 2 - 1];
+    int need_horizontal = src_width != dst_width;
+    int need_vertical = src_height != dst_height;
+
+    if (need_horizontal)
+    {
+        size_t rows = ybox_last - ybox_first;
+        for (size_t yy = 0; yy < dst_height; ++yy)
+        {
+            bounds_vert[yy * 2] -= (int)ybox_first;
+        }
+        tmp = malloc(dst_width * rows);
+        if (tmp == NULL)
+        {
+            goto cleanup;
+        }
+        for (size_t yy = 0; yy < rows; ++yy)
+        {
+            const uint8_t *in = src + (yy + ybox_first) * src_stride;
+            uint8_t *out = tmp + yy * dst_width;
+            for (size_t xx = 0; xx < dst_width; ++xx)
+            {
+                int xmin = bounds_horiz[xx * 2 + 0];
+                int xmax = bounds_horiz[xx * 2 + 1];
+                const int32_t *k = &kk_horiz[xx * ksize_horiz];
+                int32_t ss = 1 << (PRECISION_BITS - 1);
+                for (int x = 0; x < xmax; ++x)
+                {
+                    ss += in[x + xmin] * k[x];
+                }
+                out[xx] = clip8(ss);
+            }
+        }
+        src = tmp;
+        src_stride = dst_width;
+    }
+
+    if (need_vertical)
+    {
+        for (size_t yy = 0; yy < dst_height; ++yy)
+        {
+            int ymin = bounds_vert[yy * 2 + 0];
+            int ymax = bounds_vert[yy * 2 + 1];
+            const int32_t *k = &kk_vert[yy * ksize_vert];
+            uint8_t *out = dst + yy * dst_width;
+            for (size_t xx = 0; xx < dst_width; ++xx)
+            {
+                int32_t ss = 1 << (PRECISION_BITS - 1);
+                for (int y = 0; y < ymax; ++y)
+                {
+                    ss += src[(y + ymin) * src_stride + xx] * k[y];
+                }
+                out[xx] = clip8(ss);
+            }
+        }
+    }
+    else
+    {
+        for (size_t yy = 0; yy < dst_height; ++yy)
+        {
+            memcpy(dst + yy * dst_width, src + yy * src_stride, dst_width);
+        }
+    }
+    ret = 0;
+
+cleanup:
+    free(tmp);
+    free(bounds_horiz);
+    free(bounds_vert);
+    free(kk_horiz);
+    free(kk_vert);
+
+    return ret;
+}
+
+void mocr_image_normalize(
+    const uint8_t *src,
+    size_t count,
+    const float lut[MOCR_IMAGE_CHANNELS][256],
+    float *dst)
+{
+    for (int c = 0; c < MOCR_IMAGE_CHANNELS; ++c, dst += count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            dst[i] = lut[c][src[i]];
+        }
+    }
+}
@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIBMOCR_IMAGE_H
+#define LIBMOCR_IMAGE_H
+
+/* Pixel processing done in C without touching Python. Not part of the public
+ * API. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mocr.h"
+
+/* The number of channels in the tensor the model takes as input */
+#define MOCR_IMAGE_CHANNELS 3
+
+/**
+ * @brief Whether or not mocr_image_to_luma() can convert a mode
+ *
+ * @param mode The mode to check
+ * @return nonzero if the mode is supported, 0 otherwise
+ */
+int mocr_image_luma_supported(mocr_mode mode);
+
+/**
+ * @brief Converts image data to 8-bit luma using the same weights as PIL's
+ * convert('L')
+ *
+ * @param src The image data
+ * @param width The width of the image in pixels
+ * @param height The height of the image in pixels
+ * @param stride The number of bytes between the start of each row
+ * @param mode The format of the image data
+ * @param[out] dst A buffer of width * height bytes to store the luma in
+ * @return 0 on success, nonzero if the mode isn't supported
+ */
+int mocr_image_to_luma(
+    const void *src,
+    size_t width,
+    size_t height,
+    size_t stride,
+    mocr_mode mode,
+    uint8_t *dst);
+
+/**
+ * @brief Resizes an 8-bit image with the same algorithm and rounding as PIL's
+ * resize() using the bilinear filter
+ *
+ * @param src The image data
+ * @param src_width The width of the source image in pixels
+ * @param src_height The height of the source image in pixels
+ * @param src_stride The number of bytes between the start of each source row
+ * @param[out] dst A buffer of dst_width * dst_height bytes
+ * @param dst_width The width to resize to
+ * @param dst_height The height to resize to
+ * @return 0 on success, nonzero if memory couldn't be allocated
+ */
+int mocr_image_resize(
+    const uint8_t *src,
+    size_t src_width,
+    size_t src_height,
+    size_t src_stride,
+    uint8_t *dst,
+    size_t dst_width,
+    size_t dst_height);
+
+/**
+ * @brief Expands 8-bit luma into a planar float tensor, mapping every value of
+ * each channel through a lookup table
+ *
+ * @param src The luma values
+ * @param count The number of values in src
+ * @param lut The value of each channel for each luma value
+ * @param[out] dst A buffer of MOCR_IMAGE_CHANNELS * count floats
+ */
+void mocr_image_normalize(
+    const uint8_t *src,
+    size_t count,
+    const float lut[MOCR_IMAGE_CHANNELS][256],
+    float *dst);
+
+#endif // LIBMOCR_IMAGE_H
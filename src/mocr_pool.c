@@ -0,0 +1,331 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "mocr.h"
+#include "mocr_thread.h"
+
+#include <stdlib.h>
+
+#define NSEC_PER_USEC 1000
+
+/* The low 32 bits of the free list head hold the index of the top slot plus
+ * one, 0 if the list is empty. The high 32 bits are incremented by every push
+ * and pop so a stale head never compares equal (the ABA problem). */
+#define HEAD_INDEX_MASK 0xFFFFFFFFull
+#define HEAD_TAG_ONE    (HEAD_INDEX_MASK + 1)
+
+/* A context in a pool */
+typedef struct pool_slot
+{
+    /* The context */
+    mocr_ctx *ctx;
+
+    /* The index of the next free slot plus one, 0 if this is the last */
+    volatile uint64_t next;
+
+    /* The number of times the context has been checked out */
+    volatile uint64_t checkouts;
+
+    /* The total time in nanoseconds the context has spent checked out */
+    volatile uint64_t busy_ns;
+
+    /* The time the context was checked out at, 0 if it is idle */
+    volatile uint64_t acquired_at;
+}
+pool_slot;
+
+/**
+ * @brief The definition of the pool object
+ */
+struct mocr_pool
+{
+    /* The top of the lock-free stack of idle slots */
+    volatile uint64_t head;
+
+    /* The number of threads waiting for a slot. Releasing only takes the mutex
+     * when this is nonzero. */
+    volatile uint64_t waiters;
+
+    /* Used with released to wait for a slot */
+    mocr_mutex mutex;
+
+    /* Signaled when a slot is released while threads are waiting */
+    mocr_cond released;
+
+    /* The number of slots */
+    size_t size;
+
+    /* The slots */
+    pool_slot *slots;
+};
+
+/**
+ * @brief Pushes a slot onto the free list
+ *
+ * @param pool The pool
+ * @param index The index of the slot
+ */
+static void push_slot(mocr_pool *pool, size_t index)
+{
+    uint64_t head = mocr_atomic_load(&pool->head);
+    uint64_t top;
+    do
+    {
+        mocr_atomic_store(&pool->slots[index].next, head & HEAD_INDEX_MASK);
+        top = ((head & ~HEAD_INDEX_MASK) + HEAD_TAG_ONE) | (index + 1);
+    }
+    while (!mocr_atomic_cas(&pool->head, &head, top));
+}
+
+/**
+ * @brief Pops a slot off the free list
+ *
+ * @param pool The pool
+ * @return The index of the slot, pool->size if the free list is empty
+ */
+static size_t pop_slot(mocr_pool *pool)
+{
+    uint64_t head = mocr_atomic_load(&pool->head);
+    uint64_t top;
+    do
+    {
+        uint64_t index = head & HEAD_INDEX_MASK;
+        if (index == 0)
+        {
+            return pool->size;
+        }
+        uint64_t next = mocr_atomic_load(&pool->slots[index - 1].next);
+        top = ((head & ~HEAD_INDEX_MASK) + HEAD_TAG_ONE) | next;
+    }
+    while (!mocr_atomic_cas(&pool->head, &head, top));
+
+    return (size_t)(head & HEAD_INDEX_MASK) - 1;
+}
+
+mocr_pool *mocr_pool_create(const char *model, int force_cpu, size_t size)
+{
+    if (size == 0 || size >= HEAD_INDEX_MASK)
+    {
+        return NULL;
+    }
+
+    mocr_pool *pool = calloc(1, sizeof(mocr_pool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->slots = calloc(size, sizeof(pool_slot));
+    if (pool->slots == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    if (mocr_mutex_init(&pool->mutex))
+    {
+        goto error_slots;
+    }
+    if (mocr_cond_init(&pool->released))
+    {
+        goto error_mutex;
+    }
+
+    /* Every context shares the model loaded by the first */
+    for (pool->size = 0; pool->size < size; ++pool->size)
+    {
+        mocr_ctx *ctx = mocr_init(model, force_cpu);
+        if (ctx == NULL)
+        {
+            goto error_ctxs;
+        }
+        pool->slots[pool->size].ctx = ctx;
+    }
+    for (size_t i = size; i-- > 0;)
+    {
+        push_slot(pool, i);
+    }
+
+    return pool;
+
+error_ctxs:
+    for (size_t i = 0; i < pool->size; ++i)
+    {
+        mocr_destroy(pool->slots[i].ctx);
+    }
+    mocr_cond_destroy(&pool->released);
+error_mutex:
+    mocr_mutex_destroy(&pool->mutex);
+error_slots:
+    free(pool->slots);
+    free(pool);
+
+    return NULL;
+}
+
+int mocr_pool_destroy(mocr_pool *pool)
+{
+    if (pool == NULL)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < pool->size; ++i)
+    {
+        if (mocr_atomic_load(&pool->slots[i].acquired_at))
+        {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < pool->size; ++i)
+    {
+        mocr_destroy(pool->slots[i].ctx);
+    }
+    mocr_cond_destroy(&pool->released);
+    mocr_mutex_destroy(&pool->mutex);
+    free(pool->slots);
+    free(pool);
+
+    return 0;
+}
+
+size_t mocr_pool_size(mocr_pool *pool)
+{
+    if (pool == NULL)
+    {
+        return 0;
+    }
+    return pool->size;
+}
+
+mocr_ctx *mocr_pool_context(mocr_pool *pool, size_t index)
+{
+    if (pool == NULL || index >= pool->size)
+    {
+        return NULL;
+    }
+    return pool->slots[index].ctx;
+}
+
+mocr_ctx *mocr_pool_acquire(mocr_pool *pool, int64_t timeout_us)
+{
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    size_t index = pop_slot(pool);
+    if (index == pool->size && timeout_us != 0)
+    {
+        /* A timeout too long to represent waits forever */
+        uint64_t deadline = UINT64_MAX;
+        if (timeout_us > 0)
+        {
+            uint64_t now = mocr_time_now();
+            if ((uint64_t)timeout_us < (UINT64_MAX - now) / NSEC_PER_USEC)
+            {
+                deadline = now + (uint64_t)timeout_us * NSEC_PER_USEC;
+            }
+        }
+
+        /* Waiters are counted before the free list is checked again, so a
+         * release either hands over a slot here or sees the waiter and
+         * signals it */
+        mocr_mutex_lock(&pool->mutex);
+        mocr_atomic_add(&pool->waiters, 1);
+        while ((index = pop_slot(pool)) == pool->size)
+        {
+            if (timeout_us < 0)
+            {
+                mocr_cond_wait(&pool->released, &pool->mutex);
+            }
+            else if (mocr_time_now() < deadline)
+            {
+                mocr_cond_timedwait(&pool->released, &pool->mutex, deadline);
+            }
+            else
+            {
+                break;
+            }
+        }
+        mocr_atomic_add(&pool->waiters, (uint64_t)-1);
+        mocr_mutex_unlock(&pool->mutex);
+    }
+    if (index == pool->size)
+    {
+        return NULL;
+    }
+
+    pool_slot *slot = &pool->slots[index];
+    mocr_atomic_add(&slot->checkouts, 1);
+    mocr_atomic_store(&slot->acquired_at, mocr_time_now());
+    return slot->ctx;
+}
+
+int mocr_pool_release(mocr_pool *pool, mocr_ctx *ctx)
+{
+    if (pool == NULL)
+    {
+        return -1;
+    }
+    size_t index = 0;
+    while (index < pool->size && pool->slots[index].ctx != ctx)
+    {
+        ++index;
+    }
+    if (index == pool->size)
+    {
+        return -1;
+    }
+
+    /* Only one of several releases of the same context claims it, so the
+     * slot is never pushed onto the free list twice */
+    pool_slot *slot = &pool->slots[index];
+    uint64_t acquired_at = mocr_atomic_load(&slot->acquired_at);
+    do
+    {
+        if (acquired_at == 0)
+        {
+            return -1;
+        }
+    }
+    while (!mocr_atomic_cas(&slot->acquired_at, &acquired_at, 0));
+    mocr_atomic_add(&slot->busy_ns, mocr_time_now() - acquired_at);
+
+    push_slot(pool, index);
+    if (mocr_atomic_load(&pool->waiters))
+    {
+        mocr_mutex_lock(&pool->mutex);
+        mocr_cond_signal(&pool->released);
+        mocr_mutex_unlock(&pool->mutex);
+    }
+    return 0;
+}
+
+int mocr_pool_get_stats(mocr_pool *pool, size_t index, mocr_pool_stats *stats)
+{
+    if (pool == NULL || index >= pool->size)
+    {
+        return -1;
+    }
+
+    pool_slot *slot = &pool->slots[index];
+    stats->checkouts = mocr_atomic_load(&slot->checkouts);
+    stats->busy_us = mocr_atomic_load(&slot->busy_ns) / NSEC_PER_USEC;
+    stats->busy = mocr_atomic_load(&slot->acquired_at) != 0;
+    return 0;
+}
@@ -0,0 +1,1125 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* Python MUST be included before all else */
+#include "mocr_proc.h"
+
+#if defined(MOCR_HAVE_PROC)
+
+#include "mocr_image.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#if !defined(MAP_NORESERVE)
+#define MAP_NORESERVE 0
+#endif
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+/* The most bytes of text a worker can return, including the terminator */
+#define PROC_TEXT_SIZE 4096
+
+/* The most pixels of luma a slot can hold */
+#define PROC_IMAGE_SIZE (16 * 1024 * 1024)
+
+/* The number of slots per worker, so a worker has its next image ready */
+#define PROC_SLOTS_PER_WORKER 2
+
+/* Sent instead of a slot number to make a worker exit */
+#define PROC_STOP UINT32_MAX
+
+/* Shared memory objects can grow where memfd_create() is available */
+#if defined(MFD_CLOEXEC)
+#define MOCR_PROC_MEMFD
+#endif
+
+/* The part of a slot that lives in shared memory. The slot's pixels follow it
+ * on the next page. */
+typedef struct proc_shared_slot
+{
+    /* The size of the image in pixels */
+    uint64_t width;
+    uint64_t height;
+
+    /* Nonzero if text holds the result */
+    uint32_t ok;
+
+    /* The text read from the image */
+    char text[PROC_TEXT_SIZE];
+}
+proc_shared_slot;
+
+/* Every set of workers in the process. A new zygote closes the pipes of the
+ * others so it can't keep them open after they exit. Held while a worker's
+ * pipes are created so no zygote inherits the worker's ends of them. */
+static mocr_proc *g_procs;
+static mocr_mutex g_procsMutex = MOCR_MUTEX_INIT;
+
+/**
+ * @brief Gets the size of the part of a slot before its pixels, rounded up to
+ * a whole page so the pixels are page aligned
+ *
+ * @return The size in bytes
+ */
+static size_t slot_header_size(void)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (sizeof(proc_shared_slot) + page - 1) / page * page;
+}
+
+/**
+ * @brief Gets the size of a slot in shared memory. Slots are laid out one
+ * after another, so adding slots never moves the ones before them.
+ *
+ * @return The size in bytes, a whole number of pages
+ */
+static size_t slot_size(void)
+{
+    return slot_header_size() + (size_t)PROC_IMAGE_SIZE;
+}
+
+/**
+ * @brief Gets the part of a slot that lives in shared memory
+ *
+ * @param proc The set of workers
+ * @param index The slot number. The slot must be mapped.
+ * @return The shared slot
+ */
+static proc_shared_slot *shared_slot(mocr_proc *proc, size_t index)
+{
+    return (proc_shared_slot *)proc->slots[index].shm;
+}
+
+/**
+ * @brief Gets the pixels of a slot
+ *
+ * @param proc The set of workers
+ * @param index The slot number. The slot must be mapped.
+ * @return PROC_IMAGE_SIZE bytes of shared memory
+ */
+static uint8_t *slot_pixels(mocr_proc *proc, size_t index)
+{
+    return proc->slots[index].shm + slot_header_size();
+}
+
+/**
+ * @brief Maps a slot's shared memory into this process if it isn't yet
+ *
+ * @param proc The set of workers
+ * @param index The slot number. Its part of the shared memory object must
+ *              exist.
+ * @return 0 on success, nonzero on error
+ */
+static int map_slot(mocr_proc *proc, size_t index)
+{
+    mocr_proc_slot *slot = &proc->slots[index];
+    if (slot->shm || proc->shm_fd < 0)
+    {
+        return slot->shm ? 0 : -1;
+    }
+    void *shm = mmap(
+        NULL, slot_size(),
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        proc->shm_fd, (off_t)(index * slot_size())
+    );
+    if (shm == MAP_FAILED)
+    {
+        return -1;
+    }
+    slot->shm = shm;
+    return 0;
+}
+
+/**
+ * @brief Removes a set of workers from g_procs
+ *
+ * @param proc The set of workers
+ */
+static void unregister_proc(mocr_proc *proc)
+{
+    mocr_mutex_lock(&g_procsMutex);
+    mocr_proc **link = &g_procs;
+    while (*link != proc)
+    {
+        link = &(*link)->next;
+    }
+    *link = proc->next;
+    mocr_mutex_unlock(&g_procsMutex);
+}
+
+/**
+ * @brief Writes all of a buffer to a file descriptor
+ *
+ * @param fd The file descriptor
+ * @param buf The bytes to write
+ * @param size The number of bytes
+ * @return 0 on success, nonzero on error
+ */
+static int write_full(int fd, const void *buf, size_t size)
+{
+    const char *bytes = buf;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        bytes += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads exactly size bytes from a file descriptor
+ *
+ * @param fd The file descriptor
+ * @param[out] buf Receives the bytes
+ * @param size The number of bytes
+ * @return 0 on success, nonzero on error or end of file
+ */
+static int read_full(int fd, void *buf, size_t size)
+{
+    char *bytes = buf;
+    while (size > 0)
+    {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        bytes += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Creates a pipe that isn't inherited by programs the process executes
+ *
+ * @param[out] fds Receives the read and write ends
+ * @return 0 on success, nonzero on error
+ */
+static int create_pipe(int fds[2])
+{
+    if (pipe(fds))
+    {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+}
+
+/**
+ * @brief Closes a file descriptor if it's open
+ *
+ * @param fd The file descriptor, -1 if it isn't open
+ */
+static void close_fd(int *fd)
+{
+    if (*fd >= 0)
+    {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+/**
+ * @brief Unmaps the shared memory of every slot
+ *
+ * @param proc The set of workers
+ */
+static void unmap_slots(mocr_proc *proc)
+{
+    if (proc->shm)
+    {
+        munmap(proc->shm, proc->shm_size);
+    }
+    else if (proc->slots)
+    {
+        for (size_t i = 0; i < proc->capacity * PROC_SLOTS_PER_WORKER; ++i)
+        {
+            if (proc->slots[i].shm)
+            {
+                munmap(proc->slots[i].shm, slot_size());
+            }
+        }
+    }
+    close_fd(&proc->shm_fd);
+}
+
+/**
+ * @brief Closes the parent's ends of a worker's pipes
+ *
+ * @param worker The worker
+ */
+static void close_worker(mocr_proc_worker *worker)
+{
+    close_fd(&worker->request_fds[0]);
+    close_fd(&worker->request_fds[1]);
+    close_fd(&worker->response_fds[0]);
+    close_fd(&worker->response_fds[1]);
+}
+
+/**
+ * @brief Closes the parent's ends of every pipe and socket of a set of workers
+ *
+ * @param proc The set of workers
+ */
+static void close_proc(mocr_proc *proc)
+{
+    for (size_t i = 0; i < proc->count; ++i)
+    {
+        close_worker(&proc->workers[i]);
+    }
+    close_fd(&proc->control_fds[0]);
+    close_fd(&proc->wake_fds[0]);
+    close_fd(&proc->wake_fds[1]);
+}
+
+/**
+ * @brief Sends a new worker's ends of its pipes to the zygote
+ *
+ * @param sock The parent's end of the zygote's socket
+ * @param fds The read end of the request pipe and the write end of the
+ *            response pipe
+ * @return 0 on success, nonzero on error
+ */
+static int send_fds(int sock, const int fds[2])
+{
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    }
+    control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+
+    ssize_t n;
+    do
+    {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    }
+    while (n < 0 && errno == EINTR);
+    return n == 1 ? 0 : -1;
+}
+
+/**
+ * @brief Receives a new worker's ends of its pipes from the parent
+ *
+ * @param sock The zygote's end of its socket
+ * @param[out] fds Receives the read end of the request pipe and the write end
+ *                 of the response pipe
+ * @return 0 on success, nonzero on error or once the parent closes the socket
+ */
+static int recv_fds(int sock, int fds[2])
+{
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union
+    {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    }
+    control;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do
+    {
+        n = recvmsg(sock, &msg, 0);
+    }
+    while (n < 0 && errno == EINTR);
+    if (n != 1)
+    {
+        return -1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL ||
+        cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+    {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+    return 0;
+}
+
+/**
+ * @brief Reads the slots sent to a worker until it's told to stop. Runs in the
+ * worker process and never returns.
+ *
+ * @param proc The set of workers
+ * @param request_fd The read end of the worker's request pipe
+ * @param response_fd The write end of the worker's response pipe
+ * @param read Reads each image
+ * @param arg The argument passed to read
+ */
+static void work(
+    mocr_proc *proc,
+    int request_fd,
+    int response_fd,
+    mocr_proc_read_func read,
+    void *arg)
+{
+    PyEval_SaveThread();
+
+    for (;;)
+    {
+        uint32_t slot;
+        if (read_full(request_fd, &slot, sizeof(slot)) || slot == PROC_STOP)
+        {
+            break;
+        }
+
+        /* The parent fails the read if the slot can't be mapped */
+        if (slot >= proc->capacity * PROC_SLOTS_PER_WORKER ||
+            map_slot(proc, slot))
+        {
+            break;
+        }
+
+        proc_shared_slot *shared = shared_slot(proc, slot);
+        mocr_image image = {
+            slot_pixels(proc, slot),
+            (size_t)shared->width, (size_t)shared->height,
+            (size_t)shared->width,
+            mocr_mode_L
+        };
+        char *text = read(arg, &image);
+        size_t size = text ? strlen(text) + 1 : 0;
+        shared->ok = text != NULL && size <= PROC_TEXT_SIZE;
+        if (shared->ok)
+        {
+            memcpy(shared->text, text, size);
+        }
+        free(text);
+
+        if (write_full(response_fd, &slot, sizeof(slot)))
+        {
+            break;
+        }
+    }
+
+    /* Nothing the parent registered with atexit() may run here */
+    _exit(0);
+}
+
+/**
+ * @brief Forks a worker for every pair of pipe ends the parent sends until it
+ * closes the socket. Runs in the zygote process and never returns.
+ *
+ * @param proc The set of workers
+ */
+static void serve(mocr_proc *proc)
+{
+    /* Only keep the zygote's end of its own socket and its own set's slots */
+    for (mocr_proc *other = g_procs; other != NULL; other = other->next)
+    {
+        if (other != proc)
+        {
+            close_proc(other);
+            unmap_slots(other);
+        }
+    }
+    close_proc(proc);
+    int sock = proc->control_fds[1];
+
+    proc->init(proc->arg);
+
+    /* Hide everything loaded so far from the garbage collector, so collections
+     * in the workers don't write to the pages they share with the zygote */
+    PyObject *gc = PyImport_ImportModule("gc");
+    PyObject *ret = gc ? PyObject_CallMethod(gc, "freeze", NULL) : NULL;
+    Py_XDECREF(ret);
+    Py_XDECREF(gc);
+    PyErr_Clear();
+
+    /* Exited workers are reaped by the system */
+    signal(SIGCHLD, SIG_IGN);
+
+    int fds[2];
+    while (recv_fds(sock, fds) == 0)
+    {
+        /* Fork the way os.fork() does so the interpreter survives in the
+         * child. The zygote never released the GIL. */
+        PyOS_BeforeFork();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            PyOS_AfterFork_Child();
+            signal(SIGCHLD, SIG_DFL);
+            close(sock);
+            work(proc, fds[0], fds[1], proc->read, proc->arg);
+        }
+        PyOS_AfterFork_Parent();
+        close(fds[0]);
+        close(fds[1]);
+
+        int32_t reply = (int32_t)pid;
+        if (write_full(sock, &reply, sizeof(reply)))
+        {
+            break;
+        }
+    }
+
+    /* Wait for the workers so none is left for a parent that doesn't reap
+     * orphans. Each exits once the parent stops it or exits itself. */
+    while (wait(NULL) > 0 || errno == EINTR)
+    {
+    }
+    _exit(0);
+}
+
+/**
+ * @brief Marks a worker that exited and fails every unfinished slot sent to it
+ *
+ * @param proc The set of workers. The mutex must be held.
+ * @param index The number of the worker
+ */
+static void fail_worker(mocr_proc *proc, size_t index)
+{
+    mocr_proc_worker *worker = &proc->workers[index];
+    if (!worker->retiring)
+    {
+        --proc->active;
+    }
+    worker->alive = 0;
+    worker->retiring = 0;
+    worker->pending = 0;
+    --proc->alive;
+    for (size_t i = 0; i < proc->slot_count; ++i)
+    {
+        mocr_proc_slot *slot = &proc->slots[i];
+        if (slot->worker == index && !slot->done)
+        {
+            slot->done = 1;
+            slot->ok = 0;
+            slot->lost = 1;
+        }
+    }
+    mocr_cond_broadcast(&proc->done);
+    mocr_cond_broadcast(&proc->freed);
+}
+
+/**
+ * @brief Marks slots done as workers finish them until the set is stopped
+ *
+ * @param arg The set of workers
+ */
+static void collect(void *arg)
+{
+    mocr_proc *proc = arg;
+    struct pollfd *fds = proc->poll_fds;
+    size_t *workers = proc->poll_workers;
+
+    for (;;)
+    {
+        nfds_t count = 0;
+        fds[count].fd = proc->wake_fds[0];
+        fds[count].events = POLLIN;
+        ++count;
+        mocr_mutex_lock(&proc->mutex);
+        for (size_t i = 0; i < proc->count; ++i)
+        {
+            if (proc->workers[i].alive)
+            {
+                fds[count].fd = proc->workers[i].response_fds[0];
+                fds[count].events = POLLIN;
+                workers[count] = i;
+                ++count;
+            }
+        }
+        mocr_mutex_unlock(&proc->mutex);
+
+        if (poll(fds, count, -1) < 0)
+        {
+            continue;
+        }
+
+        for (nfds_t i = 1; i < count; ++i)
+        {
+            if (fds[i].revents == 0)
+            {
+                continue;
+            }
+            uint32_t index;
+            int ret = read_full(fds[i].fd, &index, sizeof(index));
+
+            mocr_mutex_lock(&proc->mutex);
+            if (ret || index >= proc->slot_count)
+            {
+                fail_worker(proc, workers[i]);
+            }
+            else
+            {
+                mocr_proc_slot *slot = &proc->slots[index];
+                slot->ok = shared_slot(proc, index)->ok != 0;
+                slot->done = 1;
+                --proc->workers[workers[i]].pending;
+                mocr_cond_broadcast(&proc->done);
+            }
+            mocr_mutex_unlock(&proc->mutex);
+        }
+
+        /* Workers were added or the set is stopping */
+        if (fds[0].revents)
+        {
+            char byte;
+            read_full(proc->wake_fds[0], &byte, 1);
+            mocr_mutex_lock(&proc->mutex);
+            int stopping = proc->stopping;
+            mocr_mutex_unlock(&proc->mutex);
+            if (stopping)
+            {
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Asks the zygote to fork a worker
+ *
+ * @param proc The set of workers
+ * @param worker A worker that isn't running. Its old pipes are closed.
+ * @return 0 on success, nonzero on error
+ */
+static int spawn_worker(mocr_proc *proc, mocr_proc_worker *worker)
+{
+    int ret = -1;
+
+    mocr_mutex_lock(&g_procsMutex);
+    close_worker(worker);
+    if (create_pipe(worker->request_fds) || create_pipe(worker->response_fds))
+    {
+        goto done;
+    }
+
+    int fds[2] = {worker->request_fds[0], worker->response_fds[1]};
+    int32_t pid;
+    if (send_fds(proc->control_fds[0], fds) ||
+        read_full(proc->control_fds[0], &pid, sizeof(pid)) ||
+        pid < 0)
+    {
+        goto done;
+    }
+    worker->pid = (pid_t)pid;
+    close_fd(&worker->response_fds[1]);
+    ret = 0;
+
+done:
+    if (ret)
+    {
+        close_worker(worker);
+    }
+    mocr_mutex_unlock(&g_procsMutex);
+    return ret;
+}
+
+/**
+ * @brief Forks the zygote of a set of workers
+ *
+ * @param proc The set of workers. The GIL must not be held.
+ * @return 0 on success, nonzero on error
+ */
+static int start_zygote(mocr_proc *proc)
+{
+    /* No other zygote may inherit either end of the socket */
+    mocr_mutex_lock(&g_procsMutex);
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, proc->control_fds))
+    {
+        mocr_mutex_unlock(&g_procsMutex);
+        return -1;
+    }
+    fcntl(proc->control_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(proc->control_fds[1], F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+    /* A zygote that died must not take the parent with it */
+    int on = 1;
+    setsockopt(
+        proc->control_fds[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on)
+    );
+#endif
+
+    /* Fork the way os.fork() does so the interpreter survives in the child */
+    PyGILState_STATE gstate = PyGILState_Ensure();
+    PyOS_BeforeFork();
+    proc->zygote = fork();
+    if (proc->zygote == 0)
+    {
+        PyOS_AfterFork_Child();
+        serve(proc);
+    }
+    PyOS_AfterFork_Parent();
+    PyGILState_Release(gstate);
+
+    close_fd(&proc->control_fds[1]);
+    if (proc->zygote < 0)
+    {
+        proc->zygote = 0;
+        close_fd(&proc->control_fds[0]);
+    }
+    mocr_mutex_unlock(&g_procsMutex);
+    return proc->zygote == 0 ? -1 : 0;
+}
+
+/**
+ * @brief Makes the zygote of a set of workers exit and waits for it. Its
+ * workers keep running.
+ *
+ * @param proc The set of workers
+ */
+static void stop_zygote(mocr_proc *proc)
+{
+    /* The zygote exits once its socket is closed */
+    close_fd(&proc->control_fds[0]);
+    while (proc->zygote > 0 &&
+        waitpid(proc->zygote, NULL, 0) < 0 && errno == EINTR)
+    {
+    }
+    proc->zygote = 0;
+}
+
+/**
+ * @brief Checks whether the zygote of a set of workers has died and cleans up
+ * after it if it has
+ *
+ * @param proc The set of workers
+ * @return Nonzero if the zygote has died
+ */
+static int reap_zygote(mocr_proc *proc)
+{
+    if (proc->zygote == 0)
+    {
+        return 1;
+    }
+    pid_t pid = waitpid(proc->zygote, NULL, WNOHANG);
+    if (pid == 0 || (pid < 0 && errno != ECHILD))
+    {
+        return 0;
+    }
+    close_fd(&proc->control_fds[0]);
+    proc->zygote = 0;
+    return 1;
+}
+
+int mocr_proc_start(
+    mocr_proc *proc,
+    size_t capacity,
+    mocr_proc_init_func init,
+    mocr_proc_read_func read,
+    void *arg)
+{
+    memset(proc, 0, sizeof(mocr_proc));
+    proc->control_fds[0] = proc->control_fds[1] = -1;
+    proc->wake_fds[0] = proc->wake_fds[1] = -1;
+    proc->shm_fd = -1;
+    proc->capacity = capacity;
+    proc->init = init;
+    proc->read = read;
+    proc->arg = arg;
+
+    size_t slot_capacity = capacity * PROC_SLOTS_PER_WORKER;
+    proc->workers = calloc(capacity, sizeof(mocr_proc_worker));
+    proc->slots = calloc(slot_capacity, sizeof(mocr_proc_slot));
+    proc->free_slots = calloc(slot_capacity, sizeof(size_t));
+    proc->poll_fds = calloc(capacity + 1, sizeof(struct pollfd));
+    proc->poll_workers = calloc(capacity + 1, sizeof(size_t));
+    if (proc->workers == NULL || proc->slots == NULL ||
+        proc->free_slots == NULL || proc->poll_fds == NULL ||
+        proc->poll_workers == NULL)
+    {
+        goto error_alloc;
+    }
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        mocr_proc_worker *worker = &proc->workers[i];
+        worker->request_fds[0] = worker->request_fds[1] = -1;
+        worker->response_fds[0] = worker->response_fds[1] = -1;
+    }
+
+    /* The zygote and the workers inherit the shared memory object and map
+     * the slots added by mocr_proc_resize() as they're sent them. Elsewhere an
+     * anonymous shared mapping holds the slots of every worker the set can
+     * have, and only pages that are touched are backed. */
+#if defined(MOCR_PROC_MEMFD)
+    proc->shm_fd = memfd_create("mocr_proc", MFD_CLOEXEC);
+    if (proc->shm_fd < 0)
+    {
+        goto error_alloc;
+    }
+#else
+    proc->shm_size = slot_capacity * slot_size();
+    proc->shm = mmap(
+        NULL, proc->shm_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1, 0
+    );
+    if (proc->shm == MAP_FAILED)
+    {
+        proc->shm = NULL;
+        goto error_alloc;
+    }
+    for (size_t i = 0; i < slot_capacity; ++i)
+    {
+        proc->slots[i].shm = proc->shm + i * slot_size();
+    }
+#endif
+
+    if (mocr_mutex_init(&proc->mutex))
+    {
+        goto error_alloc;
+    }
+    if (mocr_cond_init(&proc->freed))
+    {
+        goto error_mutex;
+    }
+    if (mocr_cond_init(&proc->done))
+    {
+        goto error_freed;
+    }
+
+    /* Registered first so zygotes of other sets close its pipes */
+    mocr_mutex_lock(&g_procsMutex);
+    proc->next = g_procs;
+    g_procs = proc;
+    mocr_mutex_unlock(&g_procsMutex);
+
+    if (create_pipe(proc->wake_fds) || start_zygote(proc))
+    {
+        goto error_fds;
+    }
+    if (mocr_thread_create(&proc->collector, collect, proc))
+    {
+        goto error_zygote;
+    }
+    return 0;
+
+error_zygote:
+    stop_zygote(proc);
+error_fds:
+    unregister_proc(proc);
+    close_fd(&proc->wake_fds[0]);
+    close_fd(&proc->wake_fds[1]);
+    mocr_cond_destroy(&proc->done);
+error_freed:
+    mocr_cond_destroy(&proc->freed);
+error_mutex:
+    mocr_mutex_destroy(&proc->mutex);
+error_alloc:
+    unmap_slots(proc);
+    free(proc->workers);
+    free(proc->slots);
+    free(proc->free_slots);
+    free(proc->poll_fds);
+    free(proc->poll_workers);
+
+    return -1;
+}
+
+/**
+ * @brief Adds slots until a set of workers has the given number. Slots are
+ * never taken away, so reads can keep using theirs.
+ *
+ * @param proc The set of workers. The mutex must not be held.
+ * @param count The number of slots to have
+ * @return 0 on success, nonzero on error
+ */
+static int add_slots(mocr_proc *proc, size_t count)
+{
+    /* Only this thread adds slots, and nothing uses them until they're free */
+    size_t first = proc->slot_count;
+    if (count <= first)
+    {
+        return 0;
+    }
+    if (proc->shm_fd >= 0 &&
+        ftruncate(proc->shm_fd, (off_t)(count * slot_size())))
+    {
+        return -1;
+    }
+    for (size_t i = first; i < count; ++i)
+    {
+        if (map_slot(proc, i))
+        {
+            return -1;
+        }
+    }
+
+    mocr_mutex_lock(&proc->mutex);
+    for (size_t i = first; i < count; ++i)
+    {
+        proc->free_slots[proc->free_count++] = i;
+    }
+    proc->slot_count = count;
+    mocr_cond_broadcast(&proc->freed);
+    mocr_mutex_unlock(&proc->mutex);
+    return 0;
+}
+
+int mocr_proc_resize(mocr_proc *proc, size_t count)
+{
+    int ret = 0;
+    int restarted = 0;
+    uint32_t stop = PROC_STOP;
+
+    if (count > proc->capacity)
+    {
+        return -1;
+    }
+    if (add_slots(proc, count * PROC_SLOTS_PER_WORKER))
+    {
+        return -1;
+    }
+
+    mocr_mutex_lock(&proc->mutex);
+
+    /* Retire the newest workers first. They get nothing after the stop. */
+    for (size_t i = proc->count; i-- > 0 && proc->active > count;)
+    {
+        mocr_proc_worker *worker = &proc->workers[i];
+        if (worker->alive && !worker->retiring)
+        {
+            worker->retiring = 1;
+            --proc->active;
+            write_full(worker->request_fds[1], &stop, sizeof(stop));
+        }
+    }
+
+    while (proc->active < count)
+    {
+        /* Reuse a worker that exited */
+        size_t index = 0;
+        while (index < proc->count && proc->workers[index].alive)
+        {
+            ++index;
+        }
+        if (index == proc->capacity)
+        {
+            ret = -1;
+            break;
+        }
+        if (index == proc->count)
+        {
+            ++proc->count;
+        }
+
+        /* Nothing else touches a worker that isn't running */
+        mocr_mutex_unlock(&proc->mutex);
+        int failed = spawn_worker(proc, &proc->workers[index]);
+        if (failed && !restarted && reap_zygote(proc))
+        {
+            restarted = 1;
+            failed = start_zygote(proc) ||
+                spawn_worker(proc, &proc->workers[index]);
+        }
+        mocr_mutex_lock(&proc->mutex);
+        if (failed)
+        {
+            ret = -1;
+            break;
+        }
+
+        mocr_proc_worker *worker = &proc->workers[index];
+        worker->alive = 1;
+        worker->retiring = 0;
+        worker->pending = 0;
+        ++proc->alive;
+        ++proc->active;
+    }
+
+    /* Reads waiting for a slot give up if no worker is left */
+    mocr_cond_broadcast(&proc->freed);
+    mocr_mutex_unlock(&proc->mutex);
+
+    /* The collector has to watch the new workers */
+    write_full(proc->wake_fds[1], "", 1);
+    return ret;
+}
+
+void mocr_proc_stop(mocr_proc *proc)
+{
+    mocr_proc_resize(proc, 0);
+
+    mocr_mutex_lock(&proc->mutex);
+    while (proc->alive)
+    {
+        mocr_cond_wait(&proc->freed, &proc->mutex);
+    }
+    proc->stopping = 1;
+    mocr_mutex_unlock(&proc->mutex);
+
+    write_full(proc->wake_fds[1], "", 1);
+    mocr_thread_join(proc->collector);
+    unregister_proc(proc);
+    stop_zygote(proc);
+
+    close_proc(proc);
+    mocr_cond_destroy(&proc->done);
+    mocr_cond_destroy(&proc->freed);
+    mocr_mutex_destroy(&proc->mutex);
+    unmap_slots(proc);
+    free(proc->workers);
+    free(proc->slots);
+    free(proc->free_slots);
+    free(proc->poll_fds);
+    free(proc->poll_workers);
+}
+
+int mocr_proc_read(mocr_proc *proc, const mocr_image *image, char **text)
+{
+    *text = NULL;
+    if (image->width > PROC_IMAGE_SIZE / image->height)
+    {
+        return -1;
+    }
+
+    mocr_mutex_lock(&proc->mutex);
+    while (proc->free_count == 0 && proc->active)
+    {
+        mocr_cond_wait(&proc->freed, &proc->mutex);
+    }
+    if (proc->active == 0)
+    {
+        mocr_mutex_unlock(&proc->mutex);
+        return -1;
+    }
+    size_t index = proc->free_slots[--proc->free_count];
+    mocr_mutex_unlock(&proc->mutex);
+
+    /* The luma goes straight into shared memory */
+    proc_shared_slot *shared = shared_slot(proc, index);
+    shared->width = image->width;
+    shared->height = image->height;
+    int failed = mocr_image_to_luma(
+        image->data,
+        image->width, image->height,
+        image->stride,
+        image->mode,
+        slot_pixels(proc, index)
+    );
+
+    int ret = 0;
+    mocr_mutex_lock(&proc->mutex);
+    mocr_proc_slot *slot = &proc->slots[index];
+    slot->done = 1;
+    slot->ok = 0;
+    slot->lost = 0;
+    if (!failed)
+    {
+        /* Send the image to the worker with the least to do. Workers can come
+         * and go while the luma is written. */
+        size_t worker = proc->count;
+        for (size_t i = 0; i < proc->count; ++i)
+        {
+            mocr_proc_worker *candidate = &proc->workers[i];
+            if (candidate->alive && !candidate->retiring &&
+                (worker == proc->count ||
+                candidate->pending < proc->workers[worker].pending))
+            {
+                worker = i;
+            }
+        }
+
+        uint32_t message = (uint32_t)index;
+        if (worker == proc->count ||
+            write_full(
+                proc->workers[worker].request_fds[1],
+                &message, sizeof(message)))
+        {
+            slot->lost = 1;
+        }
+        else
+        {
+            slot->worker = worker;
+            slot->done = 0;
+            ++proc->workers[worker].pending;
+        }
+    }
+    while (!slot->done)
+    {
+        mocr_cond_wait(&proc->done, &proc->mutex);
+    }
+
+    /* A worker that died takes the read with it, so it's read locally */
+    if (slot->lost)
+    {
+        ret = -1;
+    }
+    else if (slot->ok)
+    {
+        *text = strdup(shared->text);
+    }
+    proc->free_slots[proc->free_count++] = index;
+    mocr_cond_signal(&proc->freed);
+    mocr_mutex_unlock(&proc->mutex);
+
+    return ret;
+}
+
+#endif
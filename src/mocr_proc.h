@@ -0,0 +1,249 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIBMOCR_PROC_H
+#define LIBMOCR_PROC_H
+
+/* Reads images in forked worker processes. Workers are forked on demand by a
+ * zygote, a process forked once with everything already loaded, so they share
+ * its memory copy-on-write. Images and texts are passed through shared memory
+ * and only slot numbers go through pipes. Not part of the public API. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mocr.h"
+#include "mocr_thread.h"
+
+/* Worker processes need fork() */
+#if !defined(_WIN32)
+#define MOCR_HAVE_PROC
+#endif
+
+#if defined(MOCR_HAVE_PROC)
+
+#include <poll.h>
+#include <sys/types.h>
+
+/**
+ * @brief Called in the zygote right after it's forked, before any worker is
+ * forked from it
+ *
+ * @param arg The argument given to mocr_proc_start()
+ */
+typedef void (*mocr_proc_init_func)(void *arg);
+
+/**
+ * @brief Reads an image in a worker process
+ *
+ * @param arg The argument given to mocr_proc_start()
+ * @param image The image to read, always in mocr_mode_L
+ * @return The text read from the image, NULL on error. Freed with free().
+ */
+typedef char *(*mocr_proc_read_func)(void *arg, const mocr_image *image);
+
+/* A worker process as seen by the parent */
+typedef struct mocr_proc_worker
+{
+    /* The process ID of the worker. The zygote is its parent. */
+    pid_t pid;
+
+    /* The ends of the pipe slot numbers are sent to the worker on. The parent
+     * keeps the read end open so writing never raises SIGPIPE. */
+    int request_fds[2];
+
+    /* The ends of the pipe the worker sends finished slot numbers on */
+    int response_fds[2];
+
+    /* The number of slots sent to the worker that it hasn't finished */
+    size_t pending;
+
+    /* Nonzero while the worker is running */
+    int alive;
+
+    /* Nonzero once the worker has been told to exit. It's sent nothing new. */
+    int retiring;
+}
+mocr_proc_worker;
+
+/* The parent's view of a slot */
+typedef struct mocr_proc_slot
+{
+    /* The slot's shared memory as mapped in this process, NULL until it's
+     * mapped. Workers map the slots added after they were forked themselves. */
+    unsigned char *shm;
+
+    /* The worker the slot was sent to */
+    size_t worker;
+
+    /* Nonzero once the worker has finished the slot or died */
+    int done;
+
+    /* Nonzero if the text in shared memory is valid */
+    int ok;
+
+    /* Nonzero if the slot never reached a worker or its worker died */
+    int lost;
+}
+mocr_proc_slot;
+
+/* A set of worker processes */
+typedef struct mocr_proc
+{
+    /* The next set of workers in the process */
+    struct mocr_proc *next;
+
+    /* The process ID of the zygote */
+    pid_t zygote;
+
+    /* The ends of the socket the parent asks the zygote for workers on */
+    int control_fds[2];
+
+    /* What the zygote is started with */
+    mocr_proc_init_func init;
+    mocr_proc_read_func read;
+    void *arg;
+
+    /* The workers */
+    mocr_proc_worker *workers;
+
+    /* The most workers the set can have */
+    size_t capacity;
+
+    /* The number of workers that have been used, running or not */
+    size_t count;
+
+    /* The number of workers still running */
+    size_t alive;
+
+    /* The number of running workers that aren't retiring */
+    size_t active;
+
+    /* The shared memory object the slots live in, grown as workers are
+     * added. -1 where there isn't one, and shm holds every slot instead. */
+    int shm_fd;
+
+    /* The anonymous mapping holding every slot when there's no shm_fd */
+    unsigned char *shm;
+
+    /* The size of shm in bytes */
+    size_t shm_size;
+
+    /* The parent's view of each slot, enough for capacity workers */
+    mocr_proc_slot *slots;
+
+    /* The number of slots in use, which have shared memory */
+    size_t slot_count;
+
+    /* The slots no read is using */
+    size_t *free_slots;
+
+    /* The number of free slots */
+    size_t free_count;
+
+    /* Nonzero once the collector thread should exit */
+    int stopping;
+
+    /* Protects everything above. Requests are only written to workers while
+     * it's held. */
+    mocr_mutex mutex;
+
+    /* Broadcast when a slot is freed or a worker exits */
+    mocr_cond freed;
+
+    /* Broadcast when a slot is done */
+    mocr_cond done;
+
+    /* Written to make the collector thread look at the workers again */
+    int wake_fds[2];
+
+    /* What the collector thread polls, one more than capacity */
+    struct pollfd *poll_fds;
+
+    /* The worker each of poll_fds after the first belongs to */
+    size_t *poll_workers;
+
+    /* Waits for workers to finish slots */
+    mocr_thread collector;
+}
+mocr_proc;
+
+/**
+ * @brief Forks the zygote workers are forked from. It gets a copy of the
+ * interpreter and everything loaded in it, which it shares with every worker.
+ * No worker is running until mocr_proc_resize() is called. The GIL must not be
+ * held.
+ *
+ * @param proc The workers to start
+ * @param capacity The most worker processes the set can have. Shared memory
+ *                 is only added for the workers actually running, except
+ *                 where shared memory objects can't grow.
+ * @param init Called in the zygote right after it's forked
+ * @param read Reads images in the workers
+ * @param arg The argument passed to init and read
+ * @return 0 on success, nonzero on error
+ */
+int mocr_proc_start(
+    mocr_proc *proc,
+    size_t capacity,
+    mocr_proc_init_func init,
+    mocr_proc_read_func read,
+    void *arg);
+
+/**
+ * @brief Forks workers from the zygote or retires the newest ones until the
+ * given number are taking images. Retiring workers finish what they were sent
+ * before exiting. A zygote that died is replaced. Reads can run while this
+ * does, but it must not be called by two threads at once.
+ *
+ * @param proc The running workers
+ * @param count The number of workers to keep, at most the set's capacity
+ * @return 0 on success, nonzero if fewer workers could be forked
+ */
+int mocr_proc_resize(mocr_proc *proc, size_t count);
+
+/**
+ * @brief Lets the workers finish what they were sent, then waits for them and
+ * the zygote to exit and frees the resources of the set
+ *
+ * @param proc The workers to stop
+ */
+void mocr_proc_stop(mocr_proc *proc);
+
+/**
+ * @brief Reduces an image to luma in shared memory, then blocks until a worker
+ * has read it
+ *
+ * @param proc The running workers
+ * @param image The image to read. Its stride must not be 0.
+ * @param[out] text Receives the text read from the image, NULL on error.
+ *                  Must be freed with free().
+ * @return 0 if a worker read the image, nonzero if it's too large for a slot,
+ * no worker is taking images, or the worker couldn't be sent it or died
+ * before it finished, so it must be read some other way
+ */
+int mocr_proc_read(mocr_proc *proc, const mocr_image *image, char **text);
+
+#endif
+
+#endif // LIBMOCR_PROC_H
@@ -0,0 +1,226 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "mocr_sched.h"
+
+#include <stdlib.h>
+
+/**
+ * @brief Takes jobs off the queue and reads them in batches until the
+ * scheduler is stopped and the queue is empty
+ *
+ * @param arg The scheduler
+ */
+static void dispatch(void *arg)
+{
+    mocr_sched *sched = arg;
+
+    mocr_mutex_lock(&sched->mutex);
+    for (;;)
+    {
+        while (sched->head == NULL && !sched->stopping)
+        {
+            mocr_cond_wait(&sched->queued, &sched->mutex);
+        }
+        if (sched->head == NULL)
+        {
+            break;
+        }
+
+        /* Give the batch until the oldest job's wait is up to fill */
+        uint64_t deadline = sched->head->queued_at + sched->batch_wait;
+        while (sched->count < sched->batch_size && !sched->stopping &&
+            mocr_time_now() < deadline)
+        {
+            mocr_cond_timedwait(&sched->queued, &sched->mutex, deadline);
+        }
+
+        mocr_job *batch = sched->head;
+        mocr_job *job = batch;
+        size_t count = 0;
+        for (; count < sched->batch_size && job != NULL; ++count)
+        {
+            sched->images[count] = job->image;
+            sched->texts[count] = NULL;
+            job = job->next;
+        }
+        sched->head = job;
+        if (job == NULL)
+        {
+            sched->tail = NULL;
+        }
+        sched->count -= count;
+
+        /* Other threads can queue jobs while the batch is read */
+        mocr_mutex_unlock(&sched->mutex);
+        sched->func(sched->arg, sched->images, count, sched->texts);
+        mocr_mutex_lock(&sched->mutex);
+
+        job = batch;
+        for (size_t i = 0; i < count; ++i)
+        {
+            /* A submitted job may be gone once it's complete */
+            mocr_job *next = job->next;
+            job->text = sched->texts[i];
+            job->done = 1;
+            if (job->complete)
+            {
+                job->complete(job);
+            }
+            job = next;
+        }
+        mocr_cond_broadcast(&sched->done);
+    }
+    mocr_mutex_unlock(&sched->mutex);
+}
+
+int mocr_sched_start(
+    mocr_sched *sched,
+    size_t batch_size,
+    uint64_t batch_wait,
+    mocr_sched_func func,
+    void *arg)
+{
+    sched->head = NULL;
+    sched->tail = NULL;
+    sched->count = 0;
+    sched->batch_size = batch_size;
+    sched->batch_wait = batch_wait;
+    sched->stopping = 0;
+    sched->func = func;
+    sched->arg = arg;
+
+    sched->images = malloc(batch_size * sizeof(mocr_image));
+    sched->texts = malloc(batch_size * sizeof(char *));
+    if (sched->images == NULL || sched->texts == NULL)
+    {
+        goto error_alloc;
+    }
+    if (mocr_mutex_init(&sched->mutex))
+    {
+        goto error_alloc;
+    }
+    if (mocr_cond_init(&sched->queued))
+    {
+        goto error_mutex;
+    }
+    if (mocr_cond_init(&sched->done))
+    {
+        goto error_queued;
+    }
+    if (mocr_thread_create(&sched->thread, dispatch, sched))
+    {
+        goto error_done;
+    }
+    return 0;
+
+error_done:
+    mocr_cond_destroy(&sched->done);
+error_queued:
+    mocr_cond_destroy(&sched->queued);
+error_mutex:
+    mocr_mutex_destroy(&sched->mutex);
+error_alloc:
+    free(sched->images);
+    free(sched->texts);
+
+    return -1;
+}
+
+void mocr_sched_stop(mocr_sched *sched)
+{
+    mocr_mutex_lock(&sched->mutex);
+    sched->stopping = 1;
+    mocr_cond_signal(&sched->queued);
+    mocr_mutex_unlock(&sched->mutex);
+
+    mocr_thread_join(sched->thread);
+
+    mocr_cond_destroy(&sched->done);
+    mocr_cond_destroy(&sched->queued);
+    mocr_mutex_destroy(&sched->mutex);
+    free(sched->images);
+    free(sched->texts);
+}
+
+/**
+ * @brief Adds a job to the end of the queue
+ *
+ * @param sched The scheduler. The mutex must be held.
+ * @param job The job
+ * @return 0 on success, nonzero if the scheduler is stopping
+ */
+static int enqueue(mocr_sched *sched, mocr_job *job)
+{
+    if (sched->stopping)
+    {
+        return -1;
+    }
+    job->next = NULL;
+    job->queued_at = mocr_time_now();
+    job->text = NULL;
+    job->done = 0;
+    if (sched->tail)
+    {
+        sched->tail->next = job;
+    }
+    else
+    {
+        sched->head = job;
+    }
+    sched->tail = job;
+    ++sched->count;
+
+    /* The dispatcher only needs to wake up for a new batch or a full one */
+    if (sched->count == 1 || sched->count >= sched->batch_size)
+    {
+        mocr_cond_signal(&sched->queued);
+    }
+    return 0;
+}
+
+char *mocr_sched_read(mocr_sched *sched, const mocr_image *image)
+{
+    mocr_job job;
+    job.image = *image;
+    job.complete = NULL;
+
+    mocr_mutex_lock(&sched->mutex);
+    if (enqueue(sched, &job))
+    {
+        mocr_mutex_unlock(&sched->mutex);
+        return NULL;
+    }
+    while (!job.done)
+    {
+        mocr_cond_wait(&sched->done, &sched->mutex);
+    }
+    mocr_mutex_unlock(&sched->mutex);
+
+    return job.text;
+}
+
+int mocr_sched_submit(mocr_sched *sched, mocr_job *job)
+{
+    mocr_mutex_lock(&sched->mutex);
+    int ret = enqueue(sched, job);
+    mocr_mutex_unlock(&sched->mutex);
+    return ret;
+}
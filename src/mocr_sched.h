@@ -0,0 +1,164 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIBMOCR_SCHED_H
+#define LIBMOCR_SCHED_H
+
+/* Coalesces concurrent reads into batches run on a dispatcher thread. Not part
+ * of the public API. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mocr.h"
+#include "mocr_thread.h"
+
+/**
+ * @brief Reads a batch of images
+ *
+ * @param arg The argument given to mocr_sched_start()
+ * @param images The images to read
+ * @param count The number of images
+ * @param[out] texts An array of count elements to store the results in. Every
+ *                   element is NULL when called and is left NULL on error.
+ * @return 0 on success, nonzero on error
+ */
+typedef int (*mocr_sched_func)(
+    void *arg, const mocr_image *images, size_t count, char **texts);
+
+/* A read waiting to be batched. Lives on the stack of the thread reading,
+ * unless it was submitted with mocr_sched_submit(). */
+typedef struct mocr_job
+{
+    /* The next job in the queue */
+    struct mocr_job *next;
+
+    /* The image to read */
+    mocr_image image;
+
+    /* The time the job was queued at */
+    uint64_t queued_at;
+
+    /* The text read from the image, NULL on error */
+    char *text;
+
+    /* Nonzero once the job has been read */
+    int done;
+
+    /* Called on the dispatcher thread once a submitted job has been read,
+     * NULL for jobs queued by mocr_sched_read() */
+    void (*complete)(struct mocr_job *job);
+}
+mocr_job;
+
+/* The state of a scheduler */
+typedef struct mocr_sched
+{
+    /* Protects everything below */
+    mocr_mutex mutex;
+
+    /* Signaled when a job is queued or the scheduler is stopped */
+    mocr_cond queued;
+
+    /* Broadcast when a batch is done */
+    mocr_cond done;
+
+    /* The oldest queued job */
+    mocr_job *head;
+
+    /* The newest queued job */
+    mocr_job *tail;
+
+    /* The number of queued jobs */
+    size_t count;
+
+    /* The most jobs read in one batch */
+    size_t batch_size;
+
+    /* How long in nanoseconds the oldest job waits for a batch to fill */
+    uint64_t batch_wait;
+
+    /* Nonzero once the scheduler is stopping */
+    int stopping;
+
+    /* Reads each batch */
+    mocr_sched_func func;
+
+    /* The argument passed to func */
+    void *arg;
+
+    /* Scratch space for the images and texts of a batch */
+    mocr_image *images;
+    char **texts;
+
+    /* The dispatcher thread */
+    mocr_thread thread;
+}
+mocr_sched;
+
+/**
+ * @brief Starts a scheduler and its dispatcher thread
+ *
+ * @param sched The scheduler to start
+ * @param batch_size The most jobs to read in one batch
+ * @param batch_wait How long in nanoseconds the oldest job waits for a batch
+ *                   to fill before it's read anyway
+ * @param func Reads each batch on the dispatcher thread
+ * @param arg The argument passed to func
+ * @return 0 on success, nonzero on error
+ */
+int mocr_sched_start(
+    mocr_sched *sched,
+    size_t batch_size,
+    uint64_t batch_wait,
+    mocr_sched_func func,
+    void *arg);
+
+/**
+ * @brief Reads every queued job, then stops the dispatcher thread and frees
+ * the scheduler's resources
+ *
+ * @param sched The scheduler to stop
+ */
+void mocr_sched_stop(mocr_sched *sched);
+
+/**
+ * @brief Queues an image and blocks until the batch it's part of is read
+ *
+ * @param sched The scheduler to queue the image on
+ * @param image The image to read. It must stay valid until this returns.
+ * @return The text read from the image, NULL on error. Must be freed with
+ * free().
+ */
+char *mocr_sched_read(mocr_sched *sched, const mocr_image *image);
+
+/**
+ * @brief Queues a job without waiting for it. Its complete function is called
+ * on the dispatcher thread with the text set once the batch it's part of is
+ * read. It must return quickly, since the next batch waits for it.
+ *
+ * @param sched The scheduler to queue the job on
+ * @param job The job with its image and complete function set. It and the
+ *            image must stay valid until complete is called.
+ * @return 0 on success, nonzero if the scheduler is stopping
+ */
+int mocr_sched_submit(mocr_sched *sched, mocr_job *job);
+
+#endif // LIBMOCR_SCHED_H
@@ -0,0 +1,334 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+/* clock_gettime() and pthread_condattr_setclock() are POSIX, not C99, and
+ * syscall() is only declared with the GNU extensions */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "mocr_thread.h"
+
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if !defined(_WIN32)
+#include <time.h>
+#endif
+
+#define NSEC_PER_SEC    1000000000ull
+#define NSEC_PER_MSEC   1000000ull
+
+/* macOS can't wait on a condition variable with the monotonic clock */
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define MOCR_COND_MONOTONIC
+#endif
+
+/* The function and argument passed to a new thread */
+typedef struct thread_start
+{
+    mocr_thread_func func;
+    void *arg;
+} thread_start;
+
+#if defined(_WIN32)
+
+int mocr_mutex_init(mocr_mutex *mutex)
+{
+    InitializeSRWLock(mutex);
+    return 0;
+}
+
+void mocr_mutex_destroy(mocr_mutex *mutex)
+{
+    (void)mutex;
+}
+
+void mocr_mutex_lock(mocr_mutex *mutex)
+{
+    AcquireSRWLockExclusive(mutex);
+}
+
+void mocr_mutex_unlock(mocr_mutex *mutex)
+{
+    ReleaseSRWLockExclusive(mutex);
+}
+
+int mocr_cond_init(mocr_cond *cond)
+{
+    InitializeConditionVariable(cond);
+    return 0;
+}
+
+void mocr_cond_destroy(mocr_cond *cond)
+{
+    (void)cond;
+}
+
+void mocr_cond_wait(mocr_cond *cond, mocr_mutex *mutex)
+{
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+void mocr_cond_timedwait(mocr_cond *cond, mocr_mutex *mutex, uint64_t deadline)
+{
+    uint64_t now = mocr_time_now();
+    DWORD timeout = 0;
+    if (deadline > now)
+    {
+        /* Round up so the deadline has passed when this returns */
+        uint64_t ms = (deadline - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+        timeout = ms < INFINITE ? (DWORD)ms : INFINITE - 1;
+    }
+    SleepConditionVariableSRW(cond, mutex, timeout, 0);
+}
+
+void mocr_cond_signal(mocr_cond *cond)
+{
+    WakeConditionVariable(cond);
+}
+
+void mocr_cond_broadcast(mocr_cond *cond)
+{
+    WakeAllConditionVariable(cond);
+}
+
+static DWORD WINAPI thread_main(LPVOID param)
+{
+    thread_start start = *(thread_start *)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+int mocr_thread_create(mocr_thread *thread, mocr_thread_func func, void *arg)
+{
+    thread_start *start = malloc(sizeof(thread_start));
+    if (start == NULL)
+    {
+        return -1;
+    }
+    start->func = func;
+    start->arg = arg;
+
+    *thread = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+    if (*thread == NULL)
+    {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void mocr_thread_join(mocr_thread thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void mocr_futex_wait(volatile uint32_t *word, uint32_t expected)
+{
+    WaitOnAddress(word, &expected, sizeof(expected), INFINITE);
+}
+
+void mocr_futex_wake(volatile uint32_t *word)
+{
+    WakeByAddressAll((PVOID)word);
+}
+
+uint64_t mocr_time_now(void)
+{
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    uint64_t ticks = (uint64_t)counter.QuadPart;
+    uint64_t freq = (uint64_t)frequency.QuadPart;
+    return ticks / freq * NSEC_PER_SEC + ticks % freq * NSEC_PER_SEC / freq;
+}
+
+#else
+
+int mocr_mutex_init(mocr_mutex *mutex)
+{
+    return pthread_mutex_init(mutex, NULL);
+}
+
+void mocr_mutex_destroy(mocr_mutex *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+void mocr_mutex_lock(mocr_mutex *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void mocr_mutex_unlock(mocr_mutex *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+int mocr_cond_init(mocr_cond *cond)
+{
+#if defined(MOCR_COND_MONOTONIC)
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr))
+    {
+        return -1;
+    }
+    int ret = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (ret == 0)
+    {
+        ret = pthread_cond_init(cond, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+    return ret;
+#else
+    return pthread_cond_init(cond, NULL);
+#endif
+}
+
+void mocr_cond_destroy(mocr_cond *cond)
+{
+    pthread_cond_destroy(cond);
+}
+
+void mocr_cond_wait(mocr_cond *cond, mocr_mutex *mutex)
+{
+    pthread_cond_wait(cond, mutex);
+}
+
+void mocr_cond_timedwait(mocr_cond *cond, mocr_mutex *mutex, uint64_t deadline)
+{
+#if !defined(MOCR_COND_MONOTONIC)
+    /* Convert the deadline to the realtime clock the wait uses */
+    struct timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    uint64_t now = mocr_time_now();
+    deadline = deadline > now ? deadline - now : 0;
+    uint64_t real_now =
+        (uint64_t)real.tv_sec * NSEC_PER_SEC + (uint64_t)real.tv_nsec;
+    deadline = deadline < UINT64_MAX - real_now ?
+        deadline + real_now : UINT64_MAX;
+#endif
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline / NSEC_PER_SEC);
+    ts.tv_nsec = (long)(deadline % NSEC_PER_SEC);
+    pthread_cond_timedwait(cond, mutex, &ts);
+}
+
+void mocr_cond_signal(mocr_cond *cond)
+{
+    pthread_cond_signal(cond);
+}
+
+void mocr_cond_broadcast(mocr_cond *cond)
+{
+    pthread_cond_broadcast(cond);
+}
+
+static void *thread_main(void *param)
+{
+    thread_start start = *(thread_start *)param;
+    free(param);
+    start.func(start.arg);
+    return NULL;
+}
+
+int mocr_thread_create(mocr_thread *thread, mocr_thread_func func, void *arg)
+{
+    thread_start *start = malloc(sizeof(thread_start));
+    if (start == NULL)
+    {
+        return -1;
+    }
+    start->func = func;
+    start->arg = arg;
+
+    if (pthread_create(thread, NULL, thread_main, start))
+    {
+        free(start);
+        return -1;
+    }
+    return 0;
+}
+
+void mocr_thread_join(mocr_thread thread)
+{
+    pthread_join(thread, NULL);
+}
+
+#if defined(__linux__)
+
+void mocr_futex_wait(volatile uint32_t *word, uint32_t expected)
+{
+    syscall(
+        SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0
+    );
+}
+
+void mocr_futex_wake(volatile uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+#else
+
+/* Without a futex every word shares one condition variable. Waking takes the
+ * mutex so a waiter can't miss a change made between its check and its wait. */
+static mocr_mutex g_futexMutex = MOCR_MUTEX_INIT;
+static pthread_cond_t g_futexCond = PTHREAD_COND_INITIALIZER;
+
+void mocr_futex_wait(volatile uint32_t *word, uint32_t expected)
+{
+    mocr_mutex_lock(&g_futexMutex);
+    if (mocr_atomic_load32(word) == expected)
+    {
+        pthread_cond_wait(&g_futexCond, &g_futexMutex);
+    }
+    mocr_mutex_unlock(&g_futexMutex);
+}
+
+void mocr_futex_wake(volatile uint32_t *word)
+{
+    (void)word;
+    mocr_mutex_lock(&g_futexMutex);
+    pthread_cond_broadcast(&g_futexCond);
+    mocr_mutex_unlock(&g_futexMutex);
+}
+
+#endif
+
+uint64_t mocr_time_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+#endif
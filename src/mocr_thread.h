@@ -0,0 +1,291 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2022 Ripose
+//
+// This file is part of libmocr.
+//
+// libmocr is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as
+// published by the Free Software Foundation, version 3 of the License.
+//
+// libmocr is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with libmocr.  If not, see <https://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIBMOCR_THREAD_H
+#define LIBMOCR_THREAD_H
+
+/* A small portable wrapper around the native threading primitives. Not part of
+ * the public API. */
+
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef SRWLOCK mocr_mutex;
+typedef CONDITION_VARIABLE mocr_cond;
+typedef HANDLE mocr_thread;
+#define MOCR_MUTEX_INIT SRWLOCK_INIT
+#else
+#include <pthread.h>
+typedef pthread_mutex_t mocr_mutex;
+typedef pthread_cond_t mocr_cond;
+typedef pthread_t mocr_thread;
+#define MOCR_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+/* MOCR_MUTEX_INIT statically initializes a mutex that is never destroyed */
+
+/* Sequentially consistent operations on integers and pointers. The adds and
+ * exchanges return the previous value. mocr_atomic_cas() replaces *ptr with
+ * desired and returns nonzero if *ptr equals *expected, otherwise it stores
+ * *ptr in *expected and returns 0. */
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+static inline uint64_t mocr_atomic_load(volatile uint64_t *ptr)
+{
+    return (uint64_t)_InterlockedCompareExchange64(
+        (volatile __int64 *)ptr, 0, 0
+    );
+}
+
+static inline void mocr_atomic_store(volatile uint64_t *ptr, uint64_t value)
+{
+    _InterlockedExchange64((volatile __int64 *)ptr, (__int64)value);
+}
+
+static inline uint64_t mocr_atomic_add(volatile uint64_t *ptr, uint64_t value)
+{
+    return (uint64_t)_InterlockedExchangeAdd64(
+        (volatile __int64 *)ptr, (__int64)value
+    );
+}
+
+static inline int mocr_atomic_cas(
+    volatile uint64_t *ptr, uint64_t *expected, uint64_t desired)
+{
+    uint64_t prev = (uint64_t)_InterlockedCompareExchange64(
+        (volatile __int64 *)ptr, (__int64)desired, (__int64)*expected
+    );
+    if (prev == *expected)
+    {
+        return 1;
+    }
+    *expected = prev;
+    return 0;
+}
+
+static inline uint32_t mocr_atomic_load32(volatile uint32_t *ptr)
+{
+    return (uint32_t)_InterlockedCompareExchange((volatile long *)ptr, 0, 0);
+}
+
+static inline void mocr_atomic_store32(volatile uint32_t *ptr, uint32_t value)
+{
+    _InterlockedExchange((volatile long *)ptr, (long)value);
+}
+
+static inline uint32_t mocr_atomic_add32(volatile uint32_t *ptr, uint32_t value)
+{
+    return (uint32_t)_InterlockedExchangeAdd((volatile long *)ptr, (long)value);
+}
+
+static inline void *mocr_atomic_load_ptr(void *volatile *ptr)
+{
+    return _InterlockedCompareExchangePointer(ptr, NULL, NULL);
+}
+
+static inline void mocr_atomic_store_ptr(void *volatile *ptr, void *value)
+{
+    _InterlockedExchangePointer(ptr, value);
+}
+
+static inline void *mocr_atomic_exchange_ptr(void *volatile *ptr, void *value)
+{
+    return _InterlockedExchangePointer(ptr, value);
+}
+#else
+static inline uint64_t mocr_atomic_load(volatile uint64_t *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void mocr_atomic_store(volatile uint64_t *ptr, uint64_t value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline uint64_t mocr_atomic_add(volatile uint64_t *ptr, uint64_t value)
+{
+    return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int mocr_atomic_cas(
+    volatile uint64_t *ptr, uint64_t *expected, uint64_t desired)
+{
+    return __atomic_compare_exchange_n(
+        ptr, expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+    );
+}
+
+static inline uint32_t mocr_atomic_load32(volatile uint32_t *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void mocr_atomic_store32(volatile uint32_t *ptr, uint32_t value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t mocr_atomic_add32(volatile uint32_t *ptr, uint32_t value)
+{
+    return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline void *mocr_atomic_load_ptr(void *volatile *ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+static inline void mocr_atomic_store_ptr(void *volatile *ptr, void *value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline void *mocr_atomic_exchange_ptr(void *volatile *ptr, void *value)
+{
+    return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+#endif
+
+/* The entry point of a thread */
+typedef void (*mocr_thread_func)(void *arg);
+
+/**
+ * @brief Initializes a mutex
+ *
+ * @param mutex The mutex to initialize
+ * @return 0 on success, nonzero on error
+ */
+int mocr_mutex_init(mocr_mutex *mutex);
+
+/**
+ * @brief Destroys a mutex that is not locked
+ *
+ * @param mutex The mutex to destroy
+ */
+void mocr_mutex_destroy(mocr_mutex *mutex);
+
+/**
+ * @brief Locks a mutex
+ *
+ * @param mutex The mutex to lock
+ */
+void mocr_mutex_lock(mocr_mutex *mutex);
+
+/**
+ * @brief Unlocks a mutex locked by the calling thread
+ *
+ * @param mutex The mutex to unlock
+ */
+void mocr_mutex_unlock(mocr_mutex *mutex);
+
+/**
+ * @brief Initializes a condition variable
+ *
+ * @param cond The condition variable to initialize
+ * @return 0 on success, nonzero on error
+ */
+int mocr_cond_init(mocr_cond *cond);
+
+/**
+ * @brief Destroys a condition variable nothing is waiting on
+ *
+ * @param cond The condition variable to destroy
+ */
+void mocr_cond_destroy(mocr_cond *cond);
+
+/**
+ * @brief Waits for a condition variable to be signaled. Spurious wakeups are
+ * possible.
+ *
+ * @param cond The condition variable to wait on
+ * @param mutex The mutex locked by the calling thread
+ */
+void mocr_cond_wait(mocr_cond *cond, mocr_mutex *mutex);
+
+/**
+ * @brief Waits for a condition variable to be signaled or for a deadline to
+ * pass. Spurious wakeups are possible.
+ *
+ * @param cond The condition variable to wait on
+ * @param mutex The mutex locked by the calling thread
+ * @param deadline The time to stop waiting at, as returned by mocr_time_now()
+ */
+void mocr_cond_timedwait(mocr_cond *cond, mocr_mutex *mutex, uint64_t deadline);
+
+/**
+ * @brief Wakes up one thread waiting on a condition variable
+ *
+ * @param cond The condition variable to signal
+ */
+void mocr_cond_signal(mocr_cond *cond);
+
+/**
+ * @brief Wakes up every thread waiting on a condition variable
+ *
+ * @param cond The condition variable to broadcast
+ */
+void mocr_cond_broadcast(mocr_cond *cond);
+
+/**
+ * @brief Starts a new thread
+ *
+ * @param[out] thread Receives the new thread
+ * @param func The function the thread runs
+ * @param arg The argument passed to func
+ * @return 0 on success, nonzero on error
+ */
+int mocr_thread_create(mocr_thread *thread, mocr_thread_func func, void *arg);
+
+/**
+ * @brief Waits for a thread to exit
+ *
+ * @param thread The thread to wait for
+ */
+void mocr_thread_join(mocr_thread thread);
+
+/**
+ * @brief Blocks while a word holds an expected value. Spurious wakeups are
+ * possible.
+ *
+ * @param word The word to wait on
+ * @param expected The value to wait for the word to stop holding
+ */
+void mocr_futex_wait(volatile uint32_t *word, uint32_t expected);
+
+/**
+ * @brief Wakes every thread waiting on a word. Call this after changing the
+ * word.
+ *
+ * @param word The word threads are waiting on
+ */
+void mocr_futex_wake(volatile uint32_t *word);
+
+/**
+ * @brief Gets the time from a monotonic clock
+ *
+ * @return The time in nanoseconds since an unspecified point
+ */
+uint64_t mocr_time_now(void);
+
+#endif // LIBMOCR_THREAD_H
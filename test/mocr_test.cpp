@@ -25,6 +25,21 @@
 
 #include "mocr.h"
 
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
 TEST(MocrInitTest, Basic)
 {
     mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
@@ -55,6 +70,28 @@ TEST(MocrInitTest, Multi)
     EXPECT_EQ(mocr_destroy(ctx2), 0);
 }
 
+TEST(MocrInitTest, SharedModel)
+{
+    mocr_ctx *ctx1 = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx1, nullptr);
+    mocr_ctx *ctx2 = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx2, nullptr);
+
+    /* Options are per context even though the model is shared */
+    int64_t value = 0;
+    EXPECT_EQ(mocr_set_option(ctx1, mocr_option_batch_size, 4), 0);
+    EXPECT_EQ(mocr_get_option(ctx2, mocr_option_batch_size, &value), 0);
+    EXPECT_EQ(value, 1);
+
+    /* The model stays loaded until the last context using it is destroyed */
+    EXPECT_EQ(mocr_destroy(ctx1), 0);
+    char *text = mocr_read_file(ctx2, "data/05.jpg");
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, "ぎゃっ");
+    EXPECT_EQ(mocr_free(text), 0);
+    EXPECT_EQ(mocr_destroy(ctx2), 0);
+}
+
 TEST(MocrDestroyTest, Vaild)
 {
     mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
@@ -167,6 +204,24 @@ TEST_F(MocrReadFileTest, Basic11)
     test_file("data/11.jpg", "警察にも先生にも町中の人達に！！");
 }
 
+/* The result of an asynchronous read */
+struct AsyncResult
+{
+    bool called = false;
+    std::string text;
+};
+
+static void store_result(mocr_request *, char *text, void *userdata)
+{
+    AsyncResult *result = static_cast<AsyncResult *>(userdata);
+    result->called = true;
+    if (text)
+    {
+        result->text = text;
+        mocr_free(text);
+    }
+}
+
 TEST_F(MocrReadFileTest, BasicMulti)
 {
     test_file("data/00.jpg", "素直にあやまるしか");
@@ -175,12 +230,429 @@ TEST_F(MocrReadFileTest, BasicMulti)
     test_file("data/11.jpg", "警察にも先生にも町中の人達に！！");
 }
 
+TEST_F(MocrReadFileTest, Async)
+{
+    const char *paths[] = {
+        "data/00.jpg", "data/02.jpg", "data/05.jpg", "/file/does/not/exist.jpg"
+    };
+    const char *expected[] = {
+        "素直にあやまるしか", "実戦剣術も一流です", "ぎゃっ", ""
+    };
+    AsyncResult results[4];
+    mocr_request *requests[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        requests[i] =
+            mocr_read_file_async(ctx, paths[i], store_result, &results[i]);
+        ASSERT_NE(requests[i], nullptr);
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(mocr_request_wait(requests[i]), 0);
+        EXPECT_TRUE(results[i].called);
+        EXPECT_EQ(results[i].text, expected[i]);
+        EXPECT_EQ(mocr_request_free(requests[i]), 0);
+    }
+}
+
+TEST_F(MocrReadFileTest, Cancel)
+{
+    AsyncResult results[4];
+    mocr_request *requests[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        requests[i] =
+            mocr_read_file_async(ctx, "data/00.jpg", store_result, &results[i]);
+        ASSERT_NE(requests[i], nullptr);
+    }
+    /* The last reads are still queued behind the first */
+    EXPECT_EQ(mocr_request_cancel(requests[2]), 0);
+    EXPECT_EQ(mocr_request_set_timeout(requests[3], 0), 0);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(mocr_request_wait(requests[i]), 0);
+        EXPECT_TRUE(results[i].called);
+    }
+    EXPECT_EQ(results[0].text, "素直にあやまるしか");
+    EXPECT_EQ(results[1].text, "素直にあやまるしか");
+    EXPECT_TRUE(results[2].text.empty());
+    EXPECT_TRUE(results[3].text.empty());
+
+    /* Cancelling a finished read changes nothing */
+    EXPECT_EQ(mocr_request_cancel(requests[0]), 0);
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(mocr_request_free(requests[i]), 0);
+    }
+}
+
+/* Records the order callbacks run in. The first one signals that it started
+ * and waits to be released. */
+struct OrderEntry
+{
+    std::vector<int> *order;
+    int index;
+    std::promise<void> *started;
+    std::shared_future<void> release;
+};
+
+static void record_order(mocr_request *, char *text, void *userdata)
+{
+    mocr_free(text);
+    OrderEntry *entry = static_cast<OrderEntry *>(userdata);
+    if (entry->started)
+    {
+        entry->started->set_value();
+        entry->release.wait();
+    }
+    entry->order->push_back(entry->index);
+}
+
+TEST_F(MocrReadFileTest, Priority)
+{
+    /* The only async thread is held by the first read while the rest queue */
+    std::promise<void> started;
+    std::promise<void> release;
+    std::vector<int> order;
+    OrderEntry entries[6];
+    mocr_request *requests[6];
+    for (int i = 0; i < 6; ++i)
+    {
+        entries[i].order = &order;
+        entries[i].index = i;
+        entries[i].started = nullptr;
+    }
+    entries[0].started = &started;
+    entries[0].release = release.get_future().share();
+
+    requests[0] =
+        mocr_read_file_async(ctx, "data/00.jpg", record_order, &entries[0]);
+    ASSERT_NE(requests[0], nullptr);
+    started.get_future().wait();
+    for (int i = 1; i < 6; ++i)
+    {
+        requests[i] =
+            mocr_read_file_async(ctx, "data/00.jpg", record_order, &entries[i]);
+        ASSERT_NE(requests[i], nullptr);
+        if (i >= 4)
+        {
+            EXPECT_EQ(
+                mocr_request_set_priority(
+                    requests[i], mocr_priority_interactive
+                ),
+                0
+            );
+        }
+    }
+    EXPECT_NE(
+        mocr_request_set_priority(requests[1], static_cast<mocr_priority>(2)),
+        0
+    );
+    release.set_value();
+
+    for (int i = 0; i < 6; ++i)
+    {
+        EXPECT_EQ(mocr_request_wait(requests[i]), 0);
+        EXPECT_EQ(mocr_request_free(requests[i]), 0);
+    }
+    std::vector<int> expected = {0, 4, 5, 1, 2, 3};
+    EXPECT_EQ(order, expected);
+}
+
+TEST_F(MocrReadFileTest, Stream)
+{
+    /* Hold the only async thread so the stream's reads queue up */
+    std::promise<void> started;
+    std::promise<void> release;
+    std::vector<int> order;
+    OrderEntry blocker;
+    blocker.order = &order;
+    blocker.index = 0;
+    blocker.started = &started;
+    blocker.release = release.get_future().share();
+    mocr_request *blocking =
+        mocr_read_file_async(ctx, "data/00.jpg", record_order, &blocker);
+    ASSERT_NE(blocking, nullptr);
+    started.get_future().wait();
+
+    mocr_stream *stream = mocr_stream_create(ctx);
+    ASSERT_NE(stream, nullptr);
+    const char *paths[] = {"data/00.jpg", "data/02.jpg", "data/05.jpg"};
+    AsyncResult results[3];
+    mocr_request *requests[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        requests[i] = mocr_stream_read_file_async(
+            stream, paths[i], store_result, &results[i]
+        );
+        ASSERT_NE(requests[i], nullptr);
+    }
+    release.set_value();
+
+    EXPECT_EQ(mocr_request_wait(blocking), 0);
+    EXPECT_EQ(mocr_request_free(blocking), 0);
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(mocr_request_wait(requests[i]), 0);
+        EXPECT_TRUE(results[i].called);
+        EXPECT_EQ(mocr_request_free(requests[i]), 0);
+    }
+    EXPECT_TRUE(results[0].text.empty());
+    EXPECT_TRUE(results[1].text.empty());
+    EXPECT_EQ(results[2].text, "ぎゃっ");
+    EXPECT_EQ(mocr_stream_destroy(stream), 0);
+}
+
+TEST_F(MocrReadFileTest, Overload)
+{
+    /* Hold the only async thread so the next read stays queued */
+    std::promise<void> started;
+    std::promise<void> release;
+    std::vector<int> order;
+    OrderEntry blocker;
+    blocker.order = &order;
+    blocker.index = 0;
+    blocker.started = &started;
+    blocker.release = release.get_future().share();
+    mocr_request *blocking =
+        mocr_read_file_async(ctx, "data/00.jpg", record_order, &blocker);
+    ASSERT_NE(blocking, nullptr);
+    started.get_future().wait();
+
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_max_pending, 1), 0);
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_overload, mocr_overload_fail), 0);
+    EXPECT_NE(mocr_set_option(ctx, mocr_option_overload, 3), 0);
+    EXPECT_NE(mocr_set_option(ctx, mocr_option_max_pending, -1), 0);
+
+    AsyncResult queued;
+    AsyncResult refused;
+    AsyncResult newest;
+    mocr_request *first =
+        mocr_read_file_async(ctx, "data/02.jpg", store_result, &queued);
+    ASSERT_NE(first, nullptr);
+
+    errno = 0;
+    EXPECT_EQ(
+        mocr_read_file_async(ctx, "data/05.jpg", store_result, &refused),
+        nullptr
+    );
+    EXPECT_EQ(errno, EAGAIN);
+    errno = 0;
+    EXPECT_EQ(mocr_read_file(ctx, "data/05.jpg"), nullptr);
+    EXPECT_EQ(errno, EAGAIN);
+
+    /* The queued read makes room for the newest one */
+    ASSERT_EQ(
+        mocr_set_option(ctx, mocr_option_overload, mocr_overload_shed_oldest), 0
+    );
+    mocr_request *second =
+        mocr_read_file_async(ctx, "data/05.jpg", store_result, &newest);
+    ASSERT_NE(second, nullptr);
+    release.set_value();
+
+    EXPECT_EQ(mocr_request_wait(blocking), 0);
+    EXPECT_EQ(mocr_request_wait(first), 0);
+    EXPECT_EQ(mocr_request_wait(second), 0);
+    EXPECT_TRUE(queued.called);
+    EXPECT_TRUE(queued.text.empty());
+    EXPECT_FALSE(refused.called);
+    EXPECT_EQ(newest.text, "ぎゃっ");
+    EXPECT_EQ(mocr_request_free(blocking), 0);
+    EXPECT_EQ(mocr_request_free(first), 0);
+    EXPECT_EQ(mocr_request_free(second), 0);
+
+    int64_t value = 0;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_max_pending, &value), 0);
+    EXPECT_EQ(value, 1);
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_max_pending, 0), 0);
+    test_file("data/05.jpg", "ぎゃっ");
+}
+
+TEST_F(MocrReadFileTest, Poll)
+{
+    const char *paths[] = {
+        "data/00.jpg", "data/02.jpg", "data/05.jpg", "/file/does/not/exist.jpg"
+    };
+    const char *expected[] = {
+        "素直にあやまるしか", "実戦剣術も一流です", "ぎゃっ", ""
+    };
+    int fd = mocr_completion_fd(ctx);
+#if !defined(_WIN32)
+    ASSERT_NE(fd, -1);
+#endif
+    EXPECT_EQ(mocr_completion_fd(ctx), fd);
+
+    mocr_request *requests[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        requests[i] =
+            mocr_read_file_async(ctx, paths[i], nullptr, &expected[i]);
+        ASSERT_NE(requests[i], nullptr);
+    }
+
+    std::string texts[4];
+    bool polled[4] = {};
+    size_t count = 0;
+    while (count < 4)
+    {
+#if !defined(_WIN32)
+        pollfd readable = {fd, POLLIN, 0};
+        ASSERT_EQ(poll(&readable, 1, 60000), 1);
+#endif
+        mocr_result results[3];
+        size_t polled_now = mocr_poll(ctx, results, 3);
+        for (size_t i = 0; i < polled_now; ++i)
+        {
+            const char **userdata = static_cast<const char **>(
+                results[i].userdata
+            );
+            size_t index = static_cast<size_t>(userdata - expected);
+            ASSERT_LT(index, 4u);
+            EXPECT_EQ(results[i].request, requests[index]);
+            EXPECT_FALSE(polled[index]);
+            polled[index] = true;
+            if (results[i].text)
+            {
+                texts[index] = results[i].text;
+            }
+            EXPECT_EQ(mocr_free(results[i].text), 0);
+        }
+        count += polled_now;
+    }
+
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(texts[i], expected[i]);
+        EXPECT_EQ(mocr_request_free(requests[i]), 0);
+    }
+#if !defined(_WIN32)
+    pollfd readable = {fd, POLLIN, 0};
+    EXPECT_EQ(poll(&readable, 1, 0), 0);
+#endif
+    mocr_result result;
+    EXPECT_EQ(mocr_poll(ctx, &result, 1), 0u);
+}
+
 TEST_F(MocrReadFileTest, MissingFile)
 {
     char *text = mocr_read_file(ctx, "/file/does/not/exist.jpg");
     EXPECT_EQ(text, nullptr);
 }
 
+#if !defined(_WIN32)
+TEST_F(MocrReadFileTest, FileCache)
+{
+    const char *cache_path = "file_cache_test.bin";
+    const char *image_path = "file_cache_test.jpg";
+    std::filesystem::remove(cache_path);
+    std::filesystem::copy_file(
+        "data/00.jpg", image_path,
+        std::filesystem::copy_options::overwrite_existing
+    );
+
+    EXPECT_NE(mocr_set_file_cache(nullptr, cache_path), 0);
+    ASSERT_EQ(mocr_set_file_cache(ctx, cache_path), 0);
+    EXPECT_NE(mocr_set_file_cache(ctx, "data/00.jpg"), 0);
+    char *expected = mocr_read_file(ctx, image_path);
+    ASSERT_NE(expected, nullptr);
+
+    /* Garble the image without changing its size or modification time */
+    auto mtime = std::filesystem::last_write_time(image_path);
+    {
+        std::fstream file(
+            image_path, std::ios::in | std::ios::out | std::ios::binary
+        );
+        std::vector<char> bytes(
+            (std::istreambuf_iterator<char>(file)),
+            std::istreambuf_iterator<char>()
+        );
+        for (char &byte : bytes)
+        {
+            byte = ~byte;
+        }
+        file.seekp(0);
+        file.write(bytes.data(), bytes.size());
+    }
+    std::filesystem::last_write_time(image_path, mtime);
+
+    /* Reopening the cache finds the text without reading the image */
+    ASSERT_EQ(mocr_set_file_cache(ctx, nullptr), 0);
+    ASSERT_EQ(mocr_set_file_cache(ctx, cache_path), 0);
+    char *text = mocr_read_file(ctx, image_path);
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, expected);
+    EXPECT_EQ(mocr_free(text), 0);
+
+    /* Hashing the contents notices the change */
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_file_cache_hash, 1), 0);
+    EXPECT_EQ(mocr_read_file(ctx, image_path), nullptr);
+
+    EXPECT_EQ(mocr_free(expected), 0);
+    EXPECT_EQ(mocr_set_file_cache(ctx, nullptr), 0);
+    std::filesystem::remove(cache_path);
+    std::filesystem::remove(image_path);
+}
+
+TEST_F(MocrReadFileTest, FileCacheTornRecord)
+{
+    const char *cache_path = "file_cache_torn_test.bin";
+    std::filesystem::remove(cache_path);
+    ASSERT_EQ(mocr_set_file_cache(ctx, cache_path), 0);
+
+    /* A crash left pages of a torn record, and this context appends after it */
+    {
+        std::ofstream file(cache_path, std::ios::binary | std::ios::app);
+        std::vector<char> torn(16384, 0);
+        file.write(torn.data(), torn.size());
+    }
+    char *expected = mocr_read_file(ctx, "data/00.jpg");
+    ASSERT_NE(expected, nullptr);
+
+    /* Another context opening the file cuts off both records */
+    mocr_ctx *other = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(other, nullptr);
+    ASSERT_EQ(mocr_set_file_cache(other, cache_path), 0);
+    EXPECT_LT(std::filesystem::file_size(cache_path), 16384u);
+
+    /* The first context reads the image again instead of the missing record */
+    char *text = mocr_read_file(ctx, "data/00.jpg");
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, expected);
+    EXPECT_EQ(mocr_free(text), 0);
+    text = mocr_read_file(other, "data/00.jpg");
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, expected);
+    EXPECT_EQ(mocr_free(text), 0);
+
+    EXPECT_EQ(mocr_free(expected), 0);
+    EXPECT_EQ(mocr_destroy(other), 0);
+    EXPECT_EQ(mocr_set_file_cache(ctx, nullptr), 0);
+    std::filesystem::remove(cache_path);
+}
+#endif
+
+TEST_F(MocrReadFileTest, Encoded)
+{
+    std::ifstream file("data/04.jpg", std::ios::binary);
+    ASSERT_TRUE(file);
+    std::vector<char> bytes(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()
+    );
+
+    char *text = mocr_read_encoded(ctx, bytes.data(), bytes.size());
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, "よかったじゃないわよ！何逃げてるのよ！！早くあいつを退治してよ！");
+    EXPECT_EQ(mocr_free(text), 0);
+}
+
+TEST_F(MocrReadFileTest, EncodedInvalid)
+{
+    const char bytes[] = "not an image";
+    char *text = mocr_read_encoded(ctx, bytes, sizeof(bytes));
+    EXPECT_EQ(text, nullptr);
+}
+
 class MocrReadTest : public ::testing::Test
 {
 protected:
@@ -280,6 +752,857 @@ TEST_F(MocrReadTest, BasicMulti)
     test_file("data/11.jpg", "警察にも先生にも町中の人達に！！");
 }
 
+TEST_F(MocrReadTest, CMYK)
+{
+    int width, height, channels;
+    stbi_uc *data = stbi_load("data/06.jpg", &width, &height, &channels, 3);
+    ASSERT_NE(data, nullptr);
+
+    /* With no black, each ink is the inverse of its color */
+    size_t pixels = (size_t)width * height;
+    std::vector<unsigned char> cmyk(pixels * 4);
+    for (size_t i = 0; i < pixels; ++i)
+    {
+        cmyk[i * 4 + 0] = 255 - data[i * 3 + 0];
+        cmyk[i * 4 + 1] = 255 - data[i * 3 + 1];
+        cmyk[i * 4 + 2] = 255 - data[i * 3 + 2];
+        cmyk[i * 4 + 3] = 0;
+    }
+    stbi_image_free(data);
+
+    char *text = mocr_read(ctx, cmyk.data(), width, height, mocr_mode_CMYK);
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, "ピンポーーン");
+    EXPECT_EQ(mocr_free(text), 0);
+}
+
+TEST_F(MocrReadTest, OneBitPacked)
+{
+    int width, height, channels;
+    stbi_uc *data = stbi_load("data/05.jpg", &width, &height, &channels, 1);
+    ASSERT_NE(data, nullptr);
+
+    /* Binarize the image both one pixel per byte and packed 8 to a byte */
+    size_t packed_stride = (width + 7) / 8;
+    std::vector<unsigned char> bytes((size_t)width * height);
+    std::vector<unsigned char> packed(packed_stride * height, 0);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            bool white = data[y * width + x] >= 128;
+            bytes[y * width + x] = white;
+            if (white)
+            {
+                packed[y * packed_stride + x / 8] |= 0x80 >> (x % 8);
+            }
+        }
+    }
+    stbi_image_free(data);
+
+    char *expected = mocr_read(ctx, bytes.data(), width, height, mocr_mode_1);
+    ASSERT_NE(expected, nullptr);
+    char *text =
+        mocr_read(ctx, packed.data(), width, height, mocr_mode_1_packed);
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, expected);
+    EXPECT_EQ(mocr_free(text), 0);
+    EXPECT_EQ(mocr_free(expected), 0);
+}
+
+TEST_F(MocrReadTest, Cache)
+{
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_cache_bytes, 1 << 20), 0);
+    int64_t value = 0;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_cache_bytes, &value), 0);
+    EXPECT_EQ(value, 1 << 20);
+    EXPECT_NE(mocr_set_option(ctx, mocr_option_cache_bytes, -1), 0);
+
+    test_file("data/00.jpg", "素直にあやまるしか");
+    test_file("data/00.jpg", "素直にあやまるしか");
+
+    mocr_cache_stats stats;
+    EXPECT_NE(mocr_get_cache_stats(nullptr, &stats), 0);
+    ASSERT_EQ(mocr_get_cache_stats(ctx, &stats), 0);
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.misses, 1u);
+    EXPECT_EQ(stats.entries, 1u);
+    EXPECT_GT(stats.bytes, 0u);
+
+    /* Padding between rows isn't part of the image */
+    int width, height, channels;
+    stbi_uc *data = stbi_load("data/00.jpg", &width, &height, &channels, 3);
+    ASSERT_NE(data, nullptr);
+    size_t row_bytes = width * 3;
+    size_t stride = row_bytes + 7;
+    std::vector<unsigned char> padded(stride * height, 0xAB);
+    for (int y = 0; y < height; ++y)
+    {
+        memcpy(&padded[y * stride], &data[y * row_bytes], row_bytes);
+    }
+
+    /* A different image or format isn't a hit */
+    data[0] ^= 0xFF;
+    char *changed = mocr_read(ctx, data, width, height, mocr_mode_RGB);
+    EXPECT_NE(changed, nullptr);
+    EXPECT_EQ(mocr_free(changed), 0);
+    stbi_image_free(data);
+
+    char *text = mocr_read_strided(
+        ctx, padded.data(), width, height, stride, mocr_mode_RGB
+    );
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, "素直にあやまるしか");
+    EXPECT_EQ(mocr_free(text), 0);
+
+    ASSERT_EQ(mocr_get_cache_stats(ctx, &stats), 0);
+    EXPECT_EQ(stats.hits, 2u);
+    EXPECT_EQ(stats.misses, 2u);
+    EXPECT_EQ(stats.entries, 2u);
+
+    /* Disabling the cache empties it */
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_cache_bytes, 0), 0);
+    ASSERT_EQ(mocr_get_cache_stats(ctx, &stats), 0);
+    EXPECT_EQ(stats.entries, 0u);
+    EXPECT_EQ(stats.bytes, 0u);
+    test_file("data/00.jpg", "素直にあやまるしか");
+    ASSERT_EQ(mocr_get_cache_stats(ctx, &stats), 0);
+    EXPECT_EQ(stats.hits, 2u);
+    EXPECT_EQ(stats.misses, 2u);
+}
+
+TEST_F(MocrReadTest, AsyncCache)
+{
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_cache_bytes, 1 << 20), 0);
+    int width, height, channels;
+    stbi_uc *data = stbi_load("data/00.jpg", &width, &height, &channels, 3);
+    ASSERT_NE(data, nullptr);
+    char *text = mocr_read(ctx, data, width, height, mocr_mode_RGB);
+    EXPECT_EQ(mocr_free(text), 0);
+
+    /* Hold the only async thread with one read and queue another behind it */
+    std::promise<void> started;
+    std::promise<void> release;
+    std::vector<int> order;
+    OrderEntry entries[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        entries[i].order = &order;
+        entries[i].index = i;
+        entries[i].started = nullptr;
+    }
+    entries[0].started = &started;
+    entries[0].release = release.get_future().share();
+    mocr_request *requests[3];
+    requests[0] =
+        mocr_read_file_async(ctx, "data/02.jpg", record_order, &entries[0]);
+    ASSERT_NE(requests[0], nullptr);
+    started.get_future().wait();
+    requests[1] =
+        mocr_read_file_async(ctx, "data/05.jpg", record_order, &entries[1]);
+    ASSERT_NE(requests[1], nullptr);
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_max_pending, 1), 0);
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_overload, mocr_overload_fail), 0);
+
+    /* A hit isn't refused, and without a callback it's queued right away */
+    mocr_request *polled = mocr_read_async(
+        ctx, data, width, height, mocr_mode_RGB, nullptr, nullptr
+    );
+    ASSERT_NE(polled, nullptr);
+    mocr_result result;
+    ASSERT_EQ(mocr_poll(ctx, &result, 1), 1u);
+    EXPECT_EQ(result.request, polled);
+    EXPECT_STREQ(result.text, "素直にあやまるしか");
+    EXPECT_EQ(mocr_free(result.text), 0);
+    EXPECT_EQ(mocr_request_free(polled), 0);
+
+    /* With a callback it runs ahead of the reads already queued */
+    requests[2] = mocr_read_async(
+        ctx, data, width, height, mocr_mode_RGB, record_order, &entries[2]
+    );
+    ASSERT_NE(requests[2], nullptr);
+    release.set_value();
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(mocr_request_wait(requests[i]), 0);
+        EXPECT_EQ(mocr_request_free(requests[i]), 0);
+    }
+    std::vector<int> expected = {0, 2, 1};
+    EXPECT_EQ(order, expected);
+
+    mocr_cache_stats stats;
+    ASSERT_EQ(mocr_get_cache_stats(ctx, &stats), 0);
+    EXPECT_EQ(stats.hits, 2u);
+    stbi_image_free(data);
+}
+
+class MocrNativePreprocessTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        ctx = mocr_init(DEFAULT_MODEL, 0);
+        ASSERT_NE(ctx, nullptr);
+        ASSERT_EQ(mocr_set_option(ctx, mocr_option_native_preprocess, 1), 0);
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+    }
+
+    void test_file(
+        const char *path, int channels, mocr_mode mode, const char *expected)
+    {
+        int width, height, file_channels;
+        stbi_uc *data =
+            stbi_load(path, &width, &height, &file_channels, channels);
+        ASSERT_NE(data, nullptr);
+
+        char *text = mocr_read(ctx, data, width, height, mode);
+        ASSERT_NE(text, nullptr);
+        EXPECT_STREQ(text, expected);
+        EXPECT_EQ(mocr_free(text), 0);
+
+        stbi_image_free(data);
+    }
+
+    mocr_ctx *ctx;
+};
+
+TEST_F(MocrNativePreprocessTest, Option)
+{
+    int64_t value = 0;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_native_preprocess, &value), 0);
+    EXPECT_EQ(value, 1);
+    EXPECT_EQ(mocr_set_option(ctx, mocr_option_native_preprocess, 0), 0);
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_native_preprocess, &value), 0);
+    EXPECT_EQ(value, 0);
+}
+
+TEST_F(MocrNativePreprocessTest, BasicRGB)
+{
+    test_file("data/00.jpg", 3, mocr_mode_RGB, "素直にあやまるしか");
+    test_file("data/01.jpg", 3, mocr_mode_RGB, "立川で見た、穴への下の巨大な眼は．．．");
+    test_file("data/02.jpg", 3, mocr_mode_RGB, "実戦剣術も一流です");
+    test_file("data/11.jpg", 3, mocr_mode_RGB, "警察にも先生にも町中の人達に！！");
+}
+
+TEST_F(MocrNativePreprocessTest, BasicRGBA)
+{
+    test_file("data/03.jpg", 4, mocr_mode_RGBA, "第３０話重苦しい闇の奥で静かに呼吸づきながら");
+    test_file("data/07.jpg", 4, mocr_mode_RGBA, "ＬＩＮＫ！私達７人の力でガノンの塔の結界をやぶります");
+}
+
+TEST_F(MocrNativePreprocessTest, BasicL)
+{
+    test_file("data/05.jpg", 1, mocr_mode_L, "ぎゃっ");
+    test_file("data/08.jpg", 1, mocr_mode_L, "ファイアパンチ");
+}
+
+class MocrReadStridedTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        ctx = mocr_init(DEFAULT_MODEL, 0);
+        ASSERT_NE(ctx, nullptr);
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+    }
+
+    void test_file(const char *path, size_t padding, const char *expected_text)
+    {
+        int width, height, channels;
+        stbi_uc *data = stbi_load(path, &width, &height, &channels, 3);
+        ASSERT_NE(data, nullptr);
+
+        size_t row_bytes = width * 3;
+        size_t stride = row_bytes + padding;
+        std::vector<unsigned char> padded(stride * height, 0xAB);
+        for (int y = 0; y < height; ++y)
+        {
+            memcpy(&padded[y * stride], &data[y * row_bytes], row_bytes);
+        }
+        stbi_image_free(data);
+
+        char *text = mocr_read_strided(
+            ctx, padded.data(), width, height, stride, mocr_mode_RGB
+        );
+        ASSERT_NE(text, nullptr);
+        EXPECT_STREQ(text, expected_text);
+        EXPECT_EQ(mocr_free(text), 0);
+    }
+
+    mocr_ctx *ctx;
+};
+
+TEST_F(MocrReadStridedTest, Packed)
+{
+    test_file("data/00.jpg", 0, "素直にあやまるしか");
+}
+
+TEST_F(MocrReadStridedTest, Padded)
+{
+    test_file("data/00.jpg", 13, "素直にあやまるしか");
+    test_file("data/02.jpg", 64, "実戦剣術も一流です");
+}
+
+TEST_F(MocrReadStridedTest, StrideTooSmall)
+{
+    unsigned char data[4 * 4 * 3] = {0};
+    EXPECT_EQ(mocr_read_strided(ctx, data, 4, 4, 11, mocr_mode_RGB), nullptr);
+}
+
+class MocrReadRegionsTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        ctx = mocr_init(DEFAULT_MODEL, 0);
+        ASSERT_NE(ctx, nullptr);
+    }
+
+    void TearDown() override
+    {
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+    }
+
+    /* Stacks images vertically on a white page and records where they are */
+    void add_to_page(const char *path)
+    {
+        int width, height, channels;
+        stbi_uc *data = stbi_load(path, &width, &height, &channels, 3);
+        ASSERT_NE(data, nullptr);
+        ASSERT_LE((size_t)width, PAGE_WIDTH);
+
+        size_t top = page.size() / (PAGE_WIDTH * 3);
+        page.resize(page.size() + PAGE_WIDTH * 3 * height, 0xFF);
+        for (int y = 0; y < height; ++y)
+        {
+            memcpy(
+                &page[((top + y) * PAGE_WIDTH) * 3],
+                &data[y * width * 3],
+                width * 3
+            );
+        }
+        rects.push_back({0, top, (size_t)width, (size_t)height});
+
+        stbi_image_free(data);
+    }
+
+    static constexpr size_t PAGE_WIDTH = 1024;
+
+    mocr_ctx *ctx;
+    std::vector<unsigned char> page;
+    std::vector<mocr_rect> rects;
+};
+
+TEST_F(MocrReadRegionsTest, Basic)
+{
+    add_to_page("data/00.jpg");
+    add_to_page("data/02.jpg");
+    add_to_page("data/11.jpg");
+
+    mocr_page *pg = mocr_page_create(
+        ctx, page.data(), PAGE_WIDTH, page.size() / (PAGE_WIDTH * 3), 0,
+        mocr_mode_RGB
+    );
+    ASSERT_NE(pg, nullptr);
+
+    char *texts[3];
+    ASSERT_EQ(mocr_read_regions(pg, rects.data(), rects.size(), texts), 0);
+    EXPECT_STREQ(texts[0], "素直にあやまるしか");
+    EXPECT_STREQ(texts[1], "実戦剣術も一流です");
+    EXPECT_STREQ(texts[2], "警察にも先生にも町中の人達に！！");
+    for (char *text : texts)
+    {
+        EXPECT_EQ(mocr_free(text), 0);
+    }
+
+    EXPECT_EQ(mocr_page_destroy(pg), 0);
+}
+
+TEST_F(MocrReadRegionsTest, OutOfBounds)
+{
+    unsigned char data[8 * 8] = {0};
+    mocr_page *pg = mocr_page_create(ctx, data, 8, 8, 0, mocr_mode_L);
+    ASSERT_NE(pg, nullptr);
+
+    mocr_rect rect = {4, 4, 5, 2};
+    char *text = nullptr;
+    EXPECT_NE(mocr_read_regions(pg, &rect, 1, &text), 0);
+    EXPECT_EQ(text, nullptr);
+
+    EXPECT_EQ(mocr_page_destroy(pg), 0);
+}
+
+class MocrReadBatchTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        ctx = mocr_init(DEFAULT_MODEL, 0);
+        ASSERT_NE(ctx, nullptr);
+    }
+
+    void TearDown() override
+    {
+        for (stbi_uc *data : loaded)
+        {
+            stbi_image_free(data);
+        }
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+    }
+
+    void add_image(const char *path, int channels, mocr_mode mode)
+    {
+        int width, height, file_channels;
+        stbi_uc *data =
+            stbi_load(path, &width, &height, &file_channels, channels);
+        ASSERT_NE(data, nullptr);
+        loaded.push_back(data);
+        images.push_back({data, (size_t)width, (size_t)height, 0, mode});
+    }
+
+    mocr_ctx *ctx;
+    std::vector<stbi_uc *> loaded;
+    std::vector<mocr_image> images;
+};
+
+TEST_F(MocrReadBatchTest, Basic)
+{
+    add_image("data/00.jpg", 3, mocr_mode_RGB);
+    add_image("data/06.jpg", 1, mocr_mode_L);
+    add_image("data/10.jpg", 4, mocr_mode_RGBA);
+
+    char *texts[3];
+    ASSERT_EQ(mocr_read_batch(ctx, images.data(), images.size(), texts), 0);
+    EXPECT_STREQ(texts[0], "素直にあやまるしか");
+    EXPECT_STREQ(texts[1], "ピンポーーン");
+    EXPECT_STREQ(texts[2], "わかるかな〜？");
+    for (char *text : texts)
+    {
+        EXPECT_EQ(mocr_free(text), 0);
+    }
+}
+
+TEST_F(MocrReadBatchTest, InvalidImage)
+{
+    add_image("data/00.jpg", 3, mocr_mode_RGB);
+    images.push_back({nullptr, 8, 8, 0, mocr_mode_L});
+
+    char *texts[2];
+    EXPECT_NE(mocr_read_batch(ctx, images.data(), images.size(), texts), 0);
+    EXPECT_EQ(texts[0], nullptr);
+    EXPECT_EQ(texts[1], nullptr);
+}
+
+TEST(MocrOptionTest, BatchSize)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    int64_t value = 0;
+    EXPECT_NE(mocr_get_option(nullptr, mocr_option_batch_size, &value), 0);
+    EXPECT_NE(mocr_set_option(nullptr, mocr_option_batch_size, 8), 0);
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_batch_size, &value), 0);
+    EXPECT_EQ(value, 1);
+    EXPECT_NE(mocr_set_option(ctx, mocr_option_batch_size, 0), 0);
+    EXPECT_EQ(mocr_set_option(ctx, mocr_option_batch_size, 8), 0);
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_batch_size, &value), 0);
+    EXPECT_EQ(value, 8);
+    EXPECT_NE(mocr_set_option(ctx, mocr_option_batch_wait_us, -1), 0);
+    EXPECT_EQ(mocr_set_option(ctx, mocr_option_batch_wait_us, 1000), 0);
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_batch_wait_us, &value), 0);
+    EXPECT_EQ(value, 1000);
+
+    /* A lone read is still answered once the wait is up */
+    unsigned char data[16 * 16] = {0};
+    char *text = mocr_read(ctx, data, 16, 16, mocr_mode_L);
+    EXPECT_NE(text, nullptr);
+    EXPECT_EQ(mocr_free(text), 0);
+
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrOptionTest, ExecutorThreads)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    int64_t value = -1;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_executor_threads, &value), 0);
+    EXPECT_EQ(value, 0);
+    EXPECT_NE(mocr_set_option(ctx, mocr_option_executor_threads, -1), 0);
+    EXPECT_EQ(mocr_set_option(ctx, mocr_option_executor_threads, 2), 0);
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_executor_threads, &value), 0);
+    EXPECT_EQ(value, 2);
+
+    unsigned char data[16 * 16] = {0};
+    char *text = mocr_read(ctx, data, 16, 16, mocr_mode_L);
+    EXPECT_NE(text, nullptr);
+    EXPECT_EQ(mocr_free(text), 0);
+    text = mocr_read_file(ctx, "data/00.jpg");
+    EXPECT_STREQ(text, "素直にあやまるしか");
+    EXPECT_EQ(mocr_free(text), 0);
+
+    /* Destroying the context stops the executors */
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrOptionTest, Subinterpreter)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    /* Moving into a subinterpreter needs Python 3.12 and dependencies that
+     * support it. Either way the context must keep working. */
+    int ret = mocr_set_option(ctx, mocr_option_subinterpreter, 1);
+    int64_t value = -1;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_subinterpreter, &value), 0);
+    EXPECT_EQ(value, ret == 0);
+
+    char *text = mocr_read_file(ctx, "data/00.jpg");
+    EXPECT_STREQ(text, "素直にあやまるしか");
+    EXPECT_EQ(mocr_free(text), 0);
+
+    EXPECT_EQ(mocr_set_option(ctx, mocr_option_subinterpreter, 0), 0);
+    text = mocr_read_file(ctx, "data/00.jpg");
+    EXPECT_STREQ(text, "素直にあやまるしか");
+    EXPECT_EQ(mocr_free(text), 0);
+
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrOptionTest, ConcurrentReadsScaling)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    /* Only a free-threaded build of Python can overlap reads */
+    if (mocr_set_option(ctx, mocr_option_concurrent_reads, 1) ||
+        std::thread::hardware_concurrency() < 4)
+    {
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+        GTEST_SKIP() << "Reads can't overlap";
+    }
+
+    const int reads = 16;
+    auto time_reads = [=](int threads) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([=]() {
+                for (int j = 0; j < reads / threads; ++j)
+                {
+                    char *text = mocr_read_file(ctx, "data/00.jpg");
+                    EXPECT_STREQ(text, "素直にあやまるしか");
+                    mocr_free(text);
+                }
+            });
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        return std::chrono::steady_clock::now() - start;
+    };
+
+    /* Warm up, then the same reads spread over four threads must finish
+     * well before they do on one */
+    time_reads(1);
+    auto serial = time_reads(1);
+    auto parallel = time_reads(4);
+    EXPECT_LT(parallel * 4, serial * 3);
+
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrOptionTest, WorkerProcesses)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    std::vector<unsigned char> data(64 * 48 * 3);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (unsigned char)(i * 7);
+    }
+    char *expected = mocr_read(ctx, data.data(), 64, 48, mocr_mode_RGB);
+    ASSERT_NE(expected, nullptr);
+
+    /* Workers need fork() */
+    if (mocr_set_option(ctx, mocr_option_worker_processes, 2))
+    {
+        EXPECT_EQ(mocr_free(expected), 0);
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+        GTEST_SKIP() << "Worker processes aren't supported";
+    }
+    int64_t value = 0;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_worker_processes, &value), 0);
+    EXPECT_EQ(value, 2);
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]() {
+            for (int j = 0; j < 4; ++j)
+            {
+                char *text =
+                    mocr_read(ctx, data.data(), 64, 48, mocr_mode_RGB);
+                EXPECT_STREQ(text, expected);
+                mocr_free(text);
+            }
+        });
+    }
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(mocr_set_option(ctx, mocr_option_worker_processes, 0), 0);
+    EXPECT_EQ(mocr_free(expected), 0);
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrOptionTest, WorkerProcessesResize)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    std::vector<unsigned char> data(64 * 48);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (unsigned char)(i * 5);
+    }
+    char *expected = mocr_read(ctx, data.data(), 64, 48, mocr_mode_L);
+    ASSERT_NE(expected, nullptr);
+
+    if (mocr_set_option(ctx, mocr_option_worker_processes, 1))
+    {
+        EXPECT_EQ(mocr_free(expected), 0);
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+        GTEST_SKIP() << "Worker processes aren't supported";
+    }
+
+    /* Workers come from the zygote, so the count can change while reading */
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]() {
+            for (int j = 0; j < 8; ++j)
+            {
+                char *text = mocr_read(ctx, data.data(), 64, 48, mocr_mode_L);
+                EXPECT_STREQ(text, expected);
+                mocr_free(text);
+            }
+        });
+    }
+    for (int64_t count : {4, 2, 0, 3})
+    {
+        EXPECT_EQ(
+            mocr_set_option(ctx, mocr_option_worker_processes, count), 0
+        );
+        int64_t value = -1;
+        EXPECT_EQ(
+            mocr_get_option(ctx, mocr_option_worker_processes, &value), 0
+        );
+        EXPECT_EQ(value, count);
+    }
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(mocr_free(expected), 0);
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrOptionTest, WorkerProcessesOptions)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    std::vector<unsigned char> data(64 * 48 * 3);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (unsigned char)(i * 11);
+    }
+    char *expected = mocr_read(ctx, data.data(), 64, 48, mocr_mode_RGB);
+    ASSERT_NE(expected, nullptr);
+    if (mocr_set_option(ctx, mocr_option_native_preprocess, 1))
+    {
+        EXPECT_EQ(mocr_free(expected), 0);
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+        GTEST_SKIP() << "Native preprocessing isn't supported";
+    }
+    char *native = mocr_read(ctx, data.data(), 64, 48, mocr_mode_RGB);
+    ASSERT_NE(native, nullptr);
+
+    if (mocr_set_option(ctx, mocr_option_worker_processes, 1))
+    {
+        EXPECT_EQ(mocr_free(native), 0);
+        EXPECT_EQ(mocr_free(expected), 0);
+        EXPECT_EQ(mocr_destroy(ctx), 0);
+        GTEST_SKIP() << "Worker processes aren't supported";
+    }
+    char *text = mocr_read(ctx, data.data(), 64, 48, mocr_mode_RGB);
+    EXPECT_STREQ(text, native);
+    mocr_free(text);
+
+    /* The workers pick up options set after they were forked */
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_native_preprocess, 0), 0);
+    text = mocr_read(ctx, data.data(), 64, 48, mocr_mode_RGB);
+    EXPECT_STREQ(text, expected);
+    mocr_free(text);
+    int64_t value = 0;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_worker_processes, &value), 0);
+    EXPECT_EQ(value, 1);
+
+    EXPECT_EQ(mocr_free(native), 0);
+    EXPECT_EQ(mocr_free(expected), 0);
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrOptionTest, AsyncBatched)
+{
+    mocr_ctx *ctx = mocr_init(DEFAULT_MODEL, 0);
+    ASSERT_NE(ctx, nullptr);
+
+    int64_t value = -1;
+    EXPECT_EQ(mocr_get_option(ctx, mocr_option_async_threads, &value), 0);
+    EXPECT_EQ(value, 1);
+    EXPECT_NE(mocr_set_option(ctx, mocr_option_async_threads, 0), 0);
+
+    std::vector<unsigned char> data(64 * 48);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (unsigned char)(i * 3);
+    }
+    char *expected = mocr_read(ctx, data.data(), 64, 48, mocr_mode_L);
+    ASSERT_NE(expected, nullptr);
+
+    /* If a read held the only thread while waiting for its batch, each batch
+     * would wait out the whole 10 seconds */
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_batch_size, 4), 0);
+    ASSERT_EQ(mocr_set_option(ctx, mocr_option_batch_wait_us, 10000000), 0);
+    auto start = std::chrono::steady_clock::now();
+    AsyncResult results[16];
+    mocr_request *requests[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        requests[i] = mocr_read_async(
+            ctx, data.data(), 64, 48, mocr_mode_L, store_result, &results[i]
+        );
+        ASSERT_NE(requests[i], nullptr);
+    }
+    for (int i = 0; i < 16; ++i)
+    {
+        EXPECT_EQ(mocr_request_wait(requests[i]), 0);
+        EXPECT_EQ(results[i].text, expected);
+        EXPECT_EQ(mocr_request_free(requests[i]), 0);
+    }
+    EXPECT_LT(
+        std::chrono::steady_clock::now() - start, std::chrono::seconds(5)
+    );
+
+    EXPECT_EQ(mocr_free(expected), 0);
+    EXPECT_EQ(mocr_destroy(ctx), 0);
+}
+
+TEST(MocrPoolTest, CheckoutCheckin)
+{
+    mocr_pool *pool = mocr_pool_create(DEFAULT_MODEL, 0, 2);
+    ASSERT_NE(pool, nullptr);
+    ASSERT_EQ(mocr_pool_size(pool), 2u);
+
+    mocr_ctx *ctx1 = mocr_pool_acquire(pool, 0);
+    ASSERT_NE(ctx1, nullptr);
+    mocr_ctx *ctx2 = mocr_pool_acquire(pool, -1);
+    ASSERT_NE(ctx2, nullptr);
+    EXPECT_NE(ctx1, ctx2);
+
+    /* Every context is busy */
+    EXPECT_EQ(mocr_pool_acquire(pool, 0), nullptr);
+    EXPECT_EQ(mocr_pool_acquire(pool, 1000), nullptr);
+    EXPECT_NE(mocr_pool_destroy(pool), 0);
+
+    char *text = mocr_read_file(ctx1, "data/08.jpg");
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, "ファイアパンチ");
+    EXPECT_EQ(mocr_free(text), 0);
+
+    EXPECT_EQ(mocr_pool_release(pool, ctx1), 0);
+    EXPECT_NE(mocr_pool_release(pool, ctx1), 0);
+    EXPECT_EQ(mocr_pool_acquire(pool, 0), ctx1);
+    EXPECT_EQ(mocr_pool_release(pool, ctx1), 0);
+    EXPECT_EQ(mocr_pool_release(pool, ctx2), 0);
+
+    mocr_pool_stats stats;
+    uint64_t checkouts = 0;
+    for (size_t i = 0; i < mocr_pool_size(pool); ++i)
+    {
+        ASSERT_EQ(mocr_pool_get_stats(pool, i, &stats), 0);
+        EXPECT_EQ(stats.busy, 0);
+        checkouts += stats.checkouts;
+    }
+    EXPECT_EQ(checkouts, 3u);
+    EXPECT_NE(mocr_pool_get_stats(pool, 2, &stats), 0);
+    EXPECT_EQ(mocr_pool_size(nullptr), 0u);
+    EXPECT_NE(mocr_pool_get_stats(nullptr, 0, &stats), 0);
+    EXPECT_EQ(mocr_pool_acquire(nullptr, 0), nullptr);
+
+    EXPECT_EQ(mocr_pool_destroy(pool), 0);
+}
+
+TEST(MocrPoolTest, WaitForRelease)
+{
+    mocr_pool *pool = mocr_pool_create(DEFAULT_MODEL, 0, 1);
+    ASSERT_NE(pool, nullptr);
+
+    mocr_ctx *ctx = mocr_pool_acquire(pool, -1);
+    ASSERT_NE(ctx, nullptr);
+    std::thread releaser([pool, ctx]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        mocr_pool_release(pool, ctx);
+    });
+    EXPECT_EQ(mocr_pool_acquire(pool, -1), ctx);
+    releaser.join();
+
+    /* A timeout too long to add to the clock still waits */
+    std::thread late_releaser([pool, ctx]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        mocr_pool_release(pool, ctx);
+    });
+    EXPECT_EQ(mocr_pool_acquire(pool, INT64_MAX), ctx);
+    late_releaser.join();
+
+    /* Only one of two racing releases returns the context */
+    int released[2];
+    std::thread racers[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        racers[i] = std::thread([pool, ctx, &released, i]() {
+            released[i] = mocr_pool_release(pool, ctx);
+        });
+    }
+    for (std::thread &racer : racers)
+    {
+        racer.join();
+    }
+    EXPECT_EQ((released[0] == 0) + (released[1] == 0), 1);
+    EXPECT_EQ(mocr_pool_acquire(pool, 0), ctx);
+    EXPECT_EQ(mocr_pool_acquire(pool, 0), nullptr);
+
+    EXPECT_EQ(mocr_pool_release(pool, ctx), 0);
+    EXPECT_EQ(mocr_pool_destroy(pool), 0);
+}
+
 TEST(MocrFreeTest, Null)
 {
     EXPECT_EQ(mocr_free(nullptr), 0);
@@ -22,7 +22,11 @@
 
 #include "mocr++.h"
 
+#include <cstring>
+#include <fstream>
 #include <future>
+#include <iterator>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -271,6 +275,88 @@ TEST_F(MocrxxReadFileTest, MissingFileStdString)
     EXPECT_TRUE(ctx.read(std::string("/file/does/not/exist")).empty());
 }
 
+TEST_F(MocrxxReadFileTest, Encoded)
+{
+    std::ifstream file("data/08.jpg", std::ios::binary);
+    ASSERT_TRUE(file);
+    std::vector<char> bytes(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()
+    );
+    EXPECT_STREQ(ctx.read(bytes.data(), bytes.size()).c_str(), "ファイアパンチ");
+}
+
+TEST_F(MocrxxReadFileTest, ReadAsync)
+{
+    ASSERT_TRUE(ctx.set_option(mocr::option::AsyncThreads, 2));
+
+    std::future<std::string> basic0 = ctx.read_async("data/00.jpg");
+    std::future<std::string> basic2 = ctx.read_async("data/02.jpg");
+    std::future<std::string> basic5 = ctx.read_async(std::string("data/05.jpg"));
+    std::future<std::string> missing = ctx.read_async("/file/does/not/exist");
+
+    EXPECT_STREQ(basic0.get().c_str(), "素直にあやまるしか");
+    EXPECT_STREQ(basic2.get().c_str(), "実戦剣術も一流です");
+    EXPECT_STREQ(basic5.get().c_str(), "ぎゃっ");
+    EXPECT_TRUE(missing.get().empty());
+}
+
+#if defined(MOCRXX_HAVE_COROUTINES)
+/* A coroutine that starts right away and signals a promise when it returns */
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object()
+        {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {
+
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+};
+
+static detached_task read_co(
+    mocr::model &ctx, std::promise<std::vector<std::string>> &done)
+{
+    std::vector<std::string> texts;
+    texts.emplace_back(co_await ctx.read_co("data/00.jpg"));
+    texts.emplace_back(co_await ctx.read_co("data/11.jpg"));
+    texts.emplace_back(co_await ctx.read_co("/file/does/not/exist"));
+    done.set_value(std::move(texts));
+}
+
+TEST_F(MocrxxReadFileTest, ReadCoroutine)
+{
+    std::promise<std::vector<std::string>> done;
+    std::future<std::vector<std::string>> texts = done.get_future();
+    read_co(ctx, done);
+
+    std::vector<std::string> result = texts.get();
+    ASSERT_EQ(result.size(), 3u);
+    EXPECT_STREQ(result[0].c_str(), "素直にあやまるしか");
+    EXPECT_STREQ(result[1].c_str(), "警察にも先生にも町中の人達に！！");
+    EXPECT_TRUE(result[2].empty());
+}
+#endif
+
 class MocrxxReadTest : public ::testing::Test
 {
 protected:
@@ -391,3 +477,194 @@ TEST_F(MocrxxReadTest, BasicMultiAsync)
     basic2.wait();
     basic3.wait();
 }
+
+TEST_F(MocrxxReadTest, Strided)
+{
+    int width, height, channels;
+    stbi_uc *data = stbi_load("data/00.jpg", &width, &height, &channels, 3);
+    ASSERT_NE(data, nullptr);
+
+    size_t row_bytes = width * 3;
+    size_t stride = row_bytes + 32;
+    std::vector<unsigned char> padded(stride * height, 0);
+    for (int y = 0; y < height; ++y)
+    {
+        memcpy(&padded[y * stride], &data[y * row_bytes], row_bytes);
+    }
+    stbi_image_free(data);
+
+    std::string text =
+        ctx.read(padded.data(), width, height, stride, mocr::mode::RGB);
+    EXPECT_STREQ(text.c_str(), "素直にあやまるしか");
+}
+
+TEST_F(MocrxxReadTest, PageRegions)
+{
+    int width, height, channels;
+    stbi_uc *data = stbi_load("data/00.jpg", &width, &height, &channels, 3);
+    ASSERT_NE(data, nullptr);
+
+    mocr::page page(ctx, data, width, height, 0, mocr::mode::RGB);
+    ASSERT_TRUE(page.valid());
+    std::vector<std::string> texts = page.read({
+        {0, 0, (size_t)width, (size_t)height},
+        {0, 0, (size_t)width, (size_t)height},
+    });
+    ASSERT_EQ(texts.size(), 2u);
+    EXPECT_STREQ(texts[0].c_str(), "素直にあやまるしか");
+    EXPECT_STREQ(texts[1].c_str(), "素直にあやまるしか");
+
+    stbi_image_free(data);
+}
+
+TEST_F(MocrxxReadTest, CoalescedAsync)
+{
+    ASSERT_TRUE(ctx.set_option(mocr::option::BatchSize, 4));
+    ASSERT_TRUE(ctx.set_option(mocr::option::BatchWaitUs, 50000));
+
+    std::future<void> basic0 =
+        test_file_async("data/00.jpg", "素直にあやまるしか");
+    std::future<void> basic2 =
+        test_file_async("data/02.jpg", "実戦剣術も一流です");
+    std::future<void> basic5 = test_file_async("data/05.jpg", "ぎゃっ");
+    std::future<void> basic11 =
+        test_file_async("data/11.jpg", "警察にも先生にも町中の人達に！！");
+
+    basic0.wait();
+    basic2.wait();
+    basic5.wait();
+    basic11.wait();
+
+    ASSERT_TRUE(ctx.set_option(mocr::option::BatchSize, 1));
+    test_file("data/06.jpg", "ピンポーーン");
+}
+
+TEST_F(MocrxxReadTest, ExecutorAsync)
+{
+    ASSERT_TRUE(ctx.set_option(mocr::option::ExecutorThreads, 1));
+
+    std::future<void> basic0 =
+        test_file_async("data/00.jpg", "素直にあやまるしか");
+    std::future<void> basic2 =
+        test_file_async("data/02.jpg", "実戦剣術も一流です");
+    std::future<void> basic5 = test_file_async("data/05.jpg", "ぎゃっ");
+    std::future<void> basic11 =
+        test_file_async("data/11.jpg", "警察にも先生にも町中の人達に！！");
+
+    basic0.wait();
+    basic2.wait();
+    basic5.wait();
+    basic11.wait();
+
+    ASSERT_TRUE(ctx.set_option(mocr::option::ExecutorThreads, 0));
+    test_file("data/06.jpg", "ピンポーーン");
+}
+
+TEST_F(MocrxxReadTest, ReadAsync)
+{
+    int width, height, channels;
+    stbi_uc *data = stbi_load("data/00.jpg", &width, &height, &channels, 3);
+    ASSERT_NE(data, nullptr);
+
+    std::future<std::string> text =
+        ctx.read_async(data, width, height, mocr::mode::RGB);
+    EXPECT_STREQ(text.get().c_str(), "素直にあやまるしか");
+
+    stbi_image_free(data);
+}
+
+TEST(MocrxxPoolTest, Leases)
+{
+    mocr::pool pool("kha-white/manga-ocr-base", false, 2);
+    ASSERT_TRUE(pool.valid());
+    ASSERT_EQ(pool.size(), 2u);
+
+    auto read = [&pool](const char *path, const char *expected) {
+        mocr::pool::lease lease = pool.acquire();
+        ASSERT_TRUE(lease.valid());
+        EXPECT_STREQ(lease->read(path).c_str(), expected);
+    };
+    std::future<void> basic0 = std::async(
+        std::launch::async, read, "data/00.jpg", "素直にあやまるしか"
+    );
+    std::future<void> basic2 = std::async(
+        std::launch::async, read, "data/02.jpg", "実戦剣術も一流です"
+    );
+    std::future<void> basic5 =
+        std::async(std::launch::async, read, "data/05.jpg", "ぎゃっ");
+    basic0.wait();
+    basic2.wait();
+    basic5.wait();
+
+    mocr::pool::lease lease1 = pool.acquire(0);
+    mocr::pool::lease lease2 = pool.acquire(0);
+    ASSERT_TRUE(lease1.valid());
+    ASSERT_TRUE(lease2.valid());
+    EXPECT_FALSE(pool.acquire(0).valid());
+
+    mocr::pool_stats stats;
+    ASSERT_TRUE(pool.get_stats(0, stats));
+    EXPECT_TRUE(stats.busy);
+    uint64_t checkouts = stats.checkouts;
+    ASSERT_TRUE(pool.get_stats(1, stats));
+    EXPECT_EQ(checkouts + stats.checkouts, 5u);
+}
+
+TEST_F(MocrxxReadTest, Batch)
+{
+    int width0, height0, width1, height1, channels;
+    stbi_uc *data0 = stbi_load("data/02.jpg", &width0, &height0, &channels, 3);
+    ASSERT_NE(data0, nullptr);
+    stbi_uc *data1 = stbi_load("data/09.jpg", &width1, &height1, &channels, 1);
+    ASSERT_NE(data1, nullptr);
+
+    std::vector<std::string> texts = ctx.read({
+        {data0, (size_t)width0, (size_t)height0, 0, mocr::mode::RGB},
+        {data1, (size_t)width1, (size_t)height1, 0, mocr::mode::L},
+    });
+    ASSERT_EQ(texts.size(), 2u);
+    EXPECT_STREQ(texts[0].c_str(), "実戦剣術も一流です");
+    EXPECT_STREQ(texts[1].c_str(), "少し黙っている");
+
+    stbi_image_free(data0);
+    stbi_image_free(data1);
+}
+
+TEST_F(MocrxxReadTest, NativePreprocess)
+{
+    ASSERT_TRUE(ctx.set_option(mocr::option::NativePreprocess, 1));
+    int64_t value = 0;
+    ASSERT_TRUE(ctx.get_option(mocr::option::NativePreprocess, value));
+    EXPECT_EQ(value, 1);
+
+    test_file("data/00.jpg", "素直にあやまるしか");
+    test_file("data/11.jpg", "警察にも先生にも町中の人達に！！");
+}
+
+TEST_F(MocrxxReadTest, Overload)
+{
+    ASSERT_TRUE(ctx.set_option(mocr::option::MaxPending, 1));
+    ASSERT_TRUE(ctx.set_option(
+        mocr::option::Overload, static_cast<int64_t>(mocr::overload::Fail)
+    ));
+    int64_t value = -1;
+    ASSERT_TRUE(ctx.get_option(mocr::option::Overload, value));
+    EXPECT_EQ(value, static_cast<int64_t>(mocr::overload::Fail));
+    EXPECT_FALSE(ctx.set_option(mocr::option::Overload, 3));
+
+    /* A read on its own always fits */
+    test_file("data/11.jpg", "警察にも先生にも町中の人達に！！");
+}
+
+TEST_F(MocrxxReadTest, Cache)
+{
+    ASSERT_TRUE(ctx.set_option(mocr::option::CacheBytes, 1 << 20));
+    test_file("data/11.jpg", "警察にも先生にも町中の人達に！！");
+    test_file("data/11.jpg", "警察にも先生にも町中の人達に！！");
+
+    mocr::cache_stats stats;
+    ASSERT_TRUE(ctx.get_cache_stats(stats));
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.misses, 1u);
+    EXPECT_EQ(stats.entries, 1u);
+}